@@ -0,0 +1,963 @@
+/*
+ * adaptive_engine.cpp - 原生自适应故障注入引擎
+ *
+ * 流程（与 adaptive_injector.py 的 run_adaptive_injection 相同）：
+ *   1. 读取 unified_tracer 输出，按 exec_count 排序，depth=0 的崩溃寄存器入队
+ *   2. 每个目标注错 injections_per_target 次（第 i 次注错在第 i 次执行时）
+ *   3. 崩溃率 > 阈值时，把该寄存器 depth+1 的溯源点加入队列
+ *
+ * 不同之处：注错不再逐次串行执行，而是由固定大小的进程池并发运行，
+ * 每个 pin 进程在 exec 前绑定到一个 CPU 核；队首目标的注错次数未排满时
+ * 继续排它，排满后立即开始下一个目标，进程池始终保持满载
+ *
+ * -stop wilson / sprt 时每个目标做序贯检验：崩溃率确定在阈值一侧即停止，
+ * 省下的配额分给仍不确定的目标
+ */
+
+#include "adaptive_engine.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+// ========== 全局状态 ==========
+
+EngineConfig g_config;
+uint64_t g_img_base_addr = 0;
+std::vector<CrashScenario> g_scenarios;
+
+std::deque<InjectionTarget> g_targets;          // 所有已创建的目标（下标稳定）
+std::deque<size_t> g_queue;                     // 待注错目标
+std::vector<size_t> g_active;                   // 注错次数尚未排满的目标
+std::vector<size_t> g_completed;                // 按完成顺序
+std::set<std::pair<uint64_t, std::string> > g_seen;    // 已开始或已完成的 (offset, reg)
+
+std::vector<RunningJob> g_running;
+std::vector<int> g_free_cpus;
+uint32_t g_started_targets = 0;
+uint32_t g_seed_base = 0;
+uint64_t g_launched = 0;
+
+int64_t g_budget = 0;       // 序贯模式的剩余配额：目标开始时 +injections_per_target，每次注错 -1
+double g_z = 1.96;          // Wilson 区间的正态分位数
+
+// ========== JSON 解析 ==========
+
+const JsonValue* JsonValue::get(const char* key) const {
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (fields[i].first == key) return &fields[i].second;
+    }
+    return NULL;
+}
+
+uint64_t JsonValue::as_u64() const {
+    if (type == J_NUMBER) return (uint64_t)number;
+    if (type == J_STRING) return strtoull(str.c_str(), NULL, 0);
+    return 0;
+}
+
+const std::string& JsonValue::as_str() const {
+    static const std::string empty;
+    return type == J_STRING ? str : empty;
+}
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : s_(text), pos_(0) {}
+
+    bool parse(JsonValue& out) {
+        skip_ws();
+        if (!parse_value(out)) return false;
+        skip_ws();
+        return pos_ == s_.size();
+    }
+
+private:
+    const std::string& s_;
+    size_t pos_;
+
+    void skip_ws() {
+        while (pos_ < s_.size() && (s_[pos_] == ' ' || s_[pos_] == '\n' ||
+                                    s_[pos_] == '\r' || s_[pos_] == '\t')) {
+            pos_++;
+        }
+    }
+
+    bool literal(const char* word) {
+        size_t len = strlen(word);
+        if (s_.compare(pos_, len, word) != 0) return false;
+        pos_ += len;
+        return true;
+    }
+
+    bool parse_value(JsonValue& v) {
+        if (pos_ >= s_.size()) return false;
+        char c = s_[pos_];
+        if (c == '{') return parse_object(v);
+        if (c == '[') return parse_array(v);
+        if (c == '"') { v.type = JsonValue::J_STRING; return parse_string(v.str); }
+        if (c == 't') { v.type = JsonValue::J_BOOL; v.boolean = true; return literal("true"); }
+        if (c == 'f') { v.type = JsonValue::J_BOOL; v.boolean = false; return literal("false"); }
+        if (c == 'n') { v.type = JsonValue::J_NULL; return literal("null"); }
+
+        const char* begin = s_.c_str() + pos_;
+        char* end = NULL;
+        v.type = JsonValue::J_NUMBER;
+        v.number = strtod(begin, &end);
+        if (end == begin) return false;
+        pos_ += end - begin;
+        return true;
+    }
+
+    static void append_utf8(std::string& out, unsigned cp) {
+        if (cp < 0x80) {
+            out += (char)cp;
+        } else if (cp < 0x800) {
+            out += (char)(0xC0 | (cp >> 6));
+            out += (char)(0x80 | (cp & 0x3F));
+        } else {
+            out += (char)(0xE0 | (cp >> 12));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+
+    bool parse_string(std::string& out) {
+        pos_++;    // '"'
+        out.clear();
+        while (pos_ < s_.size()) {
+            char c = s_[pos_++];
+            if (c == '"') return true;
+            if (c != '\\') { out += c; continue; }
+            if (pos_ >= s_.size()) return false;
+            char e = s_[pos_++];
+            switch (e) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u':
+                    if (pos_ + 4 > s_.size()) return false;
+                    append_utf8(out, (unsigned)strtoul(s_.substr(pos_, 4).c_str(), NULL, 16));
+                    pos_ += 4;
+                    break;
+                default: out += e; break;    // \" \\ \/
+            }
+        }
+        return false;
+    }
+
+    bool parse_array(JsonValue& v) {
+        v.type = JsonValue::J_ARRAY;
+        pos_++;
+        skip_ws();
+        if (pos_ < s_.size() && s_[pos_] == ']') { pos_++; return true; }
+        while (true) {
+            v.items.push_back(JsonValue());
+            skip_ws();
+            if (!parse_value(v.items.back())) return false;
+            skip_ws();
+            if (pos_ >= s_.size()) return false;
+            if (s_[pos_] == ']') { pos_++; return true; }
+            if (s_[pos_++] != ',') return false;
+        }
+    }
+
+    bool parse_object(JsonValue& v) {
+        v.type = JsonValue::J_OBJECT;
+        pos_++;
+        skip_ws();
+        if (pos_ < s_.size() && s_[pos_] == '}') { pos_++; return true; }
+        while (true) {
+            skip_ws();
+            if (pos_ >= s_.size() || s_[pos_] != '"') return false;
+            v.fields.push_back(std::make_pair(std::string(), JsonValue()));
+            if (!parse_string(v.fields.back().first)) return false;
+            skip_ws();
+            if (pos_ >= s_.size() || s_[pos_++] != ':') return false;
+            skip_ws();
+            if (!parse_value(v.fields.back().second)) return false;
+            skip_ws();
+            if (pos_ >= s_.size()) return false;
+            if (s_[pos_] == '}') { pos_++; return true; }
+            if (s_[pos_++] != ',') return false;
+        }
+    }
+};
+
+// ========== 读取 unified_tracer 输出 ==========
+
+void scenario_from_json(const JsonValue& inst, CrashScenario& sc) {
+    sc.offset = inst.get("offset") ? inst.get("offset")->as_u64() : 0;
+    sc.disasm = inst.get("disasm") ? inst.get("disasm")->as_str() : "";
+    sc.cp_type = inst.get("type") ? inst.get("type")->as_str() : "";
+    sc.exec_count = inst.get("exec_count") ? inst.get("exec_count")->as_u64() : 0;
+    sc.traced_count = inst.get("traced_count") ? inst.get("traced_count")->as_u64() : 0;
+
+    const JsonValue* regs = inst.get("crash_regs");
+    if (regs) {
+        for (size_t i = 0; i < regs->items.size(); i++) {
+            sc.crash_regs.push_back(regs->items[i].as_str());
+        }
+    }
+
+    const JsonValue* traces = inst.get("register_traces");
+    if (!traces) return;
+    for (size_t i = 0; i < traces->fields.size(); i++) {
+        std::vector<SourceInfo>& list = sc.register_traces[traces->fields[i].first];
+        const std::vector<JsonValue>& sources = traces->fields[i].second.items;
+        for (size_t j = 0; j < sources.size(); j++) {
+            SourceInfo src;
+            src.offset = sources[j].get("offset") ? sources[j].get("offset")->as_u64() : 0;
+            src.disasm = sources[j].get("disasm") ? sources[j].get("disasm")->as_str() : "";
+            src.depth = sources[j].get("depth") ? (int)sources[j].get("depth")->number : 0;
+            src.hit_count = sources[j].get("hit_count") ? sources[j].get("hit_count")->as_u64() : 0;
+            src.exec_count = sources[j].get("exec_count") ? sources[j].get("exec_count")->as_u64() : 0;
+            list.push_back(src);
+        }
+    }
+}
+
+/*
+ * 读取一个输出文件（JSON 或 JSONL，JSONL 每行以 "record" 标记类型）
+ * 按线程输出时主文件只含 thread_files 列表
+ */
+bool load_output(const std::string& path, std::vector<CrashScenario>& insts,
+                 std::vector<std::string>& thread_files) {
+    std::ifstream in(path.c_str());
+    if (!in.is_open()) {
+        fprintf(stderr, "[AdaptiveEngine] 无法打开溯源结果: %s\n", path.c_str());
+        return false;
+    }
+    std::stringstream buf;
+    buf << in.rdbuf();
+    std::string text = buf.str();
+
+    std::vector<JsonValue> objects;
+    if (text.compare(0, 9, "{\"record\"") == 0) {
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            objects.push_back(JsonValue());
+            if (!JsonParser(line).parse(objects.back())) {
+                fprintf(stderr, "[AdaptiveEngine] JSONL 解析失败: %s\n", path.c_str());
+                return false;
+            }
+        }
+    } else {
+        objects.push_back(JsonValue());
+        if (!JsonParser(text).parse(objects.back())) {
+            fprintf(stderr, "[AdaptiveEngine] JSON 解析失败: %s\n", path.c_str());
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < objects.size(); i++) {
+        const JsonValue& obj = objects[i];
+        const JsonValue* record = obj.get("record");
+        const std::string kind = record ? record->as_str() : "";
+
+        const JsonValue* config = record ? (kind == "config" ? &obj : NULL) : obj.get("config");
+        if (config && config->get("img_base_addr")) {
+            g_img_base_addr = config->get("img_base_addr")->as_u64();
+        }
+
+        if (kind == "inst") {
+            insts.push_back(CrashScenario());
+            scenario_from_json(obj, insts.back());
+        } else if (!record && obj.get("crashprone_insts")) {
+            const std::vector<JsonValue>& list = obj.get("crashprone_insts")->items;
+            for (size_t j = 0; j < list.size(); j++) {
+                insts.push_back(CrashScenario());
+                scenario_from_json(list[j], insts.back());
+            }
+        }
+
+        const JsonValue* files = record ? (kind == "thread_files" ? obj.get("files") : NULL)
+                                        : obj.get("thread_files");
+        if (files) {
+            for (size_t j = 0; j < files->items.size(); j++) {
+                thread_files.push_back(files->items[j].as_str());
+            }
+        }
+    }
+    return true;
+}
+
+// 合并不同线程中同一易崩溃指令的记录（同 adaptive_injector.py 的 _merge_inst）
+void merge_scenario(CrashScenario& exist, const CrashScenario& inst) {
+    exist.exec_count += inst.exec_count;
+    exist.traced_count += inst.traced_count;
+    for (std::map<std::string, std::vector<SourceInfo> >::const_iterator it = inst.register_traces.begin();
+         it != inst.register_traces.end(); ++it) {
+        std::vector<SourceInfo>& sources = exist.register_traces[it->first];
+        for (size_t i = 0; i < it->second.size(); i++) {
+            const SourceInfo& src = it->second[i];
+            size_t j = 0;
+            while (j < sources.size() && sources[j].offset != src.offset) j++;
+            if (j < sources.size()) {
+                sources[j].hit_count += src.hit_count;
+                sources[j].exec_count += src.exec_count;
+            } else {
+                sources.push_back(src);
+            }
+        }
+    }
+}
+
+bool load_scenarios(const std::string& path) {
+    std::vector<std::string> thread_files;
+    if (!load_output(path, g_scenarios, thread_files)) return false;
+    if (thread_files.empty()) return true;
+
+    std::map<uint64_t, size_t> by_offset;
+    std::vector<CrashScenario> merged;
+    for (size_t f = 0; f < thread_files.size(); f++) {
+        std::vector<CrashScenario> insts;
+        std::vector<std::string> unused;
+        if (!load_output(thread_files[f], insts, unused)) return false;
+        for (size_t i = 0; i < insts.size(); i++) {
+            std::map<uint64_t, size_t>::iterator it = by_offset.find(insts[i].offset);
+            if (it == by_offset.end()) {
+                by_offset[insts[i].offset] = merged.size();
+                merged.push_back(insts[i]);
+            } else {
+                merge_scenario(merged[it->second], insts[i]);
+            }
+        }
+    }
+    g_scenarios.swap(merged);
+    return true;
+}
+
+// ========== 序贯检验 ==========
+
+// 双侧置信度对应的标准正态分位数（二分求解）
+double normal_quantile(double confidence) {
+    double tail = (1 - confidence) / 2;
+    double lo = 0, hi = 10;
+    for (int i = 0; i < 100; i++) {
+        double mid = (lo + hi) / 2;
+        if (0.5 * erfc(mid / sqrt(2.0)) > tail) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo + hi) / 2;
+}
+
+// 崩溃率的 Wilson 置信区间
+void wilson_interval(uint32_t crashes, uint32_t n, double& low, double& high) {
+    if (n == 0) {
+        low = 0;
+        high = 1;
+        return;
+    }
+    double z2 = g_z * g_z;
+    double p = (double)crashes / n;
+    double denom = 1 + z2 / n;
+    double center = (p + z2 / (2.0 * n)) / denom;
+    double half = g_z * sqrt(p * (1 - p) / n + z2 / (4.0 * n * n)) / denom;
+    low = center - half;
+    high = center + half;
+}
+
+/*
+ * 按停止规则判定崩溃率在阈值哪一侧；样本不足或仍不确定时返回 DECISION_NONE
+ */
+Decision decide(const InjectionTarget& target) {
+    uint32_t n = target.injection_count;
+    if (g_config.stop_rule == STOP_FIXED || n < g_config.min_injections) return DECISION_NONE;
+
+    double threshold = g_config.crash_threshold;
+    if (g_config.stop_rule == STOP_WILSON) {
+        double low, high;
+        wilson_interval(target.crash_count, n, low, high);
+        if (low > threshold) return DECISION_ABOVE;
+        if (high <= threshold) return DECISION_BELOW;
+        return DECISION_NONE;
+    }
+
+    // SPRT：H0 p = 阈值 - delta，H1 p = 阈值 + delta
+    double p0 = std::max(threshold - g_config.sprt_delta, 1e-6);
+    double p1 = std::min(threshold + g_config.sprt_delta, 1 - 1e-6);
+    double alpha = 1 - g_config.confidence;
+    uint32_t c = target.crash_count;
+    double llr = c * log(p1 / p0) + (n - c) * log((1 - p1) / (1 - p0));
+    if (llr >= log((1 - alpha) / alpha)) return DECISION_ABOVE;
+    if (llr <= log(alpha / (1 - alpha))) return DECISION_BELOW;
+    return DECISION_NONE;
+}
+
+const char* stop_rule_name(StopRule rule) {
+    switch (rule) {
+        case STOP_WILSON: return "wilson";
+        case STOP_SPRT:   return "sprt";
+        default:          return "fixed";
+    }
+}
+
+const char* decision_name(const InjectionTarget& target) {
+    switch (target.decision) {
+        case DECISION_ABOVE: return "above";
+        case DECISION_BELOW: return "below";
+        default: return g_config.stop_rule == STOP_FIXED ? "fixed" : "undecided";
+    }
+}
+
+// 追加配额的优先级：区间越宽越优先，可按执行次数加权
+double extra_priority(const InjectionTarget& target) {
+    double low, high;
+    wilson_interval(target.crash_count, target.injection_count, low, high);
+    double priority = high - low;
+    if (g_config.weight_exec) priority *= log2(2.0 + (double)target.exec_count);
+    return priority;
+}
+
+// 目标是否还能再注错（不看是否有空闲进程）
+bool can_continue(const InjectionTarget& target) {
+    if (target.decision != DECISION_NONE) return false;
+    if (target.scheduled < g_config.injections_per_target) return true;
+    if (g_config.stop_rule == STOP_FIXED) return false;
+    return target.scheduled < g_config.max_injections && g_budget > 0;
+}
+
+// ========== 注错队列 ==========
+
+bool exec_count_greater(const CrashScenario& a, const CrashScenario& b) {
+    return a.exec_count > b.exec_count;
+}
+
+bool target_exec_greater(const InjectionTarget& a, const InjectionTarget& b) {
+    return a.exec_count > b.exec_count;
+}
+
+void enqueue_target(const InjectionTarget& target) {
+    if (g_seen.count(std::make_pair(target.offset, target.reg))) return;
+    g_targets.push_back(target);
+    g_queue.push_back(g_targets.size() - 1);
+}
+
+void initialize_queue() {
+    std::stable_sort(g_scenarios.begin(), g_scenarios.end(), exec_count_greater);
+    if (g_config.top_n > 0 && g_scenarios.size() > g_config.top_n) {
+        g_scenarios.resize(g_config.top_n);
+    }
+
+    for (size_t i = 0; i < g_scenarios.size(); i++) {
+        const CrashScenario& sc = g_scenarios[i];
+        for (size_t r = 0; r < sc.crash_regs.size(); r++) {
+            InjectionTarget target;
+            target.offset = sc.offset;
+            target.reg = sc.crash_regs[r];
+            target.disasm = sc.disasm;
+            target.depth = 0;
+            target.scenario = i;
+            target.exec_count = sc.exec_count;
+            g_targets.push_back(target);
+            g_queue.push_back(g_targets.size() - 1);
+        }
+    }
+    printf("[初始化] 注错队列中有 %zu 个初始目标\n", g_queue.size());
+}
+
+/*
+ * 选出下一次注错的目标，依次为：
+ *   1. 已开始目标的首批注错（固定模式为全部配额，序贯模式为 min_injections）
+ *   2. 队首新目标
+ *   3. 基础配额内仍不确定的目标
+ *   4. 提前停止的目标省下的配额，分给最不确定的目标（不超过 max_injections）
+ * 返回 false 表示当前没有可排的注错
+ */
+bool next_injection(size_t& target_idx) {
+    uint32_t first_batch = g_config.injections_per_target;
+    if (g_config.stop_rule != STOP_FIXED) first_batch = std::min(first_batch, g_config.min_injections);
+
+    for (size_t i = 0; i < g_active.size(); i++) {
+        const InjectionTarget& target = g_targets[g_active[i]];
+        if (target.decision == DECISION_NONE && target.scheduled < first_batch) {
+            target_idx = g_active[i];
+            return true;
+        }
+    }
+
+    while (!g_queue.empty() && g_started_targets < g_config.max_targets) {
+        size_t idx = g_queue.front();
+        g_queue.pop_front();
+        g_started_targets++;
+
+        InjectionTarget& target = g_targets[idx];
+        if (!g_seen.insert(std::make_pair(target.offset, target.reg)).second) continue;
+
+        g_active.push_back(idx);
+        g_budget += g_config.injections_per_target;
+        target_idx = idx;
+        return true;
+    }
+
+    for (size_t i = 0; i < g_active.size(); i++) {
+        const InjectionTarget& target = g_targets[g_active[i]];
+        if (target.decision == DECISION_NONE && target.scheduled < g_config.injections_per_target) {
+            target_idx = g_active[i];
+            return true;
+        }
+    }
+
+    if (g_config.stop_rule == STOP_FIXED || g_budget <= 0) return false;
+
+    // 同一目标同时在跑的追加注错不超过首批大小，避免结论出来后仍有大量在途注错
+    double best = -1;
+    for (size_t i = 0; i < g_active.size(); i++) {
+        const InjectionTarget& target = g_targets[g_active[i]];
+        if (!can_continue(target) || target.scheduled - target.injection_count >= first_batch) continue;
+        double priority = extra_priority(target);
+        if (priority > best) {
+            best = priority;
+            target_idx = g_active[i];
+        }
+    }
+    return best >= 0;
+}
+
+// 目标注错结束：记录结果，崩溃率超过阈值时加入下一层溯源点
+void finish_target(size_t idx) {
+    g_active.erase(std::find(g_active.begin(), g_active.end(), idx));
+    g_completed.push_back(idx);
+
+    const InjectionTarget& target = g_targets[idx];
+    printf("\n[目标 %zu] [Depth %d] 0x%lx - %s (%s)\n", g_completed.size(), target.depth,
+           target.offset, target.disasm.c_str(), target.reg.c_str());
+    printf("  结果: 崩溃率 %.1f%% (崩溃:%u 挂起:%u 良性:%u) 判定:%s\n", target.crash_rate() * 100,
+           target.crash_count, target.hang_count, target.benign_count, decision_name(target));
+
+    // 序贯判定优先；固定次数或用完配额仍不确定时按点估计
+    bool above = target.decision == DECISION_NONE ? target.crash_rate() > g_config.crash_threshold
+                                                  : target.decision == DECISION_ABOVE;
+    if (!above) {
+        printf("  ✓ 崩溃率低于阈值，不溯源\n");
+        return;
+    }
+    printf("  → 崩溃率超过阈值 %.1f%%，添加溯源点\n", g_config.crash_threshold * 100);
+
+    const CrashScenario& sc = g_scenarios[target.scenario];
+    std::map<std::string, std::vector<SourceInfo> >::const_iterator it = sc.register_traces.find(target.reg);
+    if (it == sc.register_traces.end()) return;
+
+    int next_depth = target.depth + 1;
+    std::vector<InjectionTarget> children;
+    for (size_t i = 0; i < it->second.size(); i++) {
+        const SourceInfo& src = it->second[i];
+        if (src.depth != next_depth) continue;
+        if (g_seen.count(std::make_pair(src.offset, target.reg))) continue;
+
+        InjectionTarget child;
+        child.offset = src.offset;
+        child.reg = target.reg;
+        child.disasm = src.disasm;
+        child.depth = src.depth;
+        child.parent_offset = sc.offset;
+        child.scenario = target.scenario;
+        // 旧版 tracer 输出没有源指令执行次数，用命中次数代替
+        child.exec_count = src.exec_count ? src.exec_count : src.hit_count;
+        children.push_back(child);
+    }
+    if (g_config.weight_exec) {
+        std::stable_sort(children.begin(), children.end(), target_exec_greater);
+    }
+
+    for (size_t i = 0; i < children.size(); i++) {
+        printf("    + 0x%lx (%s) depth=%d\n", children[i].offset, children[i].reg.c_str(), children[i].depth);
+        enqueue_target(children[i]);
+    }
+    if (children.empty()) {
+        printf("    (没有 depth=%d 的未处理溯源点)\n", next_depth);
+    }
+}
+
+// 结束没有在途注错且不能继续的目标；有目标结束时返回 true（队列可能新增目标）
+bool finish_idle_targets() {
+    bool finished = false;
+    size_t i = 0;
+    while (i < g_active.size()) {
+        const InjectionTarget& target = g_targets[g_active[i]];
+        if (target.injection_count == target.scheduled && !can_continue(target)) {
+            finish_target(g_active[i]);    // 从 g_active 中移除下标 i
+            finished = true;
+        } else {
+            i++;
+        }
+    }
+    return finished;
+}
+
+// ========== 进程池 ==========
+
+double elapsed_sec(const struct timespec& since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since.tv_sec) + (now.tv_nsec - since.tv_nsec) / 1e9;
+}
+
+/*
+ * 启动一次注错：fork 后子进程自成进程组（超时时整组杀掉），
+ * 绑定到 cpu，输出重定向到 /dev/null，再 exec pin
+ */
+bool launch_injection(size_t target_idx, int cpu) {
+    InjectionTarget& target = g_targets[target_idx];
+    uint32_t kth = ++target.scheduled;
+    g_budget--;
+
+    // 参数在 fork 前准备好，子进程只做系统调用
+    char offset_buf[32], kth_buf[32], seed_buf[32];
+    snprintf(offset_buf, sizeof(offset_buf), "0x%lx", target.offset);
+    snprintf(kth_buf, sizeof(kth_buf), "%u", kth);
+    // 同一秒内启动的注错进程种子各不相同，随机比特不会重复
+    uint32_t seed = g_seed_base + (uint32_t)(++g_launched);
+    snprintf(seed_buf, sizeof(seed_buf), "%u", seed == 0 ? 1 : seed);
+
+    std::vector<std::string> args;
+    args.push_back(g_config.pin_bin);
+    args.push_back("-t");
+    args.push_back(g_config.fi_tool);
+    args.push_back("-target_offset");
+    args.push_back(offset_buf);
+    args.push_back("-target_reg");
+    args.push_back(target.reg);
+    args.push_back("-target_kth");
+    args.push_back(kth_buf);
+    args.push_back("-inject_bit");
+    args.push_back("-1");
+    args.push_back("-seed");
+    args.push_back(seed_buf);
+    args.push_back("-o");
+    args.push_back("/dev/null");
+    args.push_back("--");
+    args.insert(args.end(), g_config.program.begin(), g_config.program.end());
+
+    std::vector<char*> argv;
+    for (size_t i = 0; i < args.size(); i++) argv.push_back(const_cast<char*>(args[i].c_str()));
+    argv.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "[AdaptiveEngine] fork 失败: %s\n", strerror(errno));
+        target.scheduled--;
+        g_budget++;
+        return false;
+    }
+    if (pid == 0) {
+        setpgid(0, 0);
+        if (cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+        int devnull = open("/dev/null", O_RDWR);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+        execv(argv[0], &argv[0]);
+        _exit(127);
+    }
+    setpgid(pid, pid);    // 与子进程中的调用竞争无妨，避免 kill 时进程组尚未建立
+
+    RunningJob job;
+    job.pid = pid;
+    job.cpu = cpu;
+    job.target = target_idx;
+    clock_gettime(CLOCK_MONOTONIC, &job.start);
+    job.timed_out = false;
+    g_running.push_back(job);
+    return true;
+}
+
+// 分类规则同 inject_once：超时=挂起，信号或非零退出码=崩溃
+InjectOutcome classify(const RunningJob& job, int status) {
+    if (job.timed_out) return OUTCOME_HANG;
+    if (WIFSIGNALED(status)) return OUTCOME_CRASH;
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0) return OUTCOME_CRASH;
+    return OUTCOME_BENIGN;
+}
+
+void record_outcome(const RunningJob& job, int status) {
+    InjectionTarget& target = g_targets[job.target];
+    target.injection_count++;
+    switch (classify(job, status)) {
+        case OUTCOME_CRASH:  target.crash_count++; break;
+        case OUTCOME_HANG:   target.hang_count++; break;
+        case OUTCOME_BENIGN: target.benign_count++; break;
+    }
+    // 判定一旦做出不再改变，之后完成的在途注错只计入统计
+    if (target.decision == DECISION_NONE) {
+        target.decision = decide(target);
+    }
+}
+
+/*
+ * 回收已结束的进程并杀掉超时进程；返回回收的进程数
+ */
+size_t reap_jobs() {
+    size_t reaped = 0;
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (size_t i = 0; i < g_running.size(); i++) {
+            if (g_running[i].pid != pid) continue;
+            RunningJob job = g_running[i];
+            g_running.erase(g_running.begin() + i);
+            g_free_cpus.push_back(job.cpu);
+            record_outcome(job, status);
+            reaped++;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < g_running.size(); i++) {
+        RunningJob& job = g_running[i];
+        if (!job.timed_out && elapsed_sec(job.start) > g_config.timeout_sec) {
+            job.timed_out = true;
+            kill(-job.pid, SIGKILL);
+        }
+    }
+    return reaped;
+}
+
+// 可用 CPU 列表（遵循 taskset / cgroup 限制）
+std::vector<int> available_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &set)) cpus.push_back(c);
+        }
+    }
+    return cpus;
+}
+
+void run_campaign() {
+    std::vector<int> cpus = available_cpus();
+    uint32_t jobs = g_config.jobs;
+    if (jobs == 0) jobs = cpus.empty() ? 1 : (uint32_t)cpus.size();
+
+    // 进程数多于 CPU 时轮流复用，-1 表示不绑定
+    for (uint32_t i = 0; i < jobs; i++) {
+        g_free_cpus.push_back(cpus.empty() ? -1 : cpus[i % cpus.size()]);
+    }
+    std::reverse(g_free_cpus.begin(), g_free_cpus.end());
+
+    printf("[AdaptiveEngine] 并发注错进程: %u，每目标 %u 次，超时 %u 秒\n",
+           jobs, g_config.injections_per_target, g_config.timeout_sec);
+    if (g_config.stop_rule != STOP_FIXED) {
+        printf("[AdaptiveEngine] 序贯停止: %s，置信度 %.3f，每目标 %u - %u 次\n",
+               stop_rule_name(g_config.stop_rule), g_config.confidence,
+               g_config.min_injections, g_config.max_injections);
+    }
+
+    while (true) {
+        size_t target_idx;
+        while (!g_free_cpus.empty() && next_injection(target_idx)) {
+            int cpu = g_free_cpus.back();
+            g_free_cpus.pop_back();
+            if (!launch_injection(target_idx, cpu)) {
+                g_free_cpus.push_back(cpu);
+                break;
+            }
+        }
+        if (finish_idle_targets()) continue;
+        if (g_running.empty()) break;
+
+        if (reap_jobs() == 0) {
+            struct timespec nap = {0, 2000000};    // 2ms；单次注错通常在秒级
+            nanosleep(&nap, NULL);
+        }
+    }
+
+    printf("\n[完成] 注错循环结束，共处理 %zu 个目标\n", g_completed.size());
+}
+
+// ========== 输出 ==========
+
+void write_json_string(FILE* fp, const std::string& s) {
+    fputc('"', fp);
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            fputc('\\', fp);
+            fputc(c, fp);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+// 格式与 adaptive_injector.py 的 save_results 相同
+bool save_results(const std::string& path) {
+    FILE* fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "[AdaptiveEngine] 无法创建输出文件: %s\n", path.c_str());
+        return false;
+    }
+
+    fprintf(fp, "{\n  \"config\": {\n");
+    fprintf(fp, "    \"img_base_addr\": \"0x%lx\",\n", g_img_base_addr);
+    fprintf(fp, "    \"crash_threshold\": %g,\n", g_config.crash_threshold);
+    fprintf(fp, "    \"injections_per_target\": %u,\n", g_config.injections_per_target);
+    fprintf(fp, "    \"stop_rule\": \"%s\",\n", stop_rule_name(g_config.stop_rule));
+    fprintf(fp, "    \"min_injections\": %u,\n", g_config.min_injections);
+    fprintf(fp, "    \"max_injections\": %u,\n", g_config.max_injections);
+    fprintf(fp, "    \"confidence\": %g,\n", g_config.confidence);
+    fprintf(fp, "    \"timeout\": %u\n  },\n  \"targets\": [", g_config.timeout_sec);
+
+    uint64_t total_injections = 0, total_crashes = 0;
+    size_t decided = 0;
+    for (size_t i = 0; i < g_completed.size(); i++) {
+        const InjectionTarget& t = g_targets[g_completed[i]];
+        total_injections += t.injection_count;
+        total_crashes += t.crash_count;
+        if (t.decision != DECISION_NONE) decided++;
+
+        fprintf(fp, "%s\n    {\"offset\": \"0x%lx\", \"register\": ", i ? "," : "", t.offset);
+        write_json_string(fp, t.reg);
+        fprintf(fp, ", \"disasm\": ");
+        write_json_string(fp, t.disasm);
+        fprintf(fp, ", \"depth\": %d, \"parent_offset\": ", t.depth);
+        if (t.depth > 0) {
+            fprintf(fp, "\"0x%lx\"", t.parent_offset);
+        } else {
+            fprintf(fp, "null");
+        }
+        fprintf(fp, ", \"exec_count\": %lu, \"injection_count\": %u, \"crash_count\": %u, "
+                    "\"hang_count\": %u, \"benign_count\": %u, \"crash_rate\": %g, \"decision\": \"%s\"}",
+                t.exec_count, t.injection_count, t.crash_count, t.hang_count, t.benign_count,
+                t.crash_rate(), decision_name(t));
+    }
+
+    fprintf(fp, "\n  ],\n  \"summary\": {\n");
+    fprintf(fp, "    \"total_targets\": %zu,\n", g_completed.size());
+    fprintf(fp, "    \"total_injections\": %lu,\n", total_injections);
+    fprintf(fp, "    \"total_crashes\": %lu,\n", total_crashes);
+    fprintf(fp, "    \"decided_targets\": %zu,\n", decided);
+    fprintf(fp, "    \"overall_crash_rate\": %g\n  }\n}\n",
+            total_injections ? (double)total_crashes / total_injections : 0.0);
+    fclose(fp);
+
+    printf("[保存] 注错结果已保存到: %s\n", path.c_str());
+    return true;
+}
+
+// ========== 主函数 ==========
+
+int Usage() {
+    fprintf(stderr,
+        "原生自适应故障注入引擎\n"
+        "用法: adaptive_engine -t <trace.json> [选项] -- <program> [args]\n"
+        "  -t <file>            unified_tracer 输出（JSON / JSONL）\n"
+        "  -o <file>            注错结果（默认 injection_results.json）\n"
+        "  -pin <path>          pin 可执行文件\n"
+        "  -fi_tool <path>      targeted_faultinjection.so\n"
+        "  -threshold <r>       崩溃率阈值（默认 0.3）\n"
+        "  -injections <n>      每目标注错次数（默认 10）；序贯模式下为平均配额\n"
+        "  -stop <rule>         停止规则：fixed / wilson / sprt（默认 fixed）\n"
+        "  -min_injections <n>  序贯模式下判定前至少注错次数（默认 5）\n"
+        "  -max_injections <n>  序贯模式下单目标上限（默认 0 = 3 倍 -injections）\n"
+        "  -confidence <c>      Wilson 置信度 / SPRT 的 1 - alpha（默认 0.95）\n"
+        "  -sprt_delta <d>      SPRT 无差异区间 阈值±d（默认 0.1）\n"
+        "  -weight_exec <0/1>   按执行次数加权追加配额与扩展顺序（默认 0）\n"
+        "  -jobs <n>            并发注错进程数（默认 0 = 可用 CPU 数）\n"
+        "  -timeout <s>         单次注错超时秒数（默认 30）\n"
+        "  -top_n <n>           只处理执行次数最多的前 N 条指令（默认 0 = 全部）\n"
+        "  -max_targets <n>     最多处理的目标数（默认 100）\n");
+    return 1;
+}
+
+bool parse_args(int argc, char* argv[]) {
+    int i = 1;
+    for (; i < argc; i++) {
+        std::string opt = argv[i];
+        if (opt == "--") { i++; break; }
+        if (i + 1 >= argc) return false;
+        const char* val = argv[++i];
+        if (opt == "-t") g_config.trace_file = val;
+        else if (opt == "-o") g_config.output_file = val;
+        else if (opt == "-pin") g_config.pin_bin = val;
+        else if (opt == "-fi_tool") g_config.fi_tool = val;
+        else if (opt == "-threshold") g_config.crash_threshold = atof(val);
+        else if (opt == "-injections") g_config.injections_per_target = (uint32_t)strtoul(val, NULL, 0);
+        else if (opt == "-stop") {
+            if (!strcmp(val, "fixed")) g_config.stop_rule = STOP_FIXED;
+            else if (!strcmp(val, "wilson")) g_config.stop_rule = STOP_WILSON;
+            else if (!strcmp(val, "sprt")) g_config.stop_rule = STOP_SPRT;
+            else return false;
+        }
+        else if (opt == "-min_injections") g_config.min_injections = (uint32_t)strtoul(val, NULL, 0);
+        else if (opt == "-max_injections") g_config.max_injections = (uint32_t)strtoul(val, NULL, 0);
+        else if (opt == "-confidence") g_config.confidence = atof(val);
+        else if (opt == "-sprt_delta") g_config.sprt_delta = atof(val);
+        else if (opt == "-weight_exec") g_config.weight_exec = atoi(val) != 0;
+        else if (opt == "-jobs") g_config.jobs = (uint32_t)strtoul(val, NULL, 0);
+        else if (opt == "-timeout") g_config.timeout_sec = (uint32_t)strtoul(val, NULL, 0);
+        else if (opt == "-top_n") g_config.top_n = (uint32_t)strtoul(val, NULL, 0);
+        else if (opt == "-max_targets") g_config.max_targets = (uint32_t)strtoul(val, NULL, 0);
+        else return false;
+    }
+    for (; i < argc; i++) g_config.program.push_back(argv[i]);
+
+    if (g_config.max_injections == 0) g_config.max_injections = 3 * g_config.injections_per_target;
+    g_config.max_injections = std::max(g_config.max_injections, g_config.injections_per_target);
+    g_config.min_injections = std::max(g_config.min_injections, 1u);
+
+    return !g_config.trace_file.empty() && !g_config.program.empty() &&
+           g_config.injections_per_target > 0 &&
+           g_config.confidence > 0.5 && g_config.confidence < 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_args(argc, argv)) return Usage();
+
+    if (access(g_config.pin_bin.c_str(), X_OK) != 0) {
+        fprintf(stderr, "[AdaptiveEngine] Pin 二进制不存在: %s\n", g_config.pin_bin.c_str());
+        return 1;
+    }
+    if (access(g_config.fi_tool.c_str(), R_OK) != 0) {
+        fprintf(stderr, "[AdaptiveEngine] 故障注入工具不存在: %s\n", g_config.fi_tool.c_str());
+        return 1;
+    }
+
+    if (!load_scenarios(g_config.trace_file)) return 1;
+    printf("[AdaptiveEngine] 主镜像基地址: 0x%lx，发现 %zu 个崩溃场景\n",
+           g_img_base_addr, g_scenarios.size());
+    if (g_scenarios.empty()) {
+        fprintf(stderr, "[AdaptiveEngine] 没有发现易崩溃指令，退出\n");
+        return 1;
+    }
+
+    g_seed_base = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+    g_z = normal_quantile(g_config.confidence);
+
+    initialize_queue();
+    run_campaign();
+    return save_results(g_config.output_file) ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+/*
+ * adaptive_engine.h - 原生自适应故障注入引擎头文件
+ *
+ * 功能：读取 unified_tracer 的 JSON / JSONL 输出，以有界进程池并发运行
+ *       targeted_faultinjection.so，每个注错进程绑定到一个 CPU 核；
+ *       崩溃率阈值与按深度扩展溯源点的逻辑与 adaptive_injector.py 一致
+ *
+ * 本程序不是 Pin 工具，直接在宿主机上运行
+ */
+
+#ifndef ADAPTIVE_ENGINE_H
+#define ADAPTIVE_ENGINE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// ========== JSON 值（只覆盖 unified_tracer 输出用到的子集）==========
+
+struct JsonValue {
+    enum Type { J_NULL, J_BOOL, J_NUMBER, J_STRING, J_ARRAY, J_OBJECT };
+
+    Type type;
+    bool boolean;
+    double number;
+    std::string str;
+    std::vector<JsonValue> items;                              // J_ARRAY
+    std::vector<std::pair<std::string, JsonValue> > fields;    // J_OBJECT，保持原顺序
+
+    JsonValue() : type(J_NULL), boolean(false), number(0) {}
+
+    const JsonValue* get(const char* key) const;
+    uint64_t as_u64() const;                 // 数字，或 "0x..." 形式的字符串
+    const std::string& as_str() const;       // 非字符串时返回空串
+};
+
+// ========== 溯源结果 ==========
+
+struct SourceInfo {
+    uint64_t offset;                 // 源指令偏移
+    std::string disasm;
+    int depth;                       // 溯源深度（1=直接来源）
+    uint64_t hit_count;
+    uint64_t exec_count;             // 源指令自身的执行次数（旧版输出没有时为 0）
+};
+
+struct CrashScenario {
+    uint64_t offset;                 // 易崩溃指令偏移
+    std::string disasm;
+    std::string cp_type;
+    uint64_t exec_count;
+    uint64_t traced_count;
+    std::vector<std::string> crash_regs;
+    std::map<std::string, std::vector<SourceInfo> > register_traces;
+};
+
+// ========== 注错目标 ==========
+
+// 每个目标的停止规则
+enum StopRule {
+    STOP_FIXED = 0,                  // 固定 injections_per_target 次（与 Python 版相同）
+    STOP_WILSON,                     // Wilson 置信区间整体在阈值一侧时停止
+    STOP_SPRT                        // 序贯概率比检验
+};
+
+// 崩溃率相对阈值的判定
+enum Decision {
+    DECISION_NONE = 0,               // 尚不确定
+    DECISION_ABOVE,                  // 崩溃率 > 阈值，扩展溯源点
+    DECISION_BELOW
+};
+
+struct InjectionTarget {
+    uint64_t offset;                 // 指令偏移
+    std::string reg;                 // 目标寄存器
+    std::string disasm;
+    int depth;                       // 0=易崩溃点
+    uint64_t parent_offset;          // depth>0 时为易崩溃指令偏移
+    size_t scenario;                 // 所属崩溃场景下标
+    uint64_t exec_count;             // 指令执行次数（按动态频率加权时使用）
+    Decision decision;
+
+    uint32_t scheduled;              // 已启动的注错次数
+    uint32_t injection_count;        // 已完成的注错次数
+    uint32_t crash_count;
+    uint32_t hang_count;
+    uint32_t benign_count;
+
+    InjectionTarget() : offset(0), depth(0), parent_offset(0), scenario(0), exec_count(0),
+                        decision(DECISION_NONE), scheduled(0), injection_count(0), crash_count(0),
+                        hang_count(0), benign_count(0) {}
+
+    double crash_rate() const {
+        return injection_count == 0 ? 0.0 : (double)crash_count / injection_count;
+    }
+};
+
+// 注错结果（与 adaptive_injector.py 的 inject_once 相同）
+enum InjectOutcome { OUTCOME_CRASH, OUTCOME_HANG, OUTCOME_BENIGN };
+
+// 一个正在运行的注错进程
+struct RunningJob {
+    pid_t pid;                       // 进程组号与 pid 相同
+    int cpu;                         // 绑定的 CPU
+    size_t target;                   // g_targets 下标
+    struct timespec start;
+    bool timed_out;
+};
+
+// ========== 配置 ==========
+
+struct EngineConfig {
+    std::string trace_file;
+    std::string pin_bin;
+    std::string fi_tool;
+    std::string output_file;
+    double crash_threshold;
+    uint32_t injections_per_target;  // 每目标的基础配额
+    StopRule stop_rule;
+    uint32_t min_injections;         // 序贯停止前至少注错的次数
+    uint32_t max_injections;         // 单个目标注错上限（超过基础配额的部分来自提前停止的目标）
+    double confidence;               // Wilson 置信度，SPRT 取 alpha = beta = 1 - confidence
+    double sprt_delta;               // SPRT 的无差异区间：阈值 ± delta
+    bool weight_exec;                // 按执行次数加权追加配额与扩展顺序
+    uint32_t timeout_sec;
+    uint32_t jobs;                   // 0 = 可用 CPU 数
+    uint32_t top_n;                  // 0 = 全部
+    uint32_t max_targets;
+    std::vector<std::string> program;    // 目标程序及参数
+
+    EngineConfig()
+        : pin_bin("/home/tongshiyu/pin/pin"),
+          fi_tool("/home/tongshiyu/pin/source/tools/pinfi/obj-intel64/targeted_fi/targeted_faultinjection.so"),
+          output_file("injection_results.json"),
+          crash_threshold(0.3), injections_per_target(10), stop_rule(STOP_FIXED),
+          min_injections(5), max_injections(0), confidence(0.95), sprt_delta(0.1),
+          weight_exec(false), timeout_sec(30),
+          jobs(0), top_n(0), max_targets(100) {}
+};
+
+#endif // ADAPTIVE_ENGINE_H
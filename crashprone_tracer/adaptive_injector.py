@@ -15,6 +15,7 @@ adaptive_injector.py - 基于 unified_tracer 的自适应故障注入脚本
 import os
 import sys
 import json
+import math
 import argparse
 import subprocess
 from dataclasses import dataclass, asdict
@@ -33,12 +34,14 @@ class InjectionTarget:
     disasm: str                    # 指令反汇编
     depth: int                     # 溯源深度（0=易崩溃点）
     parent_offset: Optional[int]   # 父指令偏移（depth>0时有效）
+    exec_count: int = 0            # 指令执行次数（源指令来自 tracer 的 exec_count）
 
     # 注错统计
     injection_count: int = 0       # 已注错次数
     crash_count: int = 0           # 崩溃次数
     hang_count: int = 0            # 挂起次数
     benign_count: int = 0          # 良性次数
+    decision: str = ''             # 序贯判定：above / below，空=未判定
 
     @property
     def crash_rate(self) -> float:
@@ -59,7 +62,9 @@ class InjectionTarget:
             'crash_count': self.crash_count,
             'hang_count': self.hang_count,
             'benign_count': self.benign_count,
-            'crash_rate': self.crash_rate
+            'crash_rate': self.crash_rate,
+            'exec_count': self.exec_count,
+            'decision': self.decision or 'undecided'
         }
 
 
@@ -128,24 +133,75 @@ class UnifiedTracer:
         except Exception as e:
             raise RuntimeError(f"运行 tracer 失败: {e}")
 
+    @staticmethod
+    def _load_output(path: str) -> dict:
+        """读取 JSON 或 JSONL 输出，统一为 JSON 结构"""
+        with open(path, 'r') as f:
+            first = f.readline()
+            f.seek(0)
+            if not first.startswith('{"record"'):
+                return json.load(f)
+
+            data = {'crashprone_insts': []}
+            for line in f:
+                if not line.strip():
+                    continue
+                obj = json.loads(line)
+                kind = obj.pop('record')
+                if kind == 'inst':
+                    data['crashprone_insts'].append(obj)
+                elif kind == 'thread_files':
+                    data['thread_files'] = obj['files']
+                else:
+                    data[kind] = obj
+            return data
+
+    @staticmethod
+    def _merge_inst(merged: dict, inst: dict):
+        """合并不同线程中同一易崩溃指令的记录"""
+        exist = merged.get(inst['offset'])
+        if exist is None:
+            merged[inst['offset']] = inst
+            return
+        exist['exec_count'] += inst['exec_count']
+        exist['traced_count'] = exist.get('traced_count', 0) + inst.get('traced_count', 0)
+        for reg_name, sources in inst.get('register_traces', {}).items():
+            exist_sources = exist.setdefault('register_traces', {}).setdefault(reg_name, [])
+            by_offset = {src['offset']: src for src in exist_sources}
+            for src in sources:
+                if src['offset'] in by_offset:
+                    by_offset[src['offset']]['hit_count'] += src['hit_count']
+                    by_offset[src['offset']]['exec_count'] = (by_offset[src['offset']].get('exec_count', 0) +
+                                                              src.get('exec_count', 0))
+                else:
+                    exist_sources.append(src)
+                    by_offset[src['offset']] = src
+
     def parse_result(self, json_file: str) -> Tuple[int, List[CrashScenario]]:
-        """解析 unified_tracer 输出
+        """解析 unified_tracer 输出（JSON / JSONL，按线程输出时读取并合并各线程文件）
 
         Args:
-            json_file: JSON 文件路径
+            json_file: 输出文件路径
 
         Returns:
             (主镜像基地址, 崩溃场景列表)
         """
-        with open(json_file, 'r') as f:
-            data = json.load(f)
+        data = self._load_output(json_file)
 
         # 提取主镜像基地址
         img_base_addr = int(data['config']['img_base_addr'], 16)
 
+        insts = data.get('crashprone_insts', [])
+        if 'thread_files' in data:
+            merged = {}
+            for path in data['thread_files']:
+                for inst in self._load_output(path).get('crashprone_insts', []):
+                    self._merge_inst(merged, inst)
+            insts = list(merged.values())
+
         scenarios = []
 
-        for inst in data['crashprone_insts']:
+        for inst in insts:
             offset = int(inst['offset'], 16)
 
             # 解析每个寄存器的溯源链
@@ -158,7 +214,8 @@ class UnifiedTracer:
                         register=reg_name,
                         disasm=src['disasm'],
                         depth=src['depth'],
-                        parent_offset=offset
+                        parent_offset=offset,
+                        exec_count=src.get('exec_count') or src['hit_count']
                     )
                     trace_list.append(target)
                 register_traces[reg_name] = trace_list
@@ -185,16 +242,31 @@ class AdaptiveFaultInjector:
                  pin_root: str = "/home/tongshiyu/pin",
                  crash_threshold: float = 0.3,
                  injections_per_target: int = 10,
-                 timeout: int = 30):
+                 timeout: int = 30,
+                 stop_rule: str = 'fixed',
+                 min_injections: int = 5,
+                 max_injections: Optional[int] = None,
+                 confidence: float = 0.95,
+                 sprt_delta: float = 0.1):
         self.img_base_addr = img_base_addr
         self.pin_bin = os.path.join(pin_root, "pin")
         self.faultinjection_so = os.path.join(
-            pin_root, "source/tools/pinfi/obj-intel64/faultinjection.so"
+            pin_root, "source/tools/pinfi/obj-intel64/targeted_fi/targeted_faultinjection.so"
         )
         self.crash_threshold = crash_threshold
         self.injections_per_target = injections_per_target
         self.timeout = timeout
 
+        # 序贯停止：stop_rule 为 wilson / sprt 时，崩溃率确定在阈值一侧即停止，
+        # 省下的次数留给后续仍不确定的目标（单个目标不超过 max_injections）
+        self.stop_rule = stop_rule
+        self.min_injections = max(1, min_injections)
+        self.max_injections = max(max_injections or 3 * injections_per_target, injections_per_target)
+        self.confidence = confidence
+        self.sprt_delta = sprt_delta
+        self.z = self._normal_quantile(confidence)
+        self.budget = 0
+
         self.injection_queue = deque()
         self.completed_targets = {}  # (offset, register) -> InjectionTarget
         self.target_map = {}  # 用于快速查找目标
@@ -206,6 +278,66 @@ class AdaptiveFaultInjector:
         else:
             self.simulate_mode = False
 
+    @staticmethod
+    def _normal_quantile(confidence: float) -> float:
+        """双侧置信度对应的标准正态分位数（二分求解）"""
+        tail = (1 - confidence) / 2
+        lo, hi = 0.0, 10.0
+        for _ in range(100):
+            mid = (lo + hi) / 2
+            if 0.5 * math.erfc(mid / math.sqrt(2)) > tail:
+                lo = mid
+            else:
+                hi = mid
+        return (lo + hi) / 2
+
+    def _wilson_interval(self, crashes: int, n: int) -> Tuple[float, float]:
+        """崩溃率的 Wilson 置信区间"""
+        if n == 0:
+            return 0.0, 1.0
+        z2 = self.z * self.z
+        p = crashes / n
+        denom = 1 + z2 / n
+        center = (p + z2 / (2 * n)) / denom
+        half = self.z * math.sqrt(p * (1 - p) / n + z2 / (4 * n * n)) / denom
+        return center - half, center + half
+
+    def _decide(self, target: InjectionTarget) -> str:
+        """序贯判定：'above' / 'below'，样本不足或仍不确定时返回空串"""
+        n = target.injection_count
+        if self.stop_rule == 'fixed' or n < self.min_injections:
+            return ''
+        threshold = self.crash_threshold
+        if self.stop_rule == 'wilson':
+            low, high = self._wilson_interval(target.crash_count, n)
+            if low > threshold:
+                return 'above'
+            if high <= threshold:
+                return 'below'
+            return ''
+
+        # SPRT：H0 p = 阈值 - delta，H1 p = 阈值 + delta，alpha = beta = 1 - confidence
+        p0 = max(threshold - self.sprt_delta, 1e-6)
+        p1 = min(threshold + self.sprt_delta, 1 - 1e-6)
+        alpha = 1 - self.confidence
+        c = target.crash_count
+        llr = c * math.log(p1 / p0) + (n - c) * math.log((1 - p1) / (1 - p0))
+        if llr >= math.log((1 - alpha) / alpha):
+            return 'above'
+        if llr <= math.log(alpha / (1 - alpha)):
+            return 'below'
+        return ''
+
+    def _can_continue(self, target: InjectionTarget) -> bool:
+        """目标是否还需要继续注错"""
+        if target.decision:
+            return False
+        if target.injection_count < self.injections_per_target:
+            return True
+        if self.stop_rule == 'fixed':
+            return False
+        return target.injection_count < self.max_injections and self.budget > 0
+
     def initialize_queue(self, scenarios: List[CrashScenario], top_n: int = None):
         """初始化注错队列：添加所有 depth=0 的易崩溃点
 
@@ -225,7 +357,8 @@ class AdaptiveFaultInjector:
                     register=reg,
                     disasm=scenario.crashprone_disasm,
                     depth=0,
-                    parent_offset=None
+                    parent_offset=None,
+                    exec_count=scenario.exec_count
                 )
                 self.injection_queue.append((target, scenario))
 
@@ -250,18 +383,15 @@ class AdaptiveFaultInjector:
             import random
             return random.choice(['crash', 'benign', 'benign', 'benign'])
 
-        # 计算绝对地址
-        absolute_addr = self.img_base_addr + offset
-
-        # 实际注错
-        # 注意：根据你的 faultinjection.so 接口，可能需要使用绝对地址或相对偏移
+        # 使用镜像内偏移，由工具在镜像加载时换算，ASLR 开启时同样有效
         cmd = [
             self.pin_bin,
             "-t", self.faultinjection_so,
-            "-targetOffset", hex(offset),  # 使用相对偏移
-            # 或者使用: "-targetAddr", hex(absolute_addr),  # 使用绝对地址
-            "-targetKth", str(kth),
-            "-fioption", "AllInst",
+            "-target_offset", hex(offset),
+            "-target_reg", register,
+            "-target_kth", str(kth),
+            "-inject_bit", "-1",
+            "-o", os.devnull,
             "--", program
         ] + args
 
@@ -305,11 +435,13 @@ class AdaptiveFaultInjector:
             print(f"  指令: 0x{target.offset:x} - {target.disasm}")
             print(f"  寄存器: {target.register}")
 
-            # 执行注错
-            for i in range(1, self.injections_per_target + 1):
+            # 执行注错（第 i 次注错在目标指令第 i 次执行时）
+            self.budget += self.injections_per_target
+            while self._can_continue(target):
                 result = self.inject_once(program, args, target.offset,
-                                         target.register, i)
+                                         target.register, target.injection_count + 1)
                 target.injection_count += 1
+                self.budget -= 1
 
                 if result == 'crash':
                     target.crash_count += 1
@@ -317,17 +449,20 @@ class AdaptiveFaultInjector:
                     target.hang_count += 1
                 else:
                     target.benign_count += 1
+                target.decision = self._decide(target)
 
             crash_rate = target.crash_rate
             print(f"  结果: 崩溃率 {crash_rate:.1%} " +
                   f"(崩溃:{target.crash_count} 挂起:{target.hang_count} " +
-                  f"良性:{target.benign_count})")
+                  f"良性:{target.benign_count})" +
+                  (f" 判定:{target.decision or 'undecided'}" if self.stop_rule != 'fixed' else ""))
 
             # 保存结果
             self.completed_targets[key] = target
 
-            # 如果崩溃率超过阈值，添加溯源点到队列
-            if crash_rate > self.crash_threshold:
+            # 如果崩溃率超过阈值，添加溯源点到队列（有序贯判定时以判定为准）
+            above = (target.decision == 'above') if target.decision else crash_rate > self.crash_threshold
+            if above:
                 print(f"  → 崩溃率超过阈值 {self.crash_threshold:.1%}，添加溯源点")
 
                 # 查找该寄存器的溯源链
@@ -360,6 +495,10 @@ class AdaptiveFaultInjector:
                 'img_base_addr': hex(self.img_base_addr),
                 'crash_threshold': self.crash_threshold,
                 'injections_per_target': self.injections_per_target,
+                'stop_rule': self.stop_rule,
+                'min_injections': self.min_injections,
+                'max_injections': self.max_injections,
+                'confidence': self.confidence,
                 'timeout': self.timeout
             },
             'targets': [target.to_dict() for target in self.completed_targets.values()],
@@ -391,6 +530,13 @@ def main():
     parser.add_argument('--threshold', type=float, default=0.3, help='崩溃率阈值')
     parser.add_argument('--injections', type=int, default=10, help='每目标注错次数')
     parser.add_argument('--top-n', type=int, help='只处理执行次数最多的前 N 个指令')
+    parser.add_argument('--stop', choices=['fixed', 'wilson', 'sprt'], default='fixed',
+                        help='每目标停止规则：固定次数 / Wilson 区间 / SPRT')
+    parser.add_argument('--min-injections', type=int, default=5, help='序贯判定前至少注错次数')
+    parser.add_argument('--max-injections', type=int, help='序贯模式下单目标注错上限（默认 3 倍 --injections）')
+    parser.add_argument('--confidence', type=float, default=0.95, help='序贯判定置信度')
+    parser.add_argument('--engine', help='adaptive_engine 可执行文件路径；指定时第 3 步由原生引擎并发执行')
+    parser.add_argument('--jobs', type=int, default=0, help='原生引擎的并发注错进程数（0=可用 CPU 数）')
 
     args = parser.parse_args()
 
@@ -438,17 +584,38 @@ def main():
 
     # 步骤 3: 自适应注错
     print("\n[Step 3] 开始自适应故障注入...")
+    result_file = output_dir / "injection_results.json"
+    if args.engine:
+        cmd = [args.engine, "-t", str(trace_file), "-o", str(result_file),
+               "-pin", os.path.join(args.pin_root, "pin"),
+               "-fi_tool", os.path.join(args.pin_root,
+                   "source/tools/pinfi/obj-intel64/targeted_fi/targeted_faultinjection.so"),
+               "-threshold", str(args.threshold),
+               "-injections", str(args.injections),
+               "-stop", args.stop,
+               "-min_injections", str(args.min_injections),
+               "-max_injections", str(args.max_injections or 0),
+               "-confidence", str(args.confidence),
+               "-jobs", str(args.jobs)]
+        if args.top_n:
+            cmd += ["-top_n", str(args.top_n)]
+        cmd += ["--", args.program] + program_args
+        sys.exit(subprocess.run(cmd).returncode)
+
     injector = AdaptiveFaultInjector(
         img_base_addr=img_base_addr,
         pin_root=args.pin_root,
         crash_threshold=args.threshold,
-        injections_per_target=args.injections
+        injections_per_target=args.injections,
+        stop_rule=args.stop,
+        min_injections=args.min_injections,
+        max_injections=args.max_injections,
+        confidence=args.confidence
     )
 
     injector.run_adaptive_injection(args.program, program_args, scenarios)
 
     # 保存结果
-    result_file = output_dir / "injection_results.json"
     injector.save_results(str(result_file))
 
     print("\n" + "=" * 60)
@@ -15,6 +15,7 @@
 #include <algorithm>
 #include <ctime>
 #include <utility>
+#include <new>
 
 using namespace std;
 
@@ -24,19 +25,56 @@ using namespace std;
 TLS_KEY g_tls_key;
 PIN_LOCK g_lock;
 
-// 易崩溃指令记录表：offset -> CrashProneRecord
-std::map<ADDRINT, CrashProneRecord> g_crashprone_records;
+// 合并后的易崩溃指令记录：静态指令 ID -> 记录（仅在合并线程记录时写入，受 g_lock 保护）
+std::vector<MergedCrashRecord*> g_merged_records;
 
-// 反汇编缓存：IP -> 反汇编字符串
-std::map<ADDRINT, std::string> g_disasm_cache;
+// 静态指令表：偏移 -> ID -> 反汇编（自带锁）
+StaticInstTable g_static_table;
+
+// 尚未合并的线程状态（受 g_lock 保护）
+std::vector<ThreadState*> g_live_threads;
+
+// 静态指令信息表：ImageLoad 时遍历主镜像 .text 一次性构建，之后只读
+// g_inst_arena 按 runtime_addr 升序排列，按地址二分查找（不为 .text 每个字节建下标）
+std::vector<InstInfo> g_inst_arena;
+ADDRINT g_text_low = 0;
+ADDRINT g_text_high = 0;
 
 // 主程序镜像信息
 std::string g_main_img_name = "";
 ADDRINT g_main_img_low = 0;
 ADDRINT g_main_img_high = 0;
 
+// 环形缓冲区实际大小（-window 向上取 2 的幂）
+uint64_t g_window_size = UnifiedConfig::WINDOW_SIZE;
+uint64_t g_src_pool_size = 0;
+
 // 统计信息
-uint64_t g_total_inst_count = 0;
+struct TraceStats {
+    uint64_t total_insts;          // 易崩溃指令数（输出时累加）
+    uint64_t with_traces;          // 有溯源结果的（通过 min_exec 过滤的）
+    uint64_t sources;              // 溯源源条目数
+    uint64_t inst_count;           // 执行指令数（各线程 dyn_id 之和）
+    uint64_t cache_hits;           // 切片缓存命中
+    uint64_t cache_misses;         // 切片缓存未命中
+    uint64_t shadow_bytes;         // 影子内存大小
+
+    TraceStats() : total_insts(0), with_traces(0), sources(0), inst_count(0),
+                   cache_hits(0), cache_misses(0), shadow_bytes(0) {}
+};
+
+// 全局统计（线程结束时累加，受 g_lock 保护）
+TraceStats g_stats;
+
+// 突发采样：阶段寄存器，及计数版本的基本块信息（插桩回调在 client lock 下串行执行）
+REG g_burst_reg = REG_INVALID();
+std::map<std::pair<ADDRINT, UINT32>, BurstBbl*> g_burst_bbls;
+
+// 按线程输出时生成的文件
+std::vector<std::string> g_thread_files;
+
+// 静态指令 ID -> 全部线程执行次数（线程结束时累加，受 g_lock 保护）
+std::vector<uint64_t> g_inst_execs;
 
 // ========== KNOB 参数 ==========
 
@@ -49,6 +87,30 @@ KNOB<uint32_t> max_depth(KNOB_MODE_WRITEONCE, "pintool",
 KNOB<uint64_t> min_exec_count(KNOB_MODE_WRITEONCE, "pintool",
     "min_exec", "2", "最小执行次数过滤");
 
+KNOB<std::string> output_format(KNOB_MODE_WRITEONCE, "pintool",
+    "format", "json", "输出格式: json | jsonl（每行一个对象）");
+
+KNOB<bool> per_thread_output(KNOB_MODE_WRITEONCE, "pintool",
+    "per_thread", "0", "每个线程单独输出到 <o>.t<tid>，不合并");
+
+KNOB<uint64_t> window_size(KNOB_MODE_WRITEONCE, "pintool",
+    "window", "10000", "环形缓冲区大小（向上取 2 的幂）");
+
+KNOB<bool> shadow_mem(KNOB_MODE_WRITEONCE, "pintool",
+    "shadow_mem", "1", "通过影子内存追踪 存储 -> 加载 数据流");
+
+KNOB<uint32_t> shadow_page_bits(KNOB_MODE_WRITEONCE, "pintool",
+    "shadow_page", "12", "影子内存页大小 log2(字节)，范围 6-24");
+
+KNOB<uint64_t> burst_trace(KNOB_MODE_WRITEONCE, "pintool",
+    "burst_trace", "0", "突发采样：每次追踪的指令数 W（0 = 全程追踪）");
+
+KNOB<uint64_t> burst_skip(KNOB_MODE_WRITEONCE, "pintool",
+    "burst_skip", "1000000", "突发采样：两次追踪之间只计数的指令数 S");
+
+KNOB<uint64_t> trace_sample(KNOB_MODE_WRITEONCE, "pintool",
+    "trace_sample", "1", "每条易崩溃指令每 N 次执行溯源一次（1 = 每次都溯源）");
+
 // ========== 辅助函数 ==========
 
 // 判断寄存器是否为有效数据寄存器
@@ -68,12 +130,6 @@ REG normalize_reg(REG reg) {
     return REG_FullRegName(reg);
 }
 
-// 检查指令是否在主程序范围内
-bool is_in_main_image(ADDRINT ip) {
-    if (g_main_img_low == 0) return true;
-    return (ip >= g_main_img_low && ip <= g_main_img_high);
-}
-
 // 判断指令是否有索引寄存器
 bool has_index_register(INS ins) {
     if (INS_MemoryOperandCount(ins) == 0) return false;
@@ -81,26 +137,23 @@ bool has_index_register(INS ins) {
     return REG_valid(index_reg);
 }
 
-// JSON 转义
-std::string escape_json(const std::string& s) {
-    std::string result;
-    for (char c : s) {
-        switch (c) {
-            case '"': result += "\\\""; break;
-            case '\\': result += "\\\\"; break;
-            case '\n': result += "\\n"; break;
-            case '\r': result += "\\r"; break;
-            case '\t': result += "\\t"; break;
-            default: result += c;
-        }
+// 判断是否为除法指令（与原先按助记符匹配的集合相同）
+bool is_div_opcode(OPCODE opcode) {
+    switch (opcode) {
+        case XED_ICLASS_DIV:
+        case XED_ICLASS_IDIV:
+        case XED_ICLASS_DIVSD:
+        case XED_ICLASS_DIVSS:
+        case XED_ICLASS_DIVPD:
+        case XED_ICLASS_DIVPS:
+            return true;
+        default:
+            return false;
     }
-    return result;
 }
 
 // 判断指令是否为易崩溃指令
 bool is_crash_prone(INS ins, uint8_t& cp_type) {
-    std::string mnemonic = INS_Mnemonic(ins);
-
     // 规则 1: 内存写指令
     if (INS_IsMemoryWrite(ins)) {
         cp_type = has_index_register(ins) ? CP_INDEX_ACCESS : CP_MEM_WRITE;
@@ -114,9 +167,7 @@ bool is_crash_prone(INS ins, uint8_t& cp_type) {
     }
 
     // 规则 3: 除法指令
-    if (mnemonic == "DIV" || mnemonic == "IDIV" ||
-        mnemonic == "DIVSD" || mnemonic == "DIVSS" ||
-        mnemonic == "DIVPD" || mnemonic == "DIVPS") {
+    if (is_div_opcode(INS_Opcode(ins))) {
         cp_type = CP_DIV;
         return true;
     }
@@ -209,9 +260,9 @@ void extract_crash_registers(INS ins, uint8_t cp_type, InstInfo* info) {
 
         case CP_DIV: {
             // 除法指令：除数寄存器
-            std::string mnemonic = INS_Mnemonic(ins);
+            OPCODE opcode = INS_Opcode(ins);
 
-            if (mnemonic == "DIV" || mnemonic == "IDIV") {
+            if (opcode == XED_ICLASS_DIV || opcode == XED_ICLASS_IDIV) {
                 // 整数除法：操作数0是除数
                 if (INS_OperandCount(ins) > 0) {
                     if (INS_OperandIsReg(ins, 0)) {
@@ -227,7 +278,7 @@ void extract_crash_registers(INS ins, uint8_t cp_type, InstInfo* info) {
                         }
                     }
                 }
-            } else if (mnemonic.find("DIV") != std::string::npos) {
+            } else {
                 // 浮点除法：DIVSD, DIVSS 等，第二个操作数是除数
                 if (INS_OperandCount(ins) > 1 && INS_OperandIsReg(ins, 1)) {
                     REG divisor = INS_OperandReg(ins, 1);
@@ -245,80 +296,34 @@ void extract_crash_registers(INS ins, uint8_t cp_type, InstInfo* info) {
 
 /*
  * 对单个崩溃寄存器进行 BFS 溯源
+ * 输出每次遇到的源指令 (offset, depth)，同一偏移可能出现多次（每次计一次命中）
  */
-void trace_single_register(ThreadState* tstate, uint64_t target_id, REG target_reg,
-                           int depth_limit, RegisterTrace& result) {
+void trace_single_register(ThreadState* tstate, uint64_t target_id, uint64_t def_id,
+                           int depth_limit, std::vector<std::pair<ADDRINT, int> >& found) {
     std::set<uint64_t> visited;
     std::vector<uint64_t> current_layer;
     std::vector<uint64_t> next_layer;
-    std::set<ADDRINT> found_offsets;
 
-    result.reg_name = REG_StringShort(target_reg);
-    result.sources.clear();
-
-    // 初始化：查找最后定义该寄存器的指令
-    auto it = tstate->shadow_regs.find(target_reg);
-    if (it != tstate->shadow_regs.end()) {
-        uint64_t def_id = it->second;
-        if ((target_id > def_id) && (target_id - def_id) < UnifiedConfig::WINDOW_SIZE) {
-            current_layer.push_back(def_id);
-            visited.insert(def_id);
-        }
-    }
+    current_layer.push_back(def_id);
+    visited.insert(def_id);
 
     // BFS 回溯
     for (int depth = 1; depth <= depth_limit && !current_layer.empty(); depth++) {
         next_layer.clear();
 
+        const RingBuffer& ring = tstate->ring;
         for (uint64_t def_id : current_layer) {
-            uint64_t pos = def_id % UnifiedConfig::WINDOW_SIZE;
-            DynNode& node = tstate->ring_buffer[pos];
-
-            // 验证节点有效性
-            if (node.dyn_id != def_id) continue;
-
-            // 计算偏移
-            ADDRINT offset = node.offset;
-
-            // 添加到结果（避免重复）
-            if (found_offsets.find(offset) == found_offsets.end()) {
-                found_offsets.insert(offset);
-
-                SourceEntry entry;
-                entry.offset = offset;
-                entry.depth = depth;
-                entry.hit_count = 1;
-
-                // 从缓存获取反汇编
-                auto disasm_it = g_disasm_cache.find(node.ip);
-                if (disasm_it != g_disasm_cache.end()) {
-                    entry.disasm = disasm_it->second;
-                }
-
-                result.sources.push_back(entry);
-            } else {
-                // 已存在，增加命中计数
-                for (auto& existing : result.sources) {
-                    if (existing.offset == offset) {
-                        existing.hit_count++;
-                        break;
-                    }
-                }
-            }
+            uint64_t slot = def_id & ring.mask;
 
-            // 继续回溯：该指令的读寄存器（使用保存的read_sources）
-            for (int i = 0; i < node.num_reads; i++) {
-                REG read_reg = node.read_regs[i];
-                uint64_t parent_id = node.read_sources[i];  // 直接使用保存的来源ID
+            found.push_back(std::make_pair((ADDRINT)ring.offsets[slot], depth));
 
-                if (!is_valid_data_reg(read_reg)) continue;
-
-                // parent_id == 0 表示未定义
-                if (parent_id == 0) continue;
+            // 继续回溯：该指令读寄存器的来源（来源已被来源池覆盖时停止）
+            if (!ring.sources_valid(slot)) continue;
+            for (int i = 0; i < ring.src_count[slot]; i++) {
+                uint64_t parent_id = def_id - ring.source_dist(slot, i);
 
                 if (visited.find(parent_id) == visited.end() &&
-                    parent_id < target_id &&
-                    (target_id - parent_id) < UnifiedConfig::WINDOW_SIZE) {
+                    (target_id - parent_id) < g_window_size) {
                     next_layer.push_back(parent_id);
                     visited.insert(parent_id);
                 }
@@ -330,161 +335,301 @@ void trace_single_register(ThreadState* tstate, uint64_t target_id, REG target_r
 }
 
 /*
- * 对易崩溃指令的所有崩溃寄存器进行溯源
+ * 计算切片签名：深度 1 的定义指令及其直接来源的静态偏移
+ * 返回 false 表示没有可溯源的定义
  */
-void trace_crashprone_inst(ThreadState* tstate, ADDRINT ip, InstInfo* info,
-                           uint64_t current_dyn_id) {
-    // 计算 offset
-    ADDRINT offset = 0;
-    if (g_main_img_low != 0 && ip >= g_main_img_low && ip <= g_main_img_high) {
-        offset = ip - g_main_img_low;
-    } else {
-        return;  // 不在主镜像内
+bool slice_signature(ThreadState* tstate, uint64_t target_id, uint64_t def_id,
+                     std::vector<ADDRINT>& signature, uint64_t& hash) {
+    const RingBuffer& ring = tstate->ring;
+    uint64_t slot = def_id & ring.mask;
+
+    signature.clear();
+    signature.push_back(ring.offsets[slot]);
+    if (ring.sources_valid(slot)) {
+        for (int i = 0; i < ring.src_count[slot]; i++) {
+            uint64_t parent_id = def_id - ring.source_dist(slot, i);
+            ADDRINT parent_offset = 0;          // 0 = 已滑出窗口
+            if ((target_id - parent_id) < g_window_size) {
+                parent_offset = ring.offsets[parent_id & ring.mask] + 1;
+            }
+            signature.push_back(parent_offset);
+        }
     }
 
-    PIN_GetLock(&g_lock, 0);
+    // FNV-1a
+    hash = 1469598103934665603ULL;
+    for (ADDRINT off : signature) {
+        hash = (hash ^ off) * 1099511628211ULL;
+    }
+    return true;
+}
+
+/*
+ * 溯源单个崩溃寄存器并累加到 SourceMap，相同签名的切片只做一次 BFS
+ */
+void trace_register_cached(ThreadState* tstate, uint64_t target_id, uint8_t target_reg_id,
+                           SourceMap& sources, SliceCache& cache) {
+    // 初始化：查找最后定义该寄存器的指令
+    uint64_t def_id = tstate->shadow_regs[target_reg_id];
+    if (def_id == 0 || target_id <= def_id || (target_id - def_id) >= g_window_size) {
+        return;
+    }
+
+    std::vector<ADDRINT> signature;
+    uint64_t hash = 0;
+    if (!slice_signature(tstate, target_id, def_id, signature, hash)) return;
 
-    // 获取或创建记录
-    auto it = g_crashprone_records.find(offset);
-    if (it == g_crashprone_records.end()) {
-        CrashProneRecord record;
-        record.offset = offset;
-        record.cp_type = info->cp_type;
-        record.exec_count = 0;
-
-        auto disasm_it = g_disasm_cache.find(ip);
-        if (disasm_it != g_disasm_cache.end()) {
-            record.disasm = disasm_it->second;
+    auto it = cache.find(hash);
+    if (it != cache.end() && it->second.signature == signature) {
+        tstate->slice_cache_hits++;
+        for (const auto& h : it->second.hits) {
+            sources.entries[h.first].hit_count += h.second;
         }
+        return;
+    }
 
-        // 记录崩溃寄存器名称
-        for (int i = 0; i < info->num_crash_regs; i++) {
-            record.crash_regs.push_back(REG_StringShort(info->crash_regs[i]));
+    tstate->slice_cache_misses++;
+    std::vector<std::pair<ADDRINT, int> > found;
+    trace_single_register(tstate, target_id, def_id, max_depth.Value(), found);
+
+    SliceShape shape;
+    shape.signature = signature;
+    for (const auto& f : found) {
+        uint32_t idx = sources.add(f.first, f.second);
+        bool merged = false;
+        for (auto& h : shape.hits) {
+            if (h.first == idx) {
+                h.second++;
+                merged = true;
+                break;
+            }
         }
+        if (!merged) shape.hits.push_back(std::make_pair(idx, 1u));
+    }
 
-        g_crashprone_records[offset] = record;
-        it = g_crashprone_records.find(offset);
+    // 哈希冲突时保留先来的形状，本次结果已累加
+    if (it == cache.end()) {
+        cache.insert(std::make_pair(hash, std::move(shape)));
     }
+}
 
-    it->second.exec_count++;
+/*
+ * 获取或创建本线程的易崩溃指令记录
+ */
+inline ThreadCrashRecord* get_thread_record(ThreadState* tstate, InstInfo* info) {
+    if (info->static_id >= tstate->records.size()) {
+        tstate->records.resize(info->static_id + 1, NULL);
+    }
+    ThreadCrashRecord*& record = tstate->records[info->static_id];
+    if (record == NULL) {
+        record = new ThreadCrashRecord(info);
+    }
+    return record;
+}
 
-    PIN_ReleaseLock(&g_lock);
+/*
+ * 对易崩溃指令的所有崩溃寄存器进行溯源，只写本线程记录，不加锁
+ */
+void trace_crashprone_inst(ThreadState* tstate, ADDRINT ip, InstInfo* info,
+                           uint64_t current_dyn_id) {
+    if (g_main_img_low == 0 || ip < g_main_img_low || ip > g_main_img_high) {
+        return;  // 不在主镜像内
+    }
+
+    ThreadCrashRecord* record = get_thread_record(tstate, info);
+
+    // 采样：追踪阶段的每 N 次执行中只有第 1 次溯源
+    record->exec_count++;
+    bool do_trace = (record->trace_seen++ % trace_sample.Value()) == 0;
+    if (!do_trace) return;
+    record->traced_count++;
 
     // 对每个崩溃寄存器独立溯源
     for (int i = 0; i < info->num_crash_regs; i++) {
-        REG crash_reg = info->crash_regs[i];
-        std::string reg_name = REG_StringShort(crash_reg);
+        trace_register_cached(tstate, current_dyn_id, info->crash_reg_ids[i],
+                              record->reg_sources[i], record->slice_cache[i]);
+    }
+}
+
+/*
+ * 线程记录的命中次数外推系数：全部执行次数 / 溯源次数（全程逐次溯源时为 1）
+ */
+inline double record_scale(const ThreadCrashRecord* trec) {
+    return trec->traced_count ? (double)trec->exec_count / trec->traced_count : 1.0;
+}
 
-        RegisterTrace trace;
-        trace_single_register(tstate, current_dyn_id, crash_reg, max_depth.Value(), trace);
+/*
+ * 把一个线程的记录合并到全局记录表（调用者持有 g_lock）
+ */
+void merge_thread_records(ThreadState* tstate) {
+    if (g_merged_records.size() < tstate->records.size()) {
+        g_merged_records.resize(tstate->records.size(), NULL);
+    }
 
-        // 合并结果
-        PIN_GetLock(&g_lock, 0);
+    for (size_t id = 0; id < tstate->records.size(); id++) {
+        const ThreadCrashRecord* trec = tstate->records[id];
+        if (trec == NULL) continue;
 
-        auto& existing_trace = it->second.register_traces[reg_name];
-        if (existing_trace.sources.empty()) {
-            existing_trace = trace;
-        } else {
-            // 合并：更新命中计数
-            for (const auto& new_source : trace.sources) {
-                bool found = false;
-                for (auto& existing_source : existing_trace.sources) {
-                    if (existing_source.offset == new_source.offset) {
-                        existing_source.hit_count += new_source.hit_count;
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) {
-                    existing_trace.sources.push_back(new_source);
-                }
+        MergedCrashRecord*& record = g_merged_records[id];
+        if (record == NULL) {
+            record = new MergedCrashRecord(trec->info);
+        }
+        record->exec_count += trec->exec_count;
+        record->traced_count += trec->traced_count;
+
+        // 按本线程系数外推后累加，已有源保留首次深度
+        double scale = record_scale(trec);
+        for (int i = 0; i < trec->info->num_crash_regs; i++) {
+            for (const auto& st : trec->reg_sources[i].entries) {
+                record->reg_sources[i].add(st.offset, st.depth, (uint64_t)(st.hit_count * scale + 0.5));
             }
         }
+    }
+}
 
-        PIN_ReleaseLock(&g_lock);
+/*
+ * 累加线程的全局统计（调用者持有 g_lock）
+ */
+void accumulate_thread_stats(ThreadState* tstate) {
+    // 突发采样时执行次数只在追踪阶段统计，按 全部指令数 / 追踪阶段指令数 外推
+    if (burst_trace.Value() > 0 && tstate->traced_executed > 0) {
+        double scale = (double)tstate->executed / tstate->traced_executed;
+        for (size_t id = 0; id < tstate->inst_execs.size(); id++) {
+            tstate->inst_execs[id] = (uint64_t)(tstate->inst_execs[id] * scale + 0.5);
+        }
+    }
+    if (g_inst_execs.size() < tstate->inst_execs.size()) {
+        g_inst_execs.resize(tstate->inst_execs.size(), 0);
     }
+    for (size_t id = 0; id < tstate->inst_execs.size(); id++) {
+        g_inst_execs[id] += tstate->inst_execs[id];
+    }
+
+    g_stats.inst_count += (burst_trace.Value() > 0) ? tstate->executed : tstate->dyn_id;
+    g_stats.cache_hits += tstate->slice_cache_hits;
+    g_stats.cache_misses += tstate->slice_cache_misses;
+    g_stats.shadow_bytes += tstate->shadow_mem.bytes();
 }
 
 // ========== 分析回调 ==========
 
 /*
  * 运行时分析回调
+ * read_ea / write_ea：第一个内存读/写操作数地址，没有时为 0
  */
-VOID Analyze_Exec(THREADID tid, ADDRINT ip, InstInfo* info) {
+VOID Analyze_Exec(THREADID tid, ADDRINT ip, InstInfo* info, ADDRINT read_ea, ADDRINT write_ea) {
     ThreadState* tstate = static_cast<ThreadState*>(PIN_GetThreadData(g_tls_key, tid));
     if (!tstate) return;
 
-    uint64_t current_id = tstate->dyn_id++;
-    g_total_inst_count++;
+    uint64_t current_id = ++tstate->dyn_id;
 
-    // 1. 写入环形缓冲区
-    uint64_t pos = current_id % UnifiedConfig::WINDOW_SIZE;
-    DynNode& node = tstate->ring_buffer[pos];
-
-    node.dyn_id = current_id;
-    node.ip = ip;
-    node.num_reads = info->num_reads;
-    node.num_writes = info->num_writes;
-
-    if (g_main_img_low != 0 && ip >= g_main_img_low && ip <= g_main_img_high) {
-        node.offset = ip - g_main_img_low;
-    } else {
-        node.offset = ip;
+    if (info->static_id >= tstate->inst_execs.size()) {
+        tstate->inst_execs.resize(info->static_id + 1, 0);
     }
+    tstate->inst_execs[info->static_id]++;
 
-    memcpy(node.read_regs, info->read_regs, info->num_reads * sizeof(REG));
-    memcpy(node.write_regs, info->write_regs, info->num_writes * sizeof(REG));
+    // 1. 写入环形缓冲区
+    RingBuffer& ring = tstate->ring;
+    uint64_t slot = current_id & ring.mask;
+    ring.offsets[slot] = info->offset;
+    ring.src_begin[slot] = (uint32_t)ring.pool_cursor;
+
+    // 记录读寄存器来源的相对距离（在更新shadow_regs之前！），未定义或已滑出窗口的不记录
+    uint8_t count = 0;
+    for (int i = 0; i < info->num_reads; i++) {
+        uint64_t src_id = tstate->shadow_regs[info->read_regs[i]];
+        uint64_t dist = current_id - src_id;
+        if (src_id != 0 && dist < g_window_size) {
+            ring.src_dist[(ring.pool_cursor + count) & ring.pool_mask] = (uint32_t)dist;
+            count++;
+        }
+    }
 
-    // 记录每个读寄存器的来源指令ID（在更新shadow_regs之前！）
-    for (int i = 0; i < node.num_reads; i++) {
-        REG read_reg = node.read_regs[i];
-        auto it = tstate->shadow_regs.find(read_reg);
-        if (it != tstate->shadow_regs.end()) {
-            node.read_sources[i] = it->second;
-        } else {
-            node.read_sources[i] = 0;  // 未定义
+    // 内存读：所读各字最后一次存储的指令也是来源（同一存储只记一次）
+    if (read_ea != 0) {
+        ADDRINT first = read_ea >> 3;
+        ADDRINT last = (read_ea + info->mem_read_size - 1) >> 3;
+        uint64_t prev_id = 0;
+        for (ADDRINT w = first; w <= last && w < first + UnifiedConfig::MAX_MEM_SRCS; w++) {
+            uint64_t* def = tstate->shadow_mem.slot(w << 3, false);
+            if (def == NULL || *def == 0 || *def == prev_id) continue;
+            uint64_t dist = current_id - *def;
+            if (dist < g_window_size) {
+                ring.src_dist[(ring.pool_cursor + count) & ring.pool_mask] = (uint32_t)dist;
+                count++;
+            }
+            prev_id = *def;
         }
     }
 
+    ring.src_count[slot] = count;
+    ring.pool_cursor += count;
+
     // 如果是易崩溃指令且有崩溃寄存器，执行溯源
     if (info->cp_type != CP_NONE && info->num_crash_regs > 0) {
         trace_crashprone_inst(tstate, ip, info, current_id);
     }
 
-    // 更新 shadow_regs
-    for (int i = 0; i < node.num_writes; i++) {
-        REG reg = node.write_regs[i];
-        if (is_valid_data_reg(reg)) {
-            tstate->shadow_regs[reg] = current_id;
+    // 更新 shadow_regs（编号在插桩时已过滤为有效数据寄存器）
+    for (int i = 0; i < info->num_writes; i++) {
+        tstate->shadow_regs[info->write_regs[i]] = current_id;
+    }
+
+    // 更新影子内存
+    if (write_ea != 0) {
+        ADDRINT last = (write_ea + info->mem_write_size - 1) >> 3;
+        for (ADDRINT w = write_ea >> 3; w <= last; w++) {
+            *tstate->shadow_mem.slot(w << 3, true) = current_id;
         }
     }
 }
 
-// ========== 插桩函数 ==========
-
-VOID Instruction(INS ins, VOID *v) {
-    ADDRINT ip = INS_Address(ins);
+/*
+ * 突发采样：每个基本块入口调用，返回值写入阶段寄存器，下一个基本块入口据此切换版本
+ */
+ADDRINT PIN_FAST_ANALYSIS_CALL Burst_Tick(THREADID tid, UINT32 num_ins) {
+    ThreadState* tstate = static_cast<ThreadState*>(PIN_GetThreadData(g_tls_key, tid));
+    if (!tstate) return BURST_TRACE;
+
+    tstate->executed += num_ins;
+    if (tstate->burst_mode == BURST_TRACE) tstate->traced_executed += num_ins;
+    tstate->burst_left -= num_ins;
+    if (tstate->burst_left <= 0) {
+        if (tstate->burst_mode == BURST_TRACE) {
+            tstate->burst_mode = BURST_COUNT;
+            tstate->burst_left = burst_skip.Value();
+        } else {
+            tstate->burst_mode = BURST_TRACE;
+            tstate->burst_left = burst_trace.Value();
+            // 计数阶段没有维护影子寄存器/内存，跳过一个窗口使旧的定义全部失效
+            tstate->dyn_id += g_window_size;
+        }
+    }
+    return tstate->burst_mode;
+}
 
-    // 过滤
-    if (!is_in_main_image(ip)) return;
-    if (!RTN_Valid(INS_Rtn(ins))) return;
-    if (SEC_Name(RTN_Sec(INS_Rtn(ins))) != ".text") return;
+/*
+ * 计数版本：只累加基本块内易崩溃指令的执行次数
+ */
+ADDRINT PIN_FAST_ANALYSIS_CALL Burst_CountBbl(THREADID tid, UINT32 num_ins, BurstBbl* bbl) {
+    ThreadState* tstate = static_cast<ThreadState*>(PIN_GetThreadData(g_tls_key, tid));
+    if (!tstate) return BURST_TRACE;
 
-    std::string rtnname = RTN_Name(INS_Rtn(ins));
-    if (rtnname.find("__libc") == 0 || rtnname.find("_start") == 0 ||
-        rtnname.find("call_gmon_start") == 0 || rtnname.find("frame_dummy") == 0 ||
-        rtnname.find("__do_global") == 0 || rtnname.find("__stat") == 0) {
-        return;
+    for (InstInfo* info : bbl->crash_insts) {
+        get_thread_record(tstate, info)->exec_count++;
     }
+    return Burst_Tick(tid, num_ins);
+}
 
-    // 缓存反汇编
-    if (g_disasm_cache.find(ip) == g_disasm_cache.end()) {
-        g_disasm_cache[ip] = INS_Disassemble(ins);
-    }
+// ========== 插桩函数 ==========
 
-    // 创建指令信息
-    InstInfo* info = new InstInfo();
+/*
+ * 提取一条静态指令的全部分析信息（ImageLoad 时调用）
+ */
+void build_inst_info(INS ins, InstInfo* info) {
+    ADDRINT ip = INS_Address(ins);
     info->runtime_addr = ip;
+    info->offset = (uint32_t)(ip - g_main_img_low);
 
     // 判断是否为易崩溃指令
     uint8_t cp_type = CP_NONE;
@@ -492,6 +637,9 @@ VOID Instruction(INS ins, VOID *v) {
         info->cp_type = cp_type;
         // 提取崩溃寄存器
         extract_crash_registers(ins, cp_type, info);
+        for (int i = 0; i < info->num_crash_regs; i++) {
+            info->crash_reg_ids[i] = shadow_reg_id(info->crash_regs[i]);
+        }
     }
 
     // 提取所有读/写寄存器（用于数据流追踪）
@@ -499,8 +647,9 @@ VOID Instruction(INS ins, VOID *v) {
     for (UINT32 i = 0; i < max_reads && info->num_reads < 8; i++) {
         REG reg = INS_RegR(ins, i);
         REG norm = normalize_reg(reg);
-        if (is_valid_data_reg(norm)) {
-            info->read_regs[info->num_reads++] = norm;
+        uint8_t id = shadow_reg_id(norm);
+        if (is_valid_data_reg(norm) && id != SHADOW_REG_NONE) {
+            info->read_regs[info->num_reads++] = id;
         }
     }
 
@@ -508,153 +657,574 @@ VOID Instruction(INS ins, VOID *v) {
     for (UINT32 i = 0; i < max_writes && info->num_writes < 4; i++) {
         REG reg = INS_RegW(ins, i);
         REG norm = normalize_reg(reg);
-        if (is_valid_data_reg(norm)) {
-            info->write_regs[info->num_writes++] = norm;
+        uint8_t id = shadow_reg_id(norm);
+        if (is_valid_data_reg(norm) && id != SHADOW_REG_NONE) {
+            info->write_regs[info->num_writes++] = id;
         }
     }
 
-    // 插入分析调用
-    INS_InsertCall(
-        ins, IPOINT_BEFORE, (AFUNPTR)Analyze_Exec,
-        IARG_THREAD_ID,
-        IARG_INST_PTR,
-        IARG_PTR, info,
-        IARG_END
-    );
+    // 内存操作数（只取第一个读/写操作数；不支持 scatter/gather 等变长访问）
+    if (shadow_mem.Value() && !INS_IsVgather(ins) && !INS_IsVscatter(ins)) {
+        if (INS_IsMemoryRead(ins) && INS_HasFallThrough(ins)) {
+            info->mem_read_size = INS_MemoryReadSize(ins);
+        }
+        if (INS_IsMemoryWrite(ins) && INS_HasFallThrough(ins)) {
+            info->mem_write_size = INS_MemoryWriteSize(ins);
+        }
+    }
+}
+
+// 查找静态指令信息，不在表中（非主镜像 .text 或被过滤的函数）返回 NULL
+InstInfo* find_inst_info(ADDRINT ip) {
+    if (ip < g_text_low || ip >= g_text_high) return NULL;
+    auto it = std::lower_bound(g_inst_arena.begin(), g_inst_arena.end(), ip,
+                               [](const InstInfo& info, ADDRINT addr) { return info.runtime_addr < addr; });
+    return (it == g_inst_arena.end() || it->runtime_addr != ip) ? NULL : &*it;
+}
+
+/*
+ * 按镜像内偏移查执行次数（静态指令表在 ImageLoad 后只读）
+ */
+uint64_t inst_exec_count(const std::vector<uint64_t>& execs, ADDRINT offset) {
+    InstInfo* info = find_inst_info(g_main_img_low + offset);
+    if (info == NULL || info->static_id >= execs.size()) return 0;
+    return execs[info->static_id];
+}
+
+/*
+ * 为一条指令插入完整分析调用
+ */
+void insert_exec_call(INS ins, InstInfo* info) {
+    bool track_read = info->mem_read_size > 0;
+    bool track_write = info->mem_write_size > 0;
+
+    // 插入分析调用（没有对应内存操作数时地址传 0）
+    if (track_read && track_write) {
+        INS_InsertCall(
+            ins, IPOINT_BEFORE, (AFUNPTR)Analyze_Exec,
+            IARG_THREAD_ID,
+            IARG_INST_PTR,
+            IARG_PTR, info,
+            IARG_MEMORYREAD_EA,
+            IARG_MEMORYWRITE_EA,
+            IARG_END
+        );
+    } else if (track_read) {
+        INS_InsertCall(
+            ins, IPOINT_BEFORE, (AFUNPTR)Analyze_Exec,
+            IARG_THREAD_ID,
+            IARG_INST_PTR,
+            IARG_PTR, info,
+            IARG_MEMORYREAD_EA,
+            IARG_ADDRINT, (ADDRINT)0,
+            IARG_END
+        );
+    } else if (track_write) {
+        INS_InsertCall(
+            ins, IPOINT_BEFORE, (AFUNPTR)Analyze_Exec,
+            IARG_THREAD_ID,
+            IARG_INST_PTR,
+            IARG_PTR, info,
+            IARG_ADDRINT, (ADDRINT)0,
+            IARG_MEMORYWRITE_EA,
+            IARG_END
+        );
+    } else {
+        INS_InsertCall(
+            ins, IPOINT_BEFORE, (AFUNPTR)Analyze_Exec,
+            IARG_THREAD_ID,
+            IARG_INST_PTR,
+            IARG_PTR, info,
+            IARG_ADDRINT, (ADDRINT)0,
+            IARG_ADDRINT, (ADDRINT)0,
+            IARG_END
+        );
+    }
+}
+
+VOID Instruction(INS ins, VOID *v) {
+    // 只查表，静态分析已在 ImageLoad 中完成；重复插桩不再分配
+    InstInfo* info = find_inst_info(INS_Address(ins));
+    if (info == NULL) return;
+
+    insert_exec_call(ins, info);
+}
+
+/*
+ * 突发采样模式的插桩：每个 trace 有追踪、计数两个版本
+ * 基本块入口先按阶段寄存器切换版本，再调用 Burst_Tick / Burst_CountBbl 更新阶段
+ */
+VOID Trace(TRACE trace, VOID *v) {
+    ADDRINT version = TRACE_Version(trace);
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        INS head = BBL_InsHead(bbl);
+        UINT32 num_ins = BBL_NumIns(bbl);
+
+        // 后继 trace 保持当前版本
+        BBL_SetTargetVersion(bbl, version);
+
+        if (version == BURST_TRACE) {
+            INS_InsertVersionCase(head, g_burst_reg, BURST_COUNT, BURST_COUNT, IARG_END);
+            INS_InsertCall(head, IPOINT_BEFORE, (AFUNPTR)Burst_Tick,
+                           IARG_FAST_ANALYSIS_CALL,
+                           IARG_THREAD_ID,
+                           IARG_UINT32, num_ins,
+                           IARG_RETURN_REGS, g_burst_reg,
+                           IARG_END);
+
+            for (INS ins = head; INS_Valid(ins); ins = INS_Next(ins)) {
+                InstInfo* info = find_inst_info(INS_Address(ins));
+                if (info != NULL) insert_exec_call(ins, info);
+            }
+        } else {
+            INS_InsertVersionCase(head, g_burst_reg, BURST_TRACE, BURST_TRACE, IARG_END);
+
+            BurstBbl*& bb = g_burst_bbls[std::make_pair(INS_Address(head), num_ins)];
+            if (bb == NULL) {
+                bb = new BurstBbl();
+                for (INS ins = head; INS_Valid(ins); ins = INS_Next(ins)) {
+                    InstInfo* info = find_inst_info(INS_Address(ins));
+                    if (info != NULL && info->cp_type != CP_NONE && info->num_crash_regs > 0) {
+                        bb->crash_insts.push_back(info);
+                    }
+                }
+            }
+
+            INS_InsertCall(head, IPOINT_BEFORE, (AFUNPTR)Burst_CountBbl,
+                           IARG_FAST_ANALYSIS_CALL,
+                           IARG_THREAD_ID,
+                           IARG_UINT32, num_ins,
+                           IARG_PTR, bb,
+                           IARG_RETURN_REGS, g_burst_reg,
+                           IARG_END);
+        }
+    }
 }
 
 // ========== 镜像加载回调 ==========
 
+// 跳过的运行时/启动函数
+bool is_skipped_rtn(const std::string& rtnname) {
+    return rtnname.find("__libc") == 0 || rtnname.find("_start") == 0 ||
+           rtnname.find("call_gmon_start") == 0 || rtnname.find("frame_dummy") == 0 ||
+           rtnname.find("__do_global") == 0 || rtnname.find("__stat") == 0;
+}
+
 VOID ImageLoad(IMG img, VOID *v) {
-    if (IMG_IsMainExecutable(img)) {
-        g_main_img_name = IMG_Name(img);
-        g_main_img_low = IMG_LowAddress(img);
-        g_main_img_high = IMG_HighAddress(img);
+    if (!IMG_IsMainExecutable(img)) return;
+
+    g_main_img_name = IMG_Name(img);
+    g_main_img_low = IMG_LowAddress(img);
+    g_main_img_high = IMG_HighAddress(img);
+
+    fprintf(stderr, "[UnifiedTracer] 主镜像: %s (0x%lx - 0x%lx)\n",
+            g_main_img_name.c_str(), g_main_img_low, g_main_img_high);
+
+    // 遍历 .text 一次，构建按地址索引的静态指令信息表
+    for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec)) {
+        if (SEC_Name(sec) != ".text") continue;
 
-        fprintf(stderr, "[UnifiedTracer] 主镜像: %s (0x%lx - 0x%lx)\n",
-                g_main_img_name.c_str(), g_main_img_low, g_main_img_high);
+        g_text_low = SEC_Address(sec);
+        g_text_high = g_text_low + SEC_Size(sec);
+
+        for (RTN rtn = SEC_RtnHead(sec); RTN_Valid(rtn); rtn = RTN_Next(rtn)) {
+            if (is_skipped_rtn(RTN_Name(rtn))) continue;
+
+            RTN_Open(rtn);
+            for (INS ins = RTN_InsHead(rtn); INS_Valid(ins); ins = INS_Next(ins)) {
+                ADDRINT ip = INS_Address(ins);
+                if (ip < g_text_low || ip >= g_text_high) continue;
+
+                g_inst_arena.push_back(InstInfo());
+                InstInfo& info = g_inst_arena.back();
+                build_inst_info(ins, &info);
+                info.static_id = g_static_table.intern(info.offset, ins);
+            }
+            RTN_Close(rtn);
+        }
+        break;
     }
+
+    // 按地址排序供二分查找；插桩在 ImageLoad 之后，此时还没有指向数组元素的指针
+    std::stable_sort(g_inst_arena.begin(), g_inst_arena.end(),
+                     [](const InstInfo& a, const InstInfo& b) { return a.runtime_addr < b.runtime_addr; });
+    g_inst_arena.erase(std::unique(g_inst_arena.begin(), g_inst_arena.end(),
+                                   [](const InstInfo& a, const InstInfo& b) {
+                                       return a.runtime_addr == b.runtime_addr;
+                                   }),
+                       g_inst_arena.end());
+
+    fprintf(stderr, "[UnifiedTracer] 静态指令表: %lu 条指令\n", g_inst_arena.size());
 }
 
-// ========== 线程回调 ==========
+// ========== 输出 ==========
 
-VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v) {
-    ThreadState* tstate = new ThreadState();
-    PIN_SetThreadData(g_tls_key, tstate, tid);
+bool StreamWriter::open(const std::string& path) {
+    fp = fopen(path.c_str(), "w");
+    buf.reserve(CHUNK + 4096);
+    return fp != NULL;
 }
 
-VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v) {
-    ThreadState* tstate = static_cast<ThreadState*>(PIN_GetThreadData(g_tls_key, tid));
-    if (tstate) {
-        delete tstate;
+void StreamWriter::close() {
+    if (!fp) return;
+    flush();
+    fclose(fp);
+    fp = NULL;
+}
+
+void StreamWriter::flush() {
+    if (!buf.empty()) {
+        fwrite(buf.data(), 1, buf.size(), fp);
+        buf.clear();
     }
 }
 
-// ========== 输出结果 ==========
+void StreamWriter::raw(const char* s) {
+    buf.append(s);
+    flush_if_full();
+}
 
-VOID Fini(INT32 code, VOID *v) {
-    fprintf(stderr, "[UnifiedTracer] 程序执行完毕，共执行 %lu 条指令\n", g_total_inst_count);
-    fprintf(stderr, "[UnifiedTracer] 发现 %lu 个易崩溃指令\n", g_crashprone_records.size());
+void StreamWriter::printf(const char* fmt, ...) {
+    char tmp[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < sizeof(tmp)) {
+        buf.append(tmp, n);
+    } else {
+        size_t old = buf.size();
+        buf.resize(old + n + 1);
+        va_start(ap, fmt);
+        vsnprintf(&buf[old], n + 1, fmt, ap);
+        va_end(ap);
+        buf.resize(old + n);
+    }
+    flush_if_full();
+}
 
-    FILE* fp = fopen(output_file.Value().c_str(), "w");
-    if (!fp) {
-        fprintf(stderr, "[UnifiedTracer] 无法创建输出文件: %s\n", output_file.Value().c_str());
-        return;
+void StreamWriter::json_string(const std::string& s) {
+    buf += '"';
+    for (char c : s) {
+        switch (c) {
+            case '"': buf += "\\\""; break;
+            case '\\': buf += "\\\\"; break;
+            case '\n': buf += "\\n"; break;
+            case '\r': buf += "\\r"; break;
+            case '\t': buf += "\\t"; break;
+            default: buf += c;
+        }
     }
+    buf += '"';
+    flush_if_full();
+}
 
-    fprintf(fp, "{\n");
+bool is_jsonl() {
+    return output_format.Value() == "jsonl";
+}
 
-    // config
-    fprintf(fp, "  \"config\": {\n");
-    fprintf(fp, "    \"img_name\": \"%s\",\n", escape_json(g_main_img_name).c_str());
-    fprintf(fp, "    \"img_base_addr\": \"0x%lx\",\n", g_main_img_low);
-    fprintf(fp, "    \"max_depth\": %u,\n", max_depth.Value());
-    fprintf(fp, "    \"min_exec_count\": %lu,\n", min_exec_count.Value());
-    fprintf(fp, "    \"window_size\": %lu\n", UnifiedConfig::WINDOW_SIZE);
-    fprintf(fp, "  },\n");
+void write_config(StreamWriter& w) {
+    const char* sep = is_jsonl() ? " " : "\n    ";
+    if (is_jsonl()) {
+        w.raw("{\"record\": \"config\", ");
+    } else {
+        w.raw("{\n  \"config\": {\n    ");
+    }
+    w.raw("\"img_name\": ");
+    w.json_string(g_main_img_name);
+    w.printf(",%s\"img_base_addr\": \"0x%lx\"", sep, g_main_img_low);
+    w.printf(",%s\"max_depth\": %u", sep, max_depth.Value());
+    w.printf(",%s\"min_exec_count\": %lu", sep, min_exec_count.Value());
+    w.printf(",%s\"trace_sample\": %lu", sep, trace_sample.Value());
+    w.printf(",%s\"burst_trace\": %lu", sep, burst_trace.Value());
+    w.printf(",%s\"burst_skip\": %lu", sep, burst_skip.Value());
+    w.printf(",%s\"shadow_mem\": %s", sep, shadow_mem.Value() ? "true" : "false");
+    w.printf(",%s\"shadow_page_bits\": %u", sep, shadow_page_bits.Value());
+    w.printf(",%s\"window_size\": %lu", sep, g_window_size);
+    if (is_jsonl()) {
+        w.raw("}\n");
+    } else {
+        w.raw("\n  },\n");
+    }
+}
 
-    // crashprone_insts
-    fprintf(fp, "  \"crashprone_insts\": [\n");
+/*
+ * 写出一条易崩溃指令记录（调用者持有 g_static_table.lock）
+ * reg_sources 与 info->crash_regs 一一对应，命中次数输出时乘以 scale
+ * 未通过 min_exec 过滤时不写，返回 false
+ */
+bool write_record(StreamWriter& w, const InstInfo* info, uint64_t exec_count, uint64_t traced_count,
+                  const SourceMap* reg_sources, double scale, bool first, TraceStats& stats,
+                  const std::vector<uint64_t>& execs) {
+    stats.total_insts++;
+
+    // 过滤低执行次数
+    if (exec_count < min_exec_count.Value()) return false;
+
+    // 崩溃寄存器名；register_traces 按名称顺序输出，没有来源的寄存器省略
+    int num_regs = info->num_crash_regs;
+    std::string reg_names[UnifiedConfig::MAX_CRASH_REGS];
+    int order[UnifiedConfig::MAX_CRASH_REGS];
+    bool has_traces = false;
+    for (int i = 0; i < num_regs; i++) {
+        reg_names[i] = REG_StringShort(info->crash_regs[i]);
+        order[i] = i;
+        if (!reg_sources[i].entries.empty()) {
+            has_traces = true;
+            stats.sources += reg_sources[i].entries.size();
+        }
+    }
+    std::sort(order, order + num_regs, [&reg_names](int a, int b) { return reg_names[a] < reg_names[b]; });
+    if (has_traces) stats.with_traces++;
 
-    bool first_inst = true;
-    for (const auto& kv : g_crashprone_records) {
-        const CrashProneRecord& record = kv.second;
+    bool jsonl = is_jsonl();
+    const char* sep = jsonl ? " " : "\n      ";
+    const char* reg_sep = jsonl ? "" : "\n        ";
+    const char* src_sep = jsonl ? "" : "\n          ";
 
-        // 过滤低执行次数
-        if (record.exec_count < min_exec_count.Value()) continue;
+    if (jsonl) {
+        w.raw("{\"record\": \"inst\", ");
+    } else {
+        w.raw(first ? "    {\n      " : ",\n    {\n      ");
+    }
+    w.printf("\"offset\": \"0x%lx\",%s\"disasm\": ", (ADDRINT)info->offset, sep);
+    w.json_string(g_static_table.disasm(info->offset));
+    w.printf(",%s\"type\": \"%s\"", sep, cp_type_to_string(info->cp_type));
+    w.printf(",%s\"exec_count\": %lu", sep, exec_count);
+    w.printf(",%s\"traced_count\": %lu", sep, traced_count);
+
+    // crash_regs
+    w.printf(",%s\"crash_regs\": [", sep);
+    for (int i = 0; i < num_regs; i++) {
+        if (i > 0) w.raw(", ");
+        w.json_string(reg_names[i]);
+    }
+    w.raw("]");
+
+    // register_traces
+    w.printf(",%s\"register_traces\": {", sep);
+    bool first_reg = true;
+    for (int k = 0; k < num_regs; k++) {
+        int i = order[k];
+        if (reg_sources[i].entries.empty()) continue;
+        if (!first_reg) w.raw(jsonl ? ", " : ",");
+        first_reg = false;
+
+        w.printf("%s\"%s\": [", reg_sep, reg_names[i].c_str());
+        bool first_source = true;
+        for (const auto& st : reg_sources[i].entries) {
+            if (!first_source) w.raw(jsonl ? ", " : ",");
+            first_source = false;
+
+            w.printf("%s{\"offset\": \"0x%lx\", \"disasm\": ", src_sep, st.offset);
+            w.json_string(g_static_table.disasm(st.offset));
+            w.printf(", \"depth\": %d, \"hit_count\": %lu, \"exec_count\": %lu}",
+                     st.depth, (uint64_t)(st.hit_count * scale + 0.5), inst_exec_count(execs, st.offset));
+        }
+        w.printf("%s]", reg_sep);
+    }
 
-        if (!first_inst) fprintf(fp, ",\n");
-        first_inst = false;
+    if (jsonl) {
+        w.raw("}}\n");
+    } else {
+        w.raw("\n      }\n    }");
+    }
+    return true;
+}
 
-        fprintf(fp, "    {\n");
-        fprintf(fp, "      \"offset\": \"0x%lx\",\n", record.offset);
-        fprintf(fp, "      \"disasm\": \"%s\",\n", escape_json(record.disasm).c_str());
-        fprintf(fp, "      \"type\": \"%s\",\n", cp_type_to_string(record.cp_type));
-        fprintf(fp, "      \"exec_count\": %lu,\n", record.exec_count);
+void write_statistics(StreamWriter& w, const TraceStats& stats, bool with_thread_files) {
+    bool jsonl = is_jsonl();
+    const char* sep = jsonl ? " " : "\n    ";
 
-        // crash_regs
-        fprintf(fp, "      \"crash_regs\": [");
-        for (size_t i = 0; i < record.crash_regs.size(); i++) {
-            if (i > 0) fprintf(fp, ", ");
-            fprintf(fp, "\"%s\"", record.crash_regs[i].c_str());
+    if (jsonl) {
+        w.raw("{\"record\": \"statistics\", ");
+    } else {
+        w.raw("  \"statistics\": {\n    ");
+    }
+    w.printf("\"total_crashprone_insts\": %lu", stats.total_insts);
+    w.printf(",%s\"insts_with_traces\": %lu", sep, stats.with_traces);
+    w.printf(",%s\"total_source_entries\": %lu", sep, stats.sources);
+    w.printf(",%s\"slice_cache_hits\": %lu", sep, stats.cache_hits);
+    w.printf(",%s\"slice_cache_misses\": %lu", sep, stats.cache_misses);
+    w.printf(",%s\"shadow_mem_bytes\": %lu", sep, stats.shadow_bytes);
+    w.printf(",%s\"total_instructions_executed\": %lu", sep, stats.inst_count);
+    if (jsonl) {
+        w.raw("}\n");
+    } else {
+        w.raw("\n  }");
+    }
+
+    if (with_thread_files) {
+        w.raw(jsonl ? "{\"record\": \"thread_files\", \"files\": [" : ",\n  \"thread_files\": [");
+        for (size_t i = 0; i < g_thread_files.size(); i++) {
+            if (i > 0) w.raw(", ");
+            w.json_string(g_thread_files[i]);
         }
-        fprintf(fp, "],\n");
+        w.raw(jsonl ? "]}\n" : "]");
+    }
 
-        // register_traces
-        fprintf(fp, "      \"register_traces\": {\n");
+    if (!jsonl) w.raw("\n}\n");
+}
 
-        bool first_reg = true;
-        for (const auto& trace_kv : record.register_traces) {
-            const std::string& reg_name = trace_kv.first;
-            const RegisterTrace& trace = trace_kv.second;
+/*
+ * 按线程输出：把一个线程的记录直接写入 <o>.t<tid>，逐条生成、逐条写出
+ * （调用者持有 g_lock）
+ */
+void write_thread_file(ThreadState* tstate) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".t%u", tstate->tid);
+    std::string path = output_file.Value() + suffix;
+
+    StreamWriter w;
+    if (!w.open(path)) {
+        fprintf(stderr, "[UnifiedTracer] 无法创建输出文件: %s\n", path.c_str());
+        return;
+    }
 
-            if (!first_reg) fprintf(fp, ",\n");
-            first_reg = false;
+    write_config(w);
+    if (!is_jsonl()) w.raw("  \"crashprone_insts\": [\n");
+
+    // 线程文件中的统计只含本线程数据
+    TraceStats stats;
+    stats.inst_count = (burst_trace.Value() > 0) ? tstate->executed : tstate->dyn_id;
+    stats.cache_hits = tstate->slice_cache_hits;
+    stats.cache_misses = tstate->slice_cache_misses;
+    stats.shadow_bytes = tstate->shadow_mem.bytes();
+
+    bool first = true;
+    PIN_GetLock(&g_static_table.lock, tstate->tid + 1);
+    for (size_t id = 0; id < tstate->records.size(); id++) {
+        const ThreadCrashRecord* trec = tstate->records[id];
+        if (trec == NULL) continue;
+        if (write_record(w, trec->info, trec->exec_count, trec->traced_count, trec->reg_sources,
+                         record_scale(trec), first, stats, tstate->inst_execs)) {
+            first = false;
+        }
+    }
+    PIN_ReleaseLock(&g_static_table.lock);
 
-            fprintf(fp, "        \"%s\": [\n", reg_name.c_str());
+    if (!is_jsonl()) w.raw("\n  ],\n");
 
-            bool first_source = true;
-            for (const auto& source : trace.sources) {
-                if (!first_source) fprintf(fp, ",\n");
-                first_source = false;
+    write_statistics(w, stats, false);
+    w.close();
 
-                fprintf(fp, "          {\"offset\": \"0x%lx\", \"disasm\": \"%s\", \"depth\": %d, \"hit_count\": %lu}",
-                        source.offset, escape_json(source.disasm).c_str(),
-                        source.depth, source.hit_count);
-            }
+    g_stats.total_insts += stats.total_insts;
+    g_stats.with_traces += stats.with_traces;
+    g_stats.sources += stats.sources;
+    g_thread_files.push_back(path);
+}
 
-            fprintf(fp, "\n        ]");
-        }
+/*
+ * 线程结束：按线程输出或合并到全局记录（调用者持有 g_lock）
+ */
+void finish_thread(ThreadState* tstate) {
+    accumulate_thread_stats(tstate);
+    if (per_thread_output.Value()) {
+        write_thread_file(tstate);
+    } else {
+        merge_thread_records(tstate);
+    }
+}
+
+// ========== 线程回调 ==========
+
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v) {
+    // 按 cache line 对齐分配，影子寄存器堆位于结构体开头
+    void* mem = NULL;
+    if (posix_memalign(&mem, 64, sizeof(ThreadState)) != 0) {
+        fprintf(stderr, "[UnifiedTracer] 线程 %u 状态分配失败\n", tid);
+        return;
+    }
+    ThreadState* tstate = new (mem) ThreadState();
+    tstate->tid = tid;
+    tstate->ring.init(g_window_size, g_src_pool_size);
+    tstate->inst_execs.assign(g_inst_arena.size(), 0);
+    tstate->shadow_mem.page_shift = shadow_page_bits.Value();
+    tstate->burst_mode = BURST_TRACE;
+    tstate->burst_left = burst_trace.Value();
+    PIN_SetThreadData(g_tls_key, tstate, tid);
 
-        fprintf(fp, "\n      }\n");
-        fprintf(fp, "    }");
+    if (burst_trace.Value() > 0) {
+        PIN_SetContextReg(ctxt, g_burst_reg, BURST_TRACE);
     }
 
-    fprintf(fp, "\n  ],\n");
+    PIN_GetLock(&g_lock, tid + 1);
+    g_live_threads.push_back(tstate);
+    PIN_ReleaseLock(&g_lock);
+}
 
-    // statistics
-    uint64_t total_with_traces = 0;
-    uint64_t total_sources = 0;
-    for (const auto& kv : g_crashprone_records) {
-        if (kv.second.exec_count >= min_exec_count.Value()) {
-            if (!kv.second.register_traces.empty()) {
-                total_with_traces++;
-                for (const auto& trace_kv : kv.second.register_traces) {
-                    total_sources += trace_kv.second.sources.size();
-                }
+VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v) {
+    ThreadState* tstate = static_cast<ThreadState*>(PIN_GetThreadData(g_tls_key, tid));
+    if (!tstate) return;
+
+    // 合并或输出本线程记录
+    PIN_GetLock(&g_lock, tid + 1);
+    finish_thread(tstate);
+    g_live_threads.erase(std::remove(g_live_threads.begin(), g_live_threads.end(), tstate),
+                         g_live_threads.end());
+    PIN_ReleaseLock(&g_lock);
+
+    PIN_SetThreadData(g_tls_key, NULL, tid);
+    tstate->~ThreadState();
+    free(tstate);
+}
+
+// ========== 输出结果 ==========
+
+VOID Fini(INT32 code, VOID *v) {
+    // 处理退出时仍未结束的线程
+    PIN_GetLock(&g_lock, 0);
+    for (ThreadState* tstate : g_live_threads) {
+        finish_thread(tstate);
+    }
+    g_live_threads.clear();
+    PIN_ReleaseLock(&g_lock);
+
+    fprintf(stderr, "[UnifiedTracer] 程序执行完毕，共执行 %lu 条指令\n", g_stats.inst_count);
+
+    StreamWriter w;
+    if (!w.open(output_file.Value())) {
+        fprintf(stderr, "[UnifiedTracer] 无法创建输出文件: %s\n", output_file.Value().c_str());
+        return;
+    }
+
+    write_config(w);
+
+    if (per_thread_output.Value()) {
+        // 主文件只含配置、汇总统计和线程文件列表
+        fprintf(stderr, "[UnifiedTracer] 已按线程输出 %lu 个文件\n", g_thread_files.size());
+        write_statistics(w, g_stats, true);
+    } else {
+        // 按偏移顺序逐条写出合并后的记录
+        std::vector<const MergedCrashRecord*> records;
+        for (const MergedCrashRecord* record : g_merged_records) {
+            if (record != NULL) records.push_back(record);
+        }
+        std::sort(records.begin(), records.end(),
+                  [](const MergedCrashRecord* a, const MergedCrashRecord* b) {
+                      return a->info->offset < b->info->offset;
+                  });
+        fprintf(stderr, "[UnifiedTracer] 发现 %lu 个易崩溃指令\n", records.size());
+
+        if (!is_jsonl()) w.raw("  \"crashprone_insts\": [\n");
+
+        bool first = true;
+        PIN_GetLock(&g_static_table.lock, 0);
+        for (const MergedCrashRecord* record : records) {
+            if (write_record(w, record->info, record->exec_count, record->traced_count, record->reg_sources,
+                             1.0, first, g_stats, g_inst_execs)) {
+                first = false;
             }
         }
-    }
+        PIN_ReleaseLock(&g_static_table.lock);
 
-    fprintf(fp, "  \"statistics\": {\n");
-    fprintf(fp, "    \"total_crashprone_insts\": %lu,\n", g_crashprone_records.size());
-    fprintf(fp, "    \"insts_with_traces\": %lu,\n", total_with_traces);
-    fprintf(fp, "    \"total_source_entries\": %lu,\n", total_sources);
-    fprintf(fp, "    \"total_instructions_executed\": %lu\n", g_total_inst_count);
-    fprintf(fp, "  }\n");
+        if (!is_jsonl()) w.raw("\n  ],\n");
+        write_statistics(w, g_stats, false);
+    }
 
-    fprintf(fp, "}\n");
-    fclose(fp);
+    w.close();
 
     fprintf(stderr, "[UnifiedTracer] 结果已保存到: %s\n", output_file.Value().c_str());
 }
@@ -679,17 +1249,55 @@ int main(int argc, char *argv[]) {
 
     // 初始化锁
     PIN_InitLock(&g_lock);
+    PIN_InitLock(&g_static_table.lock);
+
+    if (output_format.Value() != "json" && output_format.Value() != "jsonl") {
+        fprintf(stderr, "[UnifiedTracer] -format 只支持 json 或 jsonl\n");
+        return Usage();
+    }
 
     // 创建 TLS key
     g_tls_key = PIN_CreateThreadDataKey(NULL);
 
     fprintf(stderr, "[UnifiedTracer] 启动统一溯源工具\n");
     fprintf(stderr, "[UnifiedTracer] 最大溯源深度: %u\n", max_depth.Value());
+    if (trace_sample.Value() == 0) {
+        fprintf(stderr, "[UnifiedTracer] -trace_sample 必须大于 0\n");
+        return Usage();
+    }
+    if (window_size.Value() == 0 || window_size.Value() > (1ULL << 24)) {
+        fprintf(stderr, "[UnifiedTracer] -window 必须在 1 到 2^24 之间\n");
+        return Usage();
+    }
+    g_window_size = 1;
+    while (g_window_size < window_size.Value()) g_window_size <<= 1;
+    g_src_pool_size = g_window_size * UnifiedConfig::SRC_POOL_RATIO;
+    fprintf(stderr, "[UnifiedTracer] 溯源窗口: %lu 条指令\n", g_window_size);
+    if (shadow_page_bits.Value() < 6 || shadow_page_bits.Value() > 24) {
+        fprintf(stderr, "[UnifiedTracer] -shadow_page 必须在 6 到 24 之间\n");
+        return Usage();
+    }
+    if (burst_trace.Value() > 0) {
+        g_burst_reg = PIN_ClaimToolRegister();
+        if (!REG_valid(g_burst_reg)) {
+            fprintf(stderr, "[UnifiedTracer] 无法分配工具寄存器，突发采样不可用\n");
+            return Usage();
+        }
+        fprintf(stderr, "[UnifiedTracer] 突发采样: 追踪 %lu 条 / 计数 %lu 条\n",
+                burst_trace.Value(), burst_skip.Value());
+    }
+    if (trace_sample.Value() > 1) {
+        fprintf(stderr, "[UnifiedTracer] 溯源采样: 每 %lu 次执行溯源一次\n", trace_sample.Value());
+    }
     fprintf(stderr, "[UnifiedTracer] 输出文件: %s\n", output_file.Value().c_str());
 
     // 注册回调
     IMG_AddInstrumentFunction(ImageLoad, 0);
-    INS_AddInstrumentFunction(Instruction, 0);
+    if (burst_trace.Value() > 0) {
+        TRACE_AddInstrumentFunction(Trace, 0);
+    } else {
+        INS_AddInstrumentFunction(Instruction, 0);
+    }
     PIN_AddThreadStartFunction(ThreadStart, 0);
     PIN_AddThreadFiniFunction(ThreadFini, 0);
     PIN_AddFiniFunction(Fini, 0);
@@ -16,14 +16,57 @@
 #include <map>
 #include <set>
 #include <vector>
+#include <unordered_map>
+#include <cstdarg>
 
 // ============ 配置参数 ============
 struct UnifiedConfig {
-    static const uint64_t WINDOW_SIZE = 10000;  // 环形缓冲区大小
+    static const uint64_t WINDOW_SIZE = 10000;  // 默认环形缓冲区大小（-window）
+    static const uint32_t SRC_POOL_RATIO = 4;   // 来源池大小 = 窗口大小 × 该值（平均每条指令的来源数上限）
+    static const int MAX_MEM_SRCS = 4;          // 每次内存读最多记录的存储来源（8 字节字）数
     static const int MAX_DEPTH = 10;             // 默认最大溯源深度
     static const int MAX_CRASH_REGS = 4;        // 最大崩溃寄存器数
 };
 
+// ============ 紧凑寄存器编号（影子寄存器堆下标）============
+/*
+ * 0 = 不追踪；1-16 = 16 个 64 位通用寄存器；17-48 = 向量寄存器 0-31
+ * XMMn / YMMn / ZMMn 共用同一编号（写 YMM 会覆盖对应 XMM）
+ * 编号在插桩时算好，分析回调只做下标访问
+ */
+enum ShadowRegId {
+    SHADOW_REG_NONE = 0,
+    SHADOW_REG_GPR_BASE = 1,
+    SHADOW_REG_VEC_BASE = 17,
+    SHADOW_REG_SLOTS = 64                       // 49 个有效编号，补齐到 8 个 cache line
+};
+
+inline uint8_t shadow_reg_id(REG reg) {
+    switch (reg) {
+        case REG_RAX: return SHADOW_REG_GPR_BASE + 0;
+        case REG_RBX: return SHADOW_REG_GPR_BASE + 1;
+        case REG_RCX: return SHADOW_REG_GPR_BASE + 2;
+        case REG_RDX: return SHADOW_REG_GPR_BASE + 3;
+        case REG_RSI: return SHADOW_REG_GPR_BASE + 4;
+        case REG_RDI: return SHADOW_REG_GPR_BASE + 5;
+        case REG_RBP: return SHADOW_REG_GPR_BASE + 6;
+        case REG_RSP: return SHADOW_REG_GPR_BASE + 7;
+        case REG_R8:  return SHADOW_REG_GPR_BASE + 8;
+        case REG_R9:  return SHADOW_REG_GPR_BASE + 9;
+        case REG_R10: return SHADOW_REG_GPR_BASE + 10;
+        case REG_R11: return SHADOW_REG_GPR_BASE + 11;
+        case REG_R12: return SHADOW_REG_GPR_BASE + 12;
+        case REG_R13: return SHADOW_REG_GPR_BASE + 13;
+        case REG_R14: return SHADOW_REG_GPR_BASE + 14;
+        case REG_R15: return SHADOW_REG_GPR_BASE + 15;
+        default: break;
+    }
+    if (REG_is_xmm(reg)) return SHADOW_REG_VEC_BASE + (reg - REG_XMM0);
+    if (REG_is_ymm(reg)) return SHADOW_REG_VEC_BASE + (reg - REG_YMM0);
+    if (REG_is_zmm(reg)) return SHADOW_REG_VEC_BASE + (reg - REG_ZMM0);
+    return SHADOW_REG_NONE;
+}
+
 // ============ 易崩溃指令类型 ============
 enum CrashProneType {
     CP_NONE = 0,
@@ -46,89 +89,334 @@ inline const char* cp_type_to_string(uint8_t cp_type) {
     }
 }
 
-// ============ 环形缓冲区节点 ============
-struct DynNode {
-    uint64_t dyn_id;               // 动态指令 ID
-    ADDRINT ip;                    // 指令地址(运行时)
-    ADDRINT offset;                // 相对偏移
+// ============ 环形缓冲区（SoA）============
+/*
+ * 动态指令 id 从 1 开始，槽位 = id & mask
+ * 只访问与当前 id 距离小于窗口大小的节点，这些槽位一定未被覆盖，因此不保存 id
+ *
+ * 每个节点只记录：
+ *   offsets[]   : 主镜像内偏移（32 位）
+ *   src_begin[] : 在来源池中的起始位置（来源池游标低 32 位）
+ *   src_count[] : 有定义且在窗口内的读寄存器来源个数
+ * 来源池保存相对距离 (当前 id - 来源 id)，变长、按顺序追加
+ */
+struct RingBuffer {
+    uint64_t mask;                 // 窗口大小 - 1（窗口大小为 2 的幂）
+    uint32_t* offsets;
+    uint32_t* src_begin;
+    uint8_t* src_count;
 
-    REG read_regs[8];              // 读寄存器(最多8个)
-    uint64_t read_sources[8];      // 每个读寄存器的来源指令ID
-    REG write_regs[4];             // 写寄存器(最多4个)
-    uint8_t num_reads;
-    uint8_t num_writes;
+    uint64_t pool_mask;            // 来源池大小 - 1
+    uint64_t pool_cursor;          // 已写入的来源总数
+    uint32_t* src_dist;
 
-    DynNode() : dyn_id(0), ip(0), offset(0), num_reads(0), num_writes(0) {
-        memset(read_regs, 0, sizeof(read_regs));
-        memset(read_sources, 0, sizeof(read_sources));
-        memset(write_regs, 0, sizeof(write_regs));
+    RingBuffer() : mask(0), offsets(NULL), src_begin(NULL), src_count(NULL),
+                   pool_mask(0), pool_cursor(0), src_dist(NULL) {}
+
+    // 不清零：未写过的槽位不会被访问
+    void init(uint64_t window, uint64_t pool) {
+        mask = window - 1;
+        pool_mask = pool - 1;
+        offsets = (uint32_t*)malloc(window * sizeof(uint32_t));
+        src_begin = (uint32_t*)malloc(window * sizeof(uint32_t));
+        src_count = (uint8_t*)malloc(window * sizeof(uint8_t));
+        src_dist = (uint32_t*)malloc(pool * sizeof(uint32_t));
+    }
+
+    ~RingBuffer() {
+        free(offsets);
+        free(src_begin);
+        free(src_count);
+        free(src_dist);
+    }
+
+    // 节点的来源是否已被来源池覆盖
+    bool sources_valid(uint64_t slot) const {
+        return (uint32_t)((uint32_t)pool_cursor - src_begin[slot]) <= pool_mask + 1;
+    }
+
+    uint32_t source_dist(uint64_t slot, int i) const {
+        return src_dist[(src_begin[slot] + i) & pool_mask];
     }
 };
 
-// ============ 每线程状态 (TLS) ============
-struct ThreadState {
-    DynNode ring_buffer[UnifiedConfig::WINDOW_SIZE];  // 环形缓冲区
-    uint64_t dyn_id;                                   // 当前动态指令 ID
-    std::map<REG, uint64_t> shadow_regs;              // REG -> 最后写该寄存器的 dyn_id
+// ============ 影子内存（两级页表）============
+/*
+ * 8 字节字 -> 最后写该字的 dyn_id（0=未定义），按线程维护
+ * 第一级：页号 -> 影子页（哈希表 + 最近一页缓存）
+ * 第二级：影子页，每页覆盖 2^page_shift 字节应用内存，首次存储时分配
+ */
+struct ShadowMemory {
+    uint32_t page_shift;                                  // log2(每页覆盖的应用字节数)
+    std::unordered_map<uint64_t, uint64_t*> pages;
+    uint64_t last_page_no;
+    uint64_t* last_page;
+
+    ShadowMemory() : page_shift(12), last_page_no(~0ULL), last_page(NULL) {}
+
+    ~ShadowMemory() {
+        for (auto& kv : pages) free(kv.second);
+    }
 
-    ThreadState() : dyn_id(0) {}
+    // 返回字 addr>>3 对应的槽位；create=false 且页不存在时返回 NULL
+    uint64_t* slot(ADDRINT addr, bool create) {
+        uint64_t page_no = addr >> page_shift;
+        if (page_no != last_page_no) {
+            auto it = pages.find(page_no);
+            if (it == pages.end()) {
+                if (!create) return NULL;
+                uint64_t* page = (uint64_t*)calloc((size_t)1 << (page_shift - 3), sizeof(uint64_t));
+                it = pages.insert(std::make_pair(page_no, page)).first;
+            }
+            last_page_no = page_no;
+            last_page = it->second;
+        }
+        return &last_page[(addr & (((ADDRINT)1 << page_shift) - 1)) >> 3];
+    }
+
+    size_t bytes() const {
+        return pages.size() * ((size_t)1 << page_shift);
+    }
 };
 
-// ============ 溯源源指令条目 ============
-struct SourceEntry {
-    ADDRINT offset;           // 源指令偏移
-    std::string disasm;       // 源指令反汇编
-    int depth;                // 溯源深度
-    uint64_t hit_count;       // 命中次数
+// ============ 每线程溯源源统计（开放寻址）============
+/*
+ * 偏移 -> (首次发现深度, 命中次数)
+ * entries 保持插入顺序（输出顺序与原先一致），slots 为线性探测的下标表
+ */
+struct SourceStat {
+    ADDRINT offset;
+    int depth;
+    uint64_t hit_count;
+};
+
+struct SourceMap {
+    static const uint32_t EMPTY = 0xffffffffu;
+
+    std::vector<SourceStat> entries;
+    std::vector<uint32_t> slots;             // 容量为 2 的幂，EMPTY 表示空槽
+
+    // 已存在则命中次数 +hits（保留首次深度），否则插入；返回条目下标（不会变化）
+    uint32_t add(ADDRINT offset, int depth, uint64_t hits = 1) {
+        if ((entries.size() + 1) * 4 > slots.size() * 3) grow();
+        uint32_t mask = slots.size() - 1;
+        uint32_t pos = hash(offset) & mask;
+        while (slots[pos] != EMPTY) {
+            SourceStat& st = entries[slots[pos]];
+            if (st.offset == offset) {
+                st.hit_count += hits;
+                return slots[pos];
+            }
+            pos = (pos + 1) & mask;
+        }
+        slots[pos] = entries.size();
+        SourceStat st = {offset, depth, hits};
+        entries.push_back(st);
+        return slots[pos];
+    }
+
+private:
+    static uint32_t hash(ADDRINT offset) {
+        return (uint32_t)((offset * 0x9E3779B97F4A7C15ULL) >> 32);
+    }
+
+    void grow() {
+        size_t cap = slots.empty() ? 8 : slots.size() * 2;
+        slots.assign(cap, EMPTY);
+        uint32_t mask = cap - 1;
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            uint32_t pos = hash(entries[i].offset) & mask;
+            while (slots[pos] != EMPTY) pos = (pos + 1) & mask;
+            slots[pos] = i;
+        }
+    }
+};
 
-    SourceEntry() : offset(0), depth(0), hit_count(0) {}
+// ============ 溯源切片缓存 ============
+/*
+ * 签名 = 深度 1 的定义指令偏移 + 其各读寄存器来源指令的偏移
+ * 签名相同的动态执行视为同一切片形状：命中时只按记录的次数累加，不再 BFS
+ */
+struct SliceShape {
+    std::vector<ADDRINT> signature;                        // 用于校验哈希冲突
+    std::vector<std::pair<uint32_t, uint32_t> > hits;     // (SourceMap 条目下标, 单次溯源中出现次数)
 };
 
-// ============ 单个崩溃寄存器的溯源结果 ============
-struct RegisterTrace {
-    std::string reg_name;                    // 寄存器名称
-    std::vector<SourceEntry> sources;        // 溯源到的源指令列表
+typedef std::unordered_map<uint64_t, SliceShape> SliceCache;   // 签名哈希 -> 切片形状
+
+struct InstInfo;
+
+// 每线程的易崩溃指令记录，按静态指令 ID 索引，Fini/ThreadFini 时合并到全局
+struct ThreadCrashRecord {
+    const InstInfo* info;                                    // 首次遇到时的静态信息
+    uint64_t exec_count;                                     // 全部执行次数（含突发采样的计数阶段）
+    uint64_t trace_seen;                                     // 在追踪阶段执行的次数
+    uint64_t traced_count;                                   // 实际溯源的次数
+    SourceMap reg_sources[UnifiedConfig::MAX_CRASH_REGS];   // 与 info->crash_regs 一一对应
+    SliceCache slice_cache[UnifiedConfig::MAX_CRASH_REGS];  // 每个崩溃寄存器的切片缓存
+
+    explicit ThreadCrashRecord(const InstInfo* i)
+        : info(i), exec_count(0), trace_seen(0), traced_count(0) {}
 };
 
-// ============ 易崩溃指令的完整记录 ============
-struct CrashProneRecord {
-    ADDRINT offset;                          // 指令偏移
-    std::string disasm;                      // 反汇编字符串
-    uint8_t cp_type;                         // 易崩溃类型
-    uint64_t exec_count;                     // 执行次数
+// ============ 每线程状态 (TLS) ============
+// 需按 64 字节对齐分配（见 ThreadStart），使影子寄存器堆对齐到 cache line
+struct ThreadState {
+    uint64_t shadow_regs[SHADOW_REG_SLOTS] __attribute__((aligned(64)));  // 编号 -> 最后写该寄存器的 dyn_id（0=未定义）
+    RingBuffer ring;                                   // 环形缓冲区
+    ShadowMemory shadow_mem;                           // 影子内存（存储 -> 加载）
+    uint64_t dyn_id;                                   // 最近一条动态指令 ID（即本线程已执行指令数）
+    std::vector<ThreadCrashRecord*> records;           // 静态指令 ID -> 本线程记录（无锁）
+    std::vector<uint64_t> inst_execs;                  // 静态指令 ID -> 本线程执行次数（追踪阶段）
+    uint64_t slice_cache_hits;                         // 切片缓存命中次数
+    uint64_t slice_cache_misses;                       // 实际执行 BFS 的次数
+
+    THREADID tid;                                      // Pin 线程号（按线程输出时用于文件名）
+
+    // 突发采样（-burst_trace）
+    ADDRINT burst_mode;                                // 当前阶段（BurstMode）
+    int64_t burst_left;                                // 当前阶段剩余指令数
+    uint64_t executed;                                 // 执行指令数（突发采样时 dyn_id 不连续）
+    uint64_t traced_executed;                          // 其中追踪阶段的指令数
+
+    ThreadState() : dyn_id(0), slice_cache_hits(0), slice_cache_misses(0), tid(0),
+                    burst_mode(0), burst_left(0), executed(0), traced_executed(0) {
+        memset(shadow_regs, 0, sizeof(shadow_regs));
+    }
 
-    // 崩溃寄存器列表（用于寻址/跳转目标/除数的寄存器）
-    std::vector<std::string> crash_regs;
+    ~ThreadState() {
+        for (size_t i = 0; i < records.size(); i++) delete records[i];
+    }
+};
 
-    // 每个崩溃寄存器的溯源结果
-    std::map<std::string, RegisterTrace> register_traces;
+// ============ 合并后的易崩溃指令记录 ============
+/*
+ * 非 -per_thread 模式下，线程结束时把本线程记录合并到按静态指令 ID 索引的表中，
+ * 命中次数在合并时按该线程的 exec_count / traced_count 外推；输出时逐条流式写出
+ */
+struct MergedCrashRecord {
+    const InstInfo* info;
+    uint64_t exec_count;                                     // 各线程执行次数之和
+    uint64_t traced_count;                                   // 各线程实际溯源次数之和
+    SourceMap reg_sources[UnifiedConfig::MAX_CRASH_REGS];   // hit_count 已外推
 
-    CrashProneRecord() : offset(0), cp_type(CP_NONE), exec_count(0) {}
+    explicit MergedCrashRecord(const InstInfo* i) : info(i), exec_count(0), traced_count(0) {}
 };
 
-// ============ 指令静态信息（插桩时提取）============
+// ============ 指令静态信息（ImageLoad 时提取，存放在连续数组中）============
 struct InstInfo {
     ADDRINT runtime_addr;                    // 运行时地址
+    uint32_t offset;                         // 主镜像内偏移
+    uint32_t static_id;                      // 静态指令 ID（同一地址重复插桩时相同）
     uint8_t cp_type;                         // 易崩溃类型
 
-    // 崩溃寄存器（归一化后的）
+    // 崩溃寄存器（归一化后的），及其影子寄存器编号
     REG crash_regs[UnifiedConfig::MAX_CRASH_REGS];
+    uint8_t crash_reg_ids[UnifiedConfig::MAX_CRASH_REGS];
     uint8_t num_crash_regs;
 
-    // 所有读寄存器（用于环形缓冲区）
-    REG read_regs[8];
+    // 所有读寄存器编号（用于环形缓冲区）
+    uint8_t read_regs[8];
     uint8_t num_reads;
 
-    // 所有写寄存器（用于shadow_regs更新）
-    REG write_regs[4];
+    // 所有写寄存器编号（用于shadow_regs更新）
+    uint8_t write_regs[4];
     uint8_t num_writes;
 
-    InstInfo() : runtime_addr(0), cp_type(CP_NONE), num_crash_regs(0),
-                 num_reads(0), num_writes(0) {
+    // 第一个内存读/写操作数的大小（0 = 无），用于影子内存
+    uint16_t mem_read_size;
+    uint16_t mem_write_size;
+
+    InstInfo() : runtime_addr(0), offset(0), static_id(0), cp_type(CP_NONE), num_crash_regs(0),
+                 num_reads(0), num_writes(0), mem_read_size(0), mem_write_size(0) {
         memset(crash_regs, 0, sizeof(crash_regs));
+        memset(crash_reg_ids, 0, sizeof(crash_reg_ids));
         memset(read_regs, 0, sizeof(read_regs));
         memset(write_regs, 0, sizeof(write_regs));
     }
 };
 
+// ============ 突发采样 ============
+/*
+ * 追踪 W 条指令 -> 只计数 S 条指令 -> 追踪 W 条 ...
+ * 两个阶段对应同一 trace 的两个版本，由工具寄存器中的阶段值在基本块入口切换
+ */
+enum BurstMode {
+    BURST_TRACE = 0,       // 完整插桩：环形缓冲区 + 溯源
+    BURST_COUNT = 1        // 只统计易崩溃指令执行次数
+};
+
+// 计数版本中每个基本块的易崩溃指令（插桩时构建，按块缓存）
+struct BurstBbl {
+    std::vector<InstInfo*> crash_insts;
+};
+
+// ============ 静态指令表 ============
+/*
+ * 每条插桩过的静态指令一项，反汇编只保存一份（重复插桩不会重复反汇编）
+ * ImageLoad 时写入，合并/输出时读取，均需持有 lock
+ */
+struct StaticInst {
+    ADDRINT offset;                          // 主镜像内偏移
+    std::string disasm;                      // 反汇编
+};
+
+struct StaticInstTable {
+    PIN_LOCK lock;
+    std::vector<StaticInst> insts;           // 静态指令 ID -> 指令
+    std::unordered_map<ADDRINT, uint32_t> ids;   // 偏移 -> 静态指令 ID
+    std::string empty;
+
+    // 返回偏移对应的 ID，首次出现时反汇编并登记
+    uint32_t intern(ADDRINT offset, INS ins) {
+        PIN_GetLock(&lock, 0);
+        auto it = ids.find(offset);
+        if (it == ids.end()) {
+            StaticInst si;
+            si.offset = offset;
+            si.disasm = INS_Disassemble(ins);
+            it = ids.insert(std::make_pair(offset, (uint32_t)insts.size())).first;
+            insts.push_back(si);
+        }
+        uint32_t id = it->second;
+        PIN_ReleaseLock(&lock);
+        return id;
+    }
+
+    // 调用者需持有 lock
+    const std::string& disasm(ADDRINT offset) const {
+        auto it = ids.find(offset);
+        return it == ids.end() ? empty : insts[it->second].disasm;
+    }
+};
+
+// ============ 流式输出 ============
+/*
+ * 缓冲写出 JSON / JSONL：内容先写入内存缓冲区，超过 CHUNK 字节时整块 fwrite，
+ * 字符串直接转义写入缓冲区，不构造中间 std::string
+ */
+class StreamWriter {
+public:
+    static const size_t CHUNK = 1 << 20;
+
+    StreamWriter() : fp(NULL) {}
+    ~StreamWriter() { close(); }
+
+    bool open(const std::string& path);
+    void close();
+
+    void raw(const char* s);
+    void printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+    void json_string(const std::string& s);      // 带引号并转义
+
+private:
+    FILE* fp;
+    std::string buf;
+
+    void flush_if_full() {
+        if (buf.size() >= CHUNK) flush();
+    }
+    void flush();
+};
+
 #endif // UNIFIED_TRACER_H
@@ -8,11 +8,14 @@
 
 #include <set>
 #include <map>
+#include <vector>
 #include <string>
+#include <algorithm>
 
 #include "pin.H"
 #include "utils.h"
 #include <stdlib.h>
+#include <stdio.h>
 using namespace std;
 
 KNOB<string> pc(KNOB_MODE_WRITEONCE, "pintool",
@@ -21,49 +24,151 @@ KNOB<string> pc(KNOB_MODE_WRITEONCE, "pintool",
 KNOB<UINT64> randint(KNOB_MODE_WRITEONCE, "pintool",
                      "randinst","0", "random instruction");
 
-static UINT64 iterations = 0;
+// Batch mode: each line of the file is "<pc> <randinst>" (pc in decimal or 0x-hex).
+// All pairs are resolved in a single run and written to -o as "<pc> <randinst> <kth>".
+KNOB<string> pairs_file(KNOB_MODE_WRITEONCE, "pintool",
+                        "pairs","", "file with (pc, randinst) pairs to resolve in one run");
 
+KNOB<string> batch_output(KNOB_MODE_WRITEONCE, "pintool",
+                          "o","kth_batch.txt", "output file for batch mode");
+
+// One (pc, global index) request; kth is the value fed to targeted_fi -target_kth
+struct PairRequest {
+    ADDRINT pc;
+    UINT64 randinst;
+    UINT64 kth;
+};
+
+// Per-PC state, only allocated for the target pcs
+struct PCCounter {
+    UINT64 occurrences;             // executions of this pc so far
+    vector<size_t> pending;         // indices into g_pairs, sorted by randinst
+    size_t next;                    // first pending pair not yet resolved
+};
+
+static vector<PairRequest> g_pairs;
+static map<ADDRINT, PCCounter*> g_counters;
+
+// Global dynamic instruction count, advanced once per BBL by its size
 static UINT64 randominst = 0;
 
-VOID countIteration(VOID *ip){
-    if (randominst < randint.Value()){
-        iterations++;
+VOID docount(UINT32 c) { randominst += c; }
+
+// Called before a target pc. back = (BBL size - position of ins in BBL), so
+// randominst - back is the 0-based global index of this execution, which is
+// the value the old per-instruction docount had at the same point.
+VOID countIteration(PCCounter *counter, UINT32 back){
+    UINT64 index = randominst - back;
+    // Every pending pair whose randinst is not beyond this execution is final:
+    // the old tool counted executions only while index < randinst.
+    while (counter->next < counter->pending.size()) {
+        PairRequest &req = g_pairs[counter->pending[counter->next]];
+        if (index < req.randinst)
+            break;
+        req.kth = counter->occurrences;
+        counter->next++;
     }
+    counter->occurrences++;
 }
 
-VOID docount(){randominst++;}
+// Pin calls this function every time a new trace is encountered
+VOID Trace(TRACE trace, VOID *v)
+{
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        UINT32 num = BBL_NumIns(bbl);
+        BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)docount, IARG_UINT32, num, IARG_END);
+
+        UINT32 pos = 0;
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins), pos++)
+        {
+            map<ADDRINT, PCCounter*>::iterator it = g_counters.find(INS_Address(ins));
+            if (it == g_counters.end())
+                continue;
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)countIteration,
+                           IARG_PTR, it->second,
+                           IARG_UINT32, num - pos,
+                           IARG_END);
+        }
+    }
+}
 
-//VOID printip(void *ip){
-//    if (static_cast<std::string>(ip) == pc.Value())
- //       interations ++;
-//}
-// Pin calls this function every time a new instruction is encountered
-VOID CountInst(INS ins, VOID *v)
+static void AddPair(ADDRINT addr, UINT64 index)
 {
-    stringstream ss;
-    ss << INS_Address(ins);
-    if (pc.Value() == ss.str()){
-        //cout << pc.Value() << " " << ss.str() << endl;
-        INS_InsertCall(ins,IPOINT_BEFORE,(AFUNPTR)countIteration,IARG_INST_PTR,IARG_END);
+    PairRequest req;
+    req.pc = addr;
+    req.randinst = index;
+    req.kth = 0;
+    g_pairs.push_back(req);
+}
+
+static bool LoadPairs(const string &filename)
+{
+    ifstream infile(filename.c_str());
+    if (!infile.is_open()) {
+        cerr << "Error: Unable to open file " << filename << endl;
+        return false;
     }
+    string line;
+    while (getline(infile, line)) {
+        istringstream iss(line);
+        string pc_str;
+        UINT64 index;
+        if (!(iss >> pc_str >> index))
+            continue;
+        AddPair(strtoull(pc_str.c_str(), NULL, 0), index);
+    }
+    infile.close();
+    return true;
+}
+
+static bool PairLess(size_t a, size_t b)
+{
+    return g_pairs[a].randinst < g_pairs[b].randinst;
+}
 
-    INS_InsertCall(ins,IPOINT_BEFORE,(AFUNPTR)docount,IARG_END);
+static void BuildCounters()
+{
+    for (size_t i = 0; i < g_pairs.size(); i++) {
+        PCCounter *&counter = g_counters[g_pairs[i].pc];
+        if (counter == NULL) {
+            counter = new PCCounter();
+            counter->occurrences = 0;
+            counter->next = 0;
+        }
+        counter->pending.push_back(i);
+    }
+    for (map<ADDRINT, PCCounter*>::iterator it = g_counters.begin(); it != g_counters.end(); ++it)
+        sort(it->second->pending.begin(), it->second->pending.end(), PairLess);
 }
 
-// bool mayChangeControlFlow(INS ins){
-// 	REG reg;
-// 	if(!INS_HasFallThrough(ins))
-// 		return true;
-// 	int numW = INS_MaxNumWRegs(ins);
-// 	for(int i =0; i < numW; i++){
-// 		if(reg == REG_RIP || reg == REG_EIP || reg == REG_IP) // conditional branches
-// 			return true;
-// 	}
-// 	return false;
-// }
 // This function is called when the application exits
 VOID Fini(INT32 code, VOID *v)
 {
+    // Pairs whose index was never passed by a later execution of their pc
+    // saw every execution of it
+    for (map<ADDRINT, PCCounter*>::iterator it = g_counters.begin(); it != g_counters.end(); ++it) {
+        PCCounter *counter = it->second;
+        for (; counter->next < counter->pending.size(); counter->next++) {
+            PairRequest &req = g_pairs[counter->pending[counter->next]];
+            req.kth = counter->occurrences;
+        }
+    }
+
+    if (!pairs_file.Value().empty()) {
+        FILE *fp = fopen(batch_output.Value().c_str(), "w");
+        if (!fp) {
+            cerr << "Unable to open " << batch_output.Value() << endl;
+            return;
+        }
+        for (size_t i = 0; i < g_pairs.size(); i++)
+            fprintf(fp, "0x%lx %lu %lu\n", g_pairs[i].pc, g_pairs[i].randinst, g_pairs[i].kth);
+        fclose(fp);
+        return;
+    }
+
+    UINT64 iterations = g_pairs.empty() ? 0 : g_pairs[0].kth;
+
     // Write to a file since cout and cerr maybe closed by the application
     ofstream OutFile;
     OutFile.open("iteration");
@@ -76,7 +181,7 @@ VOID Fini(INT32 code, VOID *v)
     if (logfile.is_open()) {
         logfile << "determineInst content:\t" <<"\n";
         logfile << "iteration:\t" << iterations <<"\n";
-        
+
         logfile.close();
     } else {
         std::cerr << "Unable to open randomInst_log file." << std::endl;
@@ -90,7 +195,9 @@ VOID Fini(INT32 code, VOID *v)
 
 INT32 Usage()
 {
-    cerr << "This tool counts the number of dynamic instructions executed" << endl;
+    cerr << "This tool counts how many times a pc executed before a global instruction index" << endl;
+    cerr << "  single: -pc <pc> -randinst <index>   (writes ./iteration)" << endl;
+    cerr << "  batch:  -pairs <file> [-o <file>]    (one \"<pc> <randinst>\" per line)" << endl;
     cerr << endl << KNOB_BASE::StringKnobSummary() << endl;
     return -1;
 }
@@ -103,8 +210,15 @@ int main(int argc, char * argv[])
     // Initialize pin
     if (PIN_Init(argc, argv)) return Usage();
 
-    // Register Instruction to be called to instrument instructions
-    INS_AddInstrumentFunction(CountInst, 0);
+    if (!pairs_file.Value().empty()) {
+        if (!LoadPairs(pairs_file.Value())) return Usage();
+    } else {
+        AddPair(strtoull(pc.Value().c_str(), NULL, 0), randint.Value());
+    }
+    BuildCounters();
+
+    // Register Trace to be called to instrument basic blocks
+    TRACE_AddInstrumentFunction(Trace, 0);
 
     // Register Fini to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
@@ -7,23 +7,25 @@
  * 使用方法：
  *   pin -t function_profiler.so -o output.json -- <program> [args]
  *   pin -t function_profiler.so -min_calls 5 -o output.json -- <program>
+ *   pin -t function_profiler.so -sample call -sample_rate 100 -o output.json -- <program>
  *
- * 输出格式：JSON
+ * 输出格式：JSON，可选每函数一行的 CSV（-csv）
  */
 
 #include "function_profiler.h"
 #include "../utils.h"
 #include <iostream>
-#include <fstream>
 #include <sstream>
-#include <iomanip>
 #include <algorithm>
 #include <cmath>
 #include <vector>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
 
 using std::cerr;
 using std::endl;
-using std::ofstream;
 using std::stringstream;
 using std::vector;
 
@@ -37,17 +39,57 @@ string g_main_img_name = "";
 ADDRINT g_main_img_low = 0;
 ADDRINT g_main_img_high = 0;
 
+// 函数ID -> 剖析数据（指向 g_function_profiles 中的元素）
+vector<FunctionProfile*> g_profile_list;
+
 // 全局统计
 UINT64 g_total_inst_executed = 0;
 
 // 线程安全锁
 PIN_LOCK g_lock;
 
+// 保存本线程 ThreadProfile* 的工具寄存器
+REG g_thread_reg = REG_INVALID();
+
+// 尚未归约的线程（Fini 时仍在运行的线程在 Fini 中归约）
+vector<ThreadProfile*> g_live_threads;
+
+// I类: 直接调用边（插桩时编号）和间接调用边（运行时插入并发哈希表）
+vector<CallEdge> g_call_edges;
+map<std::pair<UINT32, ADDRINT>, UINT32> g_call_edge_ids;
+UINT32 g_num_call_sites = 0;                        // 间接调用点数量
+
+// B1.5类: 静态访存操作数量（插桩时为每条访存指令的读/写各分配一个ID）
+UINT32 g_num_memops = 0;
+
+// 指令地址 -> 访存操作ID/调用ID（镜像加载时分配，Trace插桩时查找）
+map<ADDRINT, InsIds> g_ins_ids;
+// 不在镜像加载时静态解码结果中的指令（数据/填充导致解码错位、跳入另一种对齐等），
+// 没有访存操作ID/调用ID，不插入访存模式和调用边回调
+set<ADDRINT> g_unmapped_ins;
+
+// 采样模式: 调用指令的下一条指令（被调用函数返回后在此恢复调用者的版本）
+set<ADDRINT> g_return_sites;
+
+// 基本块增量：(片段首地址, (函数ID, 指令数)) -> 增量，每段只分配一次，
+// 代码缓存刷新后重新插桩、采样模式下的两个 trace 版本共用同一对象
+map<std::pair<ADDRINT, std::pair<UINT32, UINT32>>, BblDelta> g_bbl_deltas;
+#define DYN_CALL_EDGE_CAPACITY (1U << 14)           // 必须是2的幂
+DynCallEdge g_dyn_call_edges[DYN_CALL_EDGE_CAPACITY];
+map<std::pair<UINT32, ADDRINT>, DynCallEdge*> g_dyn_call_overflow;  // 哈希表满后使用，持 g_lock
+
+// H类: 静态边表之外的动态边（只插入不删除的并发哈希表，满后退回 FunctionProfile::extra_edges）
+#define EXTRA_EDGE_CAPACITY (1U << 14)              // 必须是2的幂
+ExtraEdge g_extra_edges[EXTRA_EDGE_CAPACITY];
+
 // ========== KNOB 参数定义 ==========
 
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool",
     "o", "function_profile.json", "输出JSON文件路径");
 
+KNOB<string> KnobCsvFile(KNOB_MODE_WRITEONCE, "pintool",
+    "csv", "", "额外输出CSV文件路径(每函数一行，为空则不输出)");
+
 KNOB<int> KnobMinCallCount(KNOB_MODE_WRITEONCE, "pintool",
     "min_calls", "1", "最小调用次数过滤(只输出调用次数>=此值的函数)");
 
@@ -57,26 +99,110 @@ KNOB<BOOL> KnobEnableDep(KNOB_MODE_WRITEONCE, "pintool",
 KNOB<BOOL> KnobEnableLifetime(KNOB_MODE_WRITEONCE, "pintool",
     "enable_lifetime", "0", "启用G类生命周期分析(有性能开销)");
 
-// ========== 辅助函数 ==========
+KNOB<string> KnobMetrics(KNOB_MODE_WRITEONCE, "pintool",
+    "metrics", "mix,mem,branch,loop,call,cfg",
+    "启用的指标组(逗号分隔): mix,mem,branch,loop,call,dep,life,cfg 或 all，未启用的组不插桩也不输出");
+
+KNOB<string> KnobSampleMode(KNOB_MODE_WRITEONCE, "pintool",
+    "sample", "none",
+    "采样模式: none(每次调用都完整剖析), call(每个函数每N次调用完整剖析1次), time(每N个时间窗口完整剖析1个)");
+
+KNOB<UINT32> KnobSampleRate(KNOB_MODE_WRITEONCE, "pintool",
+    "sample_rate", "100", "采样率N: 1/N 的调用或时间窗口被完整剖析");
+
+KNOB<UINT32> KnobSampleWindow(KNOB_MODE_WRITEONCE, "pintool",
+    "sample_window_us", "1000", "time 采样模式的时间窗口长度(微秒)");
+
+// ========== 采样 ==========
+
+enum SampleMode { SAMPLE_NONE, SAMPLE_CALL, SAMPLE_TIME };
+
+// trace 版本：轻量版本只统计调用次数，完整版本插入全部回调
+// Pin 在系统调用等情况下会把版本重置为 0，因此轻量版本取 0
+enum TraceVersion { VERSION_LIGHT = 0, VERSION_FULL = 1 };
+
+SampleMode g_sample_mode = SAMPLE_NONE;
+UINT32 g_sample_rate = 1;
+UINT64 g_sample_window_us = 1000;
+
+// 保存本线程当前调用是否完整剖析（即应执行的 trace 版本）的工具寄存器
+REG g_sample_reg = REG_INVALID();
+
+// time 采样模式每隔多少次调用读一次时钟
+#define SAMPLE_CLOCK_INTERVAL 64
+
+// ========== 指标组 ==========
+
+enum MetricGroup {
+    METRIC_MIX    = 1 << 0,     // B2/B3/D类: 指令类型、熵、寄存器读写
+    METRIC_MEM    = 1 << 1,     // B1/B1.5类: 访存次数与访问模式
+    METRIC_BRANCH = 1 << 2,     // C/E类: 分支次数、方向、间接跳转
+    METRIC_LOOP   = 1 << 3,     // C/E类: 循环迭代与嵌套深度
+    METRIC_CALL   = 1 << 4,     // C/E/I类: 调用次数、调用深度、调用图
+    METRIC_DEP    = 1 << 5,     // F类: 数据依赖
+    METRIC_LIFE   = 1 << 6,     // G类: 寄存器生命周期
+    METRIC_CFG    = 1 << 7      // H类: 圈复杂度
+};
+
+// 启用的指标组掩码（main 中由 -metrics / -enable_dep / -enable_lifetime 解析）
+UINT32 g_metrics = 0;
+
+inline bool MetricEnabled(UINT32 group) {
+    return (g_metrics & group) != 0;
+}
+
+/**
+ * 解析 -metrics 参数
+ * @return false 表示包含未知的组名
+ */
+bool ParseMetrics(const string& spec, UINT32& mask) {
+    static const struct { const char* name; UINT32 bit; } groups[] = {
+        {"mix", METRIC_MIX}, {"mem", METRIC_MEM}, {"branch", METRIC_BRANCH}, {"loop", METRIC_LOOP},
+        {"call", METRIC_CALL}, {"dep", METRIC_DEP}, {"life", METRIC_LIFE}, {"cfg", METRIC_CFG},
+    };
+    mask = 0;
+    stringstream ss(spec);
+    string item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        if (item == "all") {
+            mask = 0xff;
+            continue;
+        }
+        bool found = false;
+        for (const auto& g : groups) {
+            if (item == g.name) {
+                mask |= g.bit;
+                found = true;
+            }
+        }
+        if (!found) {
+            cerr << "[Function Profiler] Unknown metric group: " << item << endl;
+            return false;
+        }
+    }
+    return true;
+}
 
 /**
- * JSON转义函数
+ * 启用的指标组名称列表（写入 tool_info）
  */
-string escape_json(const string& s) {
+string MetricsToString(UINT32 mask) {
+    static const char* names[] = {"mix", "mem", "branch", "loop", "call", "dep", "life", "cfg"};
     string result;
-    for (char c : s) {
-        switch (c) {
-            case '"':  result += "\\\""; break;
-            case '\\': result += "\\\\"; break;
-            case '\n': result += "\\n"; break;
-            case '\r': result += "\\r"; break;
-            case '\t': result += "\\t"; break;
-            default: result += c;
+    for (int i = 0; i < 8; i++) {
+        if (mask & (1U << i)) {
+            if (!result.empty()) result += ",";
+            result += names[i];
         }
     }
     return result;
 }
 
+// ========== 辅助函数 ==========
+
 /**
  * 地址转十六进制字符串
  */
@@ -93,10 +219,10 @@ string addr_to_hex(ADDRINT addr) {
  * @param n 类型数量
  * @return 熵值（0表示完全单一，越大表示越均匀）
  */
-double ComputeInstructionEntropy(const vector<UINT64>& counts) {
+double ComputeInstructionEntropy(const UINT64* counts, size_t n) {
     UINT64 total = 0;
-    for (UINT64 c : counts) {
-        total += c;
+    for (size_t i = 0; i < n; i++) {
+        total += counts[i];
     }
 
     if (total == 0) {
@@ -104,9 +230,9 @@ double ComputeInstructionEntropy(const vector<UINT64>& counts) {
     }
 
     double entropy = 0.0;
-    for (UINT64 c : counts) {
-        if (c > 0) {
-            double p = (double)c / (double)total;
+    for (size_t i = 0; i < n; i++) {
+        if (counts[i] > 0) {
+            double p = (double)counts[i] / (double)total;
             entropy -= p * log2(p);
         }
     }
@@ -114,6 +240,49 @@ double ComputeInstructionEntropy(const vector<UINT64>& counts) {
     return entropy;
 }
 
+/**
+ * JSON对象段：字段直接写入 StreamWriter，第一个字段写入时才输出段头，
+ * 按指标组裁剪输出时，没有字段的段整体省略；段在析构时闭合
+ */
+class JsonSection {
+public:
+    JsonSection(StreamWriter& w, bool& first_section, const char* name)
+        : writer(w), first(first_section), name(name), num_fields(0) {}
+
+    ~JsonSection() {
+        if (num_fields > 0) {
+            writer.raw("\n      }");
+        }
+    }
+
+    void add(const char* key, UINT64 value) { field(key); writer.u64(value); }
+    void add(const char* key, UINT32 value) { field(key); writer.u64(value); }
+    void add(const char* key, INT32 value) { field(key); writer.i64(value); }
+    void add_fixed(const char* key, double value, int precision) { field(key); writer.fixed(value, precision); }
+    void add_null(const char* key) { field(key); writer.raw("null"); }
+
+    // 写出 "key": ，值由调用者随后直接写入
+    void field(const char* key) {
+        if (num_fields++ == 0) {
+            writer.raw(first ? "      \"" : ",\n      \"");
+            writer.raw(name);
+            writer.raw("\": {\n");
+            first = false;
+        } else {
+            writer.raw(",\n");
+        }
+        writer.raw("        \"");
+        writer.raw(key);
+        writer.raw("\": ");
+    }
+
+private:
+    StreamWriter& writer;
+    bool& first;                    // 所在对象中是否还没有输出过段
+    const char* name;
+    UINT32 num_fields;
+};
+
 /**
  * 判断是否为算术指令
  * 包括：ADD/SUB/MUL/DIV/INC/DEC/NEG/ADC/SBB等
@@ -332,451 +501,536 @@ bool ShouldSkipFunction(const string& func_name) {
 /**
  * 函数入口回调：统计调用次数
  */
-VOID FunctionEntry(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->call_exec), 1);
+VOID FunctionEntry(ThreadProfile* tp, UINT32 func_id) {
+    tp->counters[func_id].call_exec++;
+}
+
+/**
+ * 基本块执行回调：只统计指令数（mix/mem/branch/dep 指标组都未启用时使用）
+ */
+VOID ApplyBBLInstCount(ThreadProfile* tp, UINT32 func_id, UINT32 num_inst) {
+    tp->inst_executed += num_inst;
+    tp->counters[func_id].inst_exec += num_inst;
 }
 
 /**
- * 指令执行回调：统计总指令数
+ * 基本块执行回调：一次累加整个基本块的静态增量
+ * 取代逐指令的 CountInstruction / CountArithmeticExec / CountRegisterOps 等回调
  */
-VOID CountInstruction(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->inst_exec), 1);
-    __sync_fetch_and_add(&g_total_inst_executed, 1);
+VOID ApplyBBLDelta(ThreadProfile* tp, UINT32 func_id, const BblDelta* d) {
+    FunctionCounters& c = tp->counters[func_id];
+    tp->inst_executed += d->inst;
+    c.inst_exec += d->inst;
+    c.mem_inst_exec += d->mem_inst;
+    c.branch_exec += d->branch;
+    c.indirect_exec += d->indirect;
+    c.arith_exec += d->arith;
+    c.logic_exec += d->logic;
+    c.float_exec += d->fp;
+    c.simd_exec += d->simd;
+    c.pure_compute_exec += d->pure_compute;
+    c.data_movement_exec += d->data_movement;
+    c.compare_exec += d->compare;
+    c.stack_exec += d->stack;
+    c.string_exec += d->str;
+    c.nop_exec += d->nop;
+    c.other_exec += d->other;
+    c.reg_read_exec += d->reg_read;
+    c.reg_write_exec += d->reg_write;
+    c.mem_to_reg_exec += d->mem_to_reg;
+    c.reg_to_mem_exec += d->reg_to_mem;
 }
 
 // ========== 内存访问模式分析阈值 ==========
 #define SEQUENTIAL_THRESHOLD 64   // ±64字节内视为连续（缓存行大小）
 #define STRIDE_VARIANCE_THRESHOLD 8  // stride变化在8字节内视为步长访问
+#define MEMOP_MAX_CONFIDENCE 3    // 步长置信度上限，置信度降为0前不替换预测步长
+
+enum AccessPattern { ACCESS_FIRST, ACCESS_SEQUENTIAL, ACCESS_STRIDED, ACCESS_RANDOM };
 
 /**
- * 内存读访问模式分析回调
- * 统计读次数并分析访问模式（连续/步长/随机）
+ * 用访存操作自己的步长预测表项分类一次访问
+ * 步长与预测步长相符时置信度加1；不符时置信度减1，减到0后才换成新步长，
+ * 因此规则步长流中偶尔的跳变不会丢失已学到的步长
  */
-VOID AnalyzeMemoryReadPattern(FunctionProfile* profile, ADDRINT addr) {
-    __sync_fetch_and_add(&(profile->mem_read_exec), 1);
-
-    if (profile->has_last_read) {
-        INT64 stride = (INT64)addr - (INT64)profile->last_read_addr;
-        INT64 abs_stride = stride < 0 ? -stride : stride;
-
-        if (abs_stride <= SEQUENTIAL_THRESHOLD) {
-            // 连续访问：地址差在缓存行范围内
-            __sync_fetch_and_add(&(profile->seq_read_exec), 1);
-        } else {
-            // 检查stride是否稳定（与上次stride相近）
-            INT64 stride_diff = stride - profile->last_read_stride;
-            if (stride_diff < 0) stride_diff = -stride_diff;
-
-            if (stride_diff <= STRIDE_VARIANCE_THRESHOLD) {
-                // 步长访问：stride稳定
-                __sync_fetch_and_add(&(profile->stride_read_exec), 1);
-            } else {
-                // 随机访问：stride变化大
-                __sync_fetch_and_add(&(profile->random_read_exec), 1);
-            }
-        }
-        profile->last_read_stride = stride;
+inline AccessPattern ClassifyAccess(MemopState& m, ADDRINT addr) {
+    if (!m.valid) {
+        m.last_addr = addr;
+        m.valid = 1;
+        return ACCESS_FIRST;
+    }
+
+    INT64 stride = (INT64)addr - (INT64)m.last_addr;
+    INT64 abs_stride = stride < 0 ? -stride : stride;
+    INT64 stride_diff = stride - m.last_stride;
+    if (stride_diff < 0) stride_diff = -stride_diff;
+    bool predicted = stride_diff <= STRIDE_VARIANCE_THRESHOLD;
+
+    if (predicted) {
+        if (m.confidence < MEMOP_MAX_CONFIDENCE) m.confidence++;
+    } else if (m.confidence > 0) {
+        m.confidence--;
+    } else {
+        m.last_stride = stride;
     }
+    m.last_addr = addr;
 
-    profile->last_read_addr = addr;
-    profile->has_last_read = true;
+    if (abs_stride <= SEQUENTIAL_THRESHOLD) {
+        // 连续访问：地址差在缓存行范围内
+        return ACCESS_SEQUENTIAL;
+    }
+    // 步长访问：与预测步长相符；随机访问：步长变化大
+    return predicted ? ACCESS_STRIDED : ACCESS_RANDOM;
 }
 
 /**
- * 内存写访问模式分析回调
- * 统计写次数并分析访问模式（连续/步长/随机）
+ * 内存读访问模式分析回调
+ * 统计读次数并按该访存指令的步长历史分析访问模式（连续/步长/随机）
  */
-VOID AnalyzeMemoryWritePattern(FunctionProfile* profile, ADDRINT addr) {
-    __sync_fetch_and_add(&(profile->mem_write_exec), 1);
-
-    if (profile->has_last_write) {
-        INT64 stride = (INT64)addr - (INT64)profile->last_write_addr;
-        INT64 abs_stride = stride < 0 ? -stride : stride;
-
-        if (abs_stride <= SEQUENTIAL_THRESHOLD) {
-            // 连续访问
-            __sync_fetch_and_add(&(profile->seq_write_exec), 1);
-        } else {
-            // 检查stride是否稳定
-            INT64 stride_diff = stride - profile->last_write_stride;
-            if (stride_diff < 0) stride_diff = -stride_diff;
+VOID AnalyzeMemoryReadPattern(ThreadProfile* tp, UINT32 memop_id, UINT32 func_id, ADDRINT addr) {
+    FunctionCounters& c = tp->counters[func_id];
+    c.mem_read_exec++;
 
-            if (stride_diff <= STRIDE_VARIANCE_THRESHOLD) {
-                // 步长访问
-                __sync_fetch_and_add(&(profile->stride_write_exec), 1);
-            } else {
-                // 随机访问
-                __sync_fetch_and_add(&(profile->random_write_exec), 1);
-            }
-        }
-        profile->last_write_stride = stride;
+    switch (ClassifyAccess(tp->memops[memop_id], addr)) {
+        case ACCESS_SEQUENTIAL: c.seq_read_exec++; break;
+        case ACCESS_STRIDED:    c.stride_read_exec++; break;
+        case ACCESS_RANDOM:     c.random_read_exec++; break;
+        default: break;
     }
-
-    profile->last_write_addr = addr;
-    profile->has_last_write = true;
 }
 
 /**
- * 访存指令执行回调(不重复计数)
+ * 内存写访问模式分析回调
+ * 统计写次数并按该访存指令的步长历史分析访问模式（连续/步长/随机）
  */
-VOID CountMemoryInstExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->mem_inst_exec), 1);
-}
+VOID AnalyzeMemoryWritePattern(ThreadProfile* tp, UINT32 memop_id, UINT32 func_id, ADDRINT addr) {
+    FunctionCounters& c = tp->counters[func_id];
+    c.mem_write_exec++;
 
-/**
- * 分支执行回调
- */
-VOID CountBranch(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->branch_exec), 1);
+    switch (ClassifyAccess(tp->memops[memop_id], addr)) {
+        case ACCESS_SEQUENTIAL: c.seq_write_exec++; break;
+        case ACCESS_STRIDED:    c.stride_write_exec++; break;
+        case ACCESS_RANDOM:     c.random_write_exec++; break;
+        default: break;
+    }
 }
 
-/**
- * 间接跳转回调
- */
-VOID CountIndirectBranch(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->indirect_exec), 1);
-}
+// ========== E类: 控制流细化回调 ==========
 
 /**
- * 算术指令执行回调
+ * 分支方向统计回调
  */
-VOID CountArithmeticExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->arith_exec), 1);
+VOID CountBranchDirection(ThreadProfile* tp, UINT32 func_id, BOOL taken) {
+    if (taken) {
+        tp->counters[func_id].branch_taken_exec++;
+    } else {
+        tp->counters[func_id].branch_not_taken_exec++;
+    }
 }
 
 /**
- * 浮点指令执行回调
+ * 循环迭代计数回调（回边执行时调用）
+ * 同时用本线程的循环栈跟踪嵌套深度：
+ *   回边跳转 -> 循环ID不在栈中则压栈；在栈中则弹出其上层（内层循环已经退出）
+ *   回边不跳转 -> 循环退出，弹出该循环及其上层
+ * @param tp 本线程剖析状态
+ * @param func_id 函数ID
+ * @param loop_id 循环ID（镜像加载时按回边分配）
+ * @param taken 分支是否跳转（回边是否执行）
  */
-VOID CountFloatExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->float_exec), 1);
-}
+VOID TrackLoopExecution(ThreadProfile* tp, UINT32 func_id, UINT32 loop_id, BOOL taken) {
+    FunctionCounters& c = tp->counters[func_id];
 
-/**
- * 逻辑指令执行回调
- */
-VOID CountLogicExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->logic_exec), 1);
-}
+    // 在栈中查找该循环（从最内层开始）
+    UINT32 stored = c.loop_depth < MAX_LOOP_DEPTH ? c.loop_depth : MAX_LOOP_DEPTH;
+    UINT32 pos = stored;
+    while (pos > 0 && c.loop_stack[pos - 1] != loop_id) {
+        pos--;
+    }
 
-/**
- * SIMD指令执行回调
- */
-VOID CountSIMDExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->simd_exec), 1);
-}
+    if (taken) {
+        // 回边执行，表示循环继续
+        c.loop_iter_total++;
 
-/**
- * 纯计算指令执行回调
- */
-VOID CountPureComputeExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->pure_compute_exec), 1);
+        if (pos > 0) {
+            c.loop_depth = pos;
+        } else {
+            // 新进入的循环，增加嵌套深度；栈满后的循环无法区分，深度停在 MAX_LOOP_DEPTH + 1
+            if (c.loop_depth < MAX_LOOP_DEPTH) {
+                c.loop_stack[c.loop_depth] = loop_id;
+                c.loop_depth++;
+            } else {
+                c.loop_depth = MAX_LOOP_DEPTH + 1;
+            }
+            if (c.loop_depth > c.loop_depth_max) {
+                c.loop_depth_max = c.loop_depth;
+            }
+        }
+    } else if (pos > 0) {
+        // 回边未执行，表示循环退出
+        c.loop_depth = pos - 1;
+    } else if (c.loop_depth > MAX_LOOP_DEPTH) {
+        // 栈外的循环退出
+        c.loop_depth = MAX_LOOP_DEPTH;
+    }
 }
 
 /**
- * 数据移动指令执行回调
+ * 调用深度跟踪回调 - 函数调用
+ * 同时统计调用其他函数的次数
  */
-VOID CountDataMovementExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->data_movement_exec), 1);
-}
+VOID TrackCallDepthEnter(ThreadProfile* tp, UINT32 func_id) {
+    FunctionCounters& c = tp->counters[func_id];
 
-/**
- * 比较指令执行回调
- */
-VOID CountCompareExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->compare_exec), 1);
-}
+    // 统计调用其他函数次数
+    c.call_other_exec++;
 
-/**
- * 栈操作指令执行回调
- */
-VOID CountStackExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->stack_exec), 1);
+    // 更新调用深度（本线程内）
+    c.current_call_depth++;
+    if (c.current_call_depth > c.call_depth_max) {
+        c.call_depth_max = c.current_call_depth;
+    }
 }
 
 /**
- * 字符串指令执行回调
+ * 调用深度跟踪回调 - 函数返回
  */
-VOID CountStringExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->string_exec), 1);
+VOID TrackCallDepthExit(ThreadProfile* tp, UINT32 func_id) {
+    FunctionCounters& c = tp->counters[func_id];
+    if (c.current_call_depth > 0) {
+        c.current_call_depth--;
+    }
 }
 
+// ========== I类: 函数间调用图回调 ==========
+
 /**
- * NOP指令执行回调
+ * 在并发哈希表中查找或插入间接调用边（只在内联缓存未命中时调用）
+ * 表只插入不删除：用CAS抢占空槽，写完键后置为可用；表满时退回持锁的溢出表
  */
-VOID CountNopExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->nop_exec), 1);
+DynCallEdge* LookupDynCallEdge(UINT32 caller_id, ADDRINT callee_addr) {
+    UINT64 h = ((UINT64)callee_addr * 0x9E3779B97F4A7C15ULL) ^ ((UINT64)caller_id * 0xC2B2AE3D27D4EB4FULL);
+    UINT32 slot = (UINT32)(h >> 32) & (DYN_CALL_EDGE_CAPACITY - 1);
+
+    for (UINT32 probe = 0; probe < DYN_CALL_EDGE_CAPACITY; probe++) {
+        DynCallEdge& e = g_dyn_call_edges[slot];
+        if (e.state == 0 && __sync_bool_compare_and_swap(&e.state, 0, 1)) {
+            e.caller_id = caller_id;
+            e.callee_addr = callee_addr;
+            __sync_synchronize();
+            e.state = 2;
+            return &e;
+        }
+        while (e.state == 1) {
+            // 其他线程正在写入该槽的键
+        }
+        if (e.caller_id == caller_id && e.callee_addr == callee_addr) {
+            return &e;
+        }
+        slot = (slot + 1) & (DYN_CALL_EDGE_CAPACITY - 1);
+    }
+
+    PIN_GetLock(&g_lock, 1);
+    DynCallEdge*& overflow = g_dyn_call_overflow[std::make_pair(caller_id, callee_addr)];
+    if (overflow == NULL) {
+        overflow = new DynCallEdge();
+        overflow->caller_id = caller_id;
+        overflow->callee_addr = callee_addr;
+        overflow->state = 2;
+    }
+    PIN_ReleaseLock(&g_lock);
+    return overflow;
 }
 
 /**
- * 其他指令执行回调
+ * 把内联缓存中的本地计数累加到间接调用边
  */
-VOID CountOtherExec(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->other_exec), 1);
+inline VOID FlushCallSiteCache(CallSiteCache& cache) {
+    if (cache.edge != NULL && cache.pending > 0) {
+        __sync_fetch_and_add(&(cache.edge->count), cache.pending);
+    }
+    cache.pending = 0;
 }
 
-// ========== D类: 寄存器使用回调 ==========
-
 /**
- * 寄存器操作计数回调
+ * 直接调用回调：边ID在插桩时确定，只增加本线程计数
  */
-VOID CountRegisterOps(FunctionProfile* profile, UINT32 num_reads, UINT32 num_writes) {
-    __sync_fetch_and_add(&(profile->reg_read_exec), num_reads);
-    __sync_fetch_and_add(&(profile->reg_write_exec), num_writes);
+VOID RecordDirectCall(ThreadProfile* tp, UINT32 edge_id) {
+    tp->call_edge_counts[edge_id]++;
 }
 
-// ========== E类: 控制流细化回调 ==========
-
 /**
- * 分支方向统计回调
+ * 间接调用回调：目标与上次相同时只增加本地计数，否则查哈希表并切换缓存
+ * @param site_id 间接调用点ID
+ * @param caller_id 调用者函数ID
+ * @param target 运行时调用目标
  */
-VOID CountBranchDirection(FunctionProfile* profile, BOOL taken) {
-    if (taken) {
-        __sync_fetch_and_add(&(profile->branch_taken_exec), 1);
-    } else {
-        __sync_fetch_and_add(&(profile->branch_not_taken_exec), 1);
+VOID RecordIndirectCall(ThreadProfile* tp, UINT32 site_id, UINT32 caller_id, ADDRINT target) {
+    CallSiteCache& cache = tp->site_caches[site_id];
+    if (cache.target == target && cache.edge != NULL) {
+        cache.pending++;
+        return;
     }
+    FlushCallSiteCache(cache);
+    cache.edge = LookupDynCallEdge(caller_id, target);
+    cache.target = target;
+    cache.pending = 1;
 }
 
+// ========== F类/G类: 寄存器数据流回调 ==========
+
 /**
- * 循环迭代计数回调（回边执行时调用）
- * 同时跟踪循环嵌套深度
- * @param profile 函数剖析数据指针
- * @param backedge_addr 回边指令地址（用于标识不同的循环）
- * @param taken 分支是否跳转（回边是否执行）
+ * 寄存器数据流回调：一次完成F类数据依赖和G类生命周期统计
+ * @param read_mask 本指令读的寄存器（紧凑寄存器ID掩码，插桩时计算）
+ * @param write_mask 本指令写的寄存器
  */
-VOID TrackLoopExecution(FunctionProfile* profile, ADDRINT backedge_addr, BOOL taken) {
-    if (taken) {
-        // 回边执行，表示循环继续
-        __sync_fetch_and_add(&(profile->loop_iter_total), 1);
-
-        // 检查是否是新进入的循环
-        PIN_GetLock(&g_lock, 1);
-        if (profile->active_loops.find(backedge_addr) == profile->active_loops.end()) {
-            // 新循环，增加嵌套深度
-            profile->active_loops.insert(backedge_addr);
-            profile->current_loop_depth = profile->active_loops.size();
-            if (profile->current_loop_depth > profile->loop_depth_max) {
-                profile->loop_depth_max = profile->current_loop_depth;
+VOID TrackRegisterDataflow(ThreadProfile* tp, UINT32 func_id, ADDRINT read_mask, ADDRINT write_mask) {
+    RegDataflowState& r = tp->regs;
+    FunctionCounters& c = tp->counters[func_id];
+    UINT64 current_id = ++r.dyn_id;
+    bool dep = MetricEnabled(METRIC_DEP);
+    bool life = MetricEnabled(METRIC_LIFE);
+
+    // 读寄存器：定义-使用对、依赖距离、存活时间
+    UINT64 reads = read_mask & r.defined_mask;
+    while (reads != 0) {
+        UINT32 idx = __builtin_ctzll(reads);
+        UINT64 bit = reads & (0 - reads);
+        reads ^= bit;
+
+        UINT64 dist = current_id - r.def_id[idx];
+        if (dep) {
+            c.def_use_pairs++;
+            if (dist > c.reg_dep_chain_max) {
+                c.reg_dep_chain_max = (UINT32)std::min<UINT64>(dist, 0xffffffffU);
+            }
+        }
+        if (life) {
+            c.reg_lifetime_total += dist;
+            // 首次使用距离
+            if ((r.used_mask & bit) == 0) {
+                c.first_use_dist_total += dist;
             }
         }
-        PIN_ReleaseLock(&g_lock);
-    } else {
-        // 回边未执行，表示循环退出
-        PIN_GetLock(&g_lock, 1);
-        profile->active_loops.erase(backedge_addr);
-        profile->current_loop_depth = profile->active_loops.size();
-        PIN_ReleaseLock(&g_lock);
     }
-}
+    r.used_mask |= read_mask;
 
-/**
- * 调用深度跟踪回调 - 函数调用
- * 同时统计调用其他函数的次数
- */
-VOID TrackCallDepthEnter(FunctionProfile* profile) {
-    // 统计调用其他函数次数
-    __sync_fetch_and_add(&(profile->call_other_exec), 1);
+    if (write_mask == 0) {
+        return;
+    }
 
-    // 更新调用深度
-    UINT32 new_depth = __sync_add_and_fetch(&(profile->current_call_depth), 1);
-    // 更新最大深度（无锁方式）
-    UINT32 old_max = profile->call_depth_max;
-    while (new_depth > old_max) {
-        if (__sync_bool_compare_and_swap(&(profile->call_depth_max), old_max, new_depth)) {
-            break;
-        }
-        old_max = profile->call_depth_max;
+    // 写寄存器：上次定义后未被读取即被覆盖的是死写
+    if (life) {
+        c.dead_write_exec += __builtin_popcountll(write_mask & r.defined_mask & ~r.used_mask);
+    }
+    UINT64 writes = write_mask;
+    while (writes != 0) {
+        UINT32 idx = __builtin_ctzll(writes);
+        writes &= writes - 1;
+        r.def_id[idx] = current_id;
     }
+    r.defined_mask |= write_mask;
+    r.used_mask &= ~(UINT64)write_mask;
 }
 
+// ========== H类: 动态圈复杂度回调 ==========
+
 /**
- * 调用深度跟踪回调 - 函数返回
+ * 置位覆盖位图：只有首次命中时才执行原子或，之后只是一次普通读
  */
-VOID TrackCallDepthExit(FunctionProfile* profile) {
-    if (profile->current_call_depth > 0) {
-        __sync_fetch_and_sub(&(profile->current_call_depth), 1);
+inline VOID SetCoverageBit(UINT64* bits, UINT32 id) {
+    UINT64* word = &bits[id >> 6];
+    UINT64 mask = 1ULL << (id & 63);
+    if ((*word & mask) == 0) {
+        __sync_fetch_and_or(word, mask);
     }
 }
 
-// ========== I类: 函数间调用图回调 ==========
-
 /**
- * 记录调用边：caller调用callee
- * 用于计算fan_in和fan_out
- * @param caller_profile 调用者的profile
- * @param callee_addr 被调用函数的地址
+ * 统计位图中置位的个数
  */
-VOID RecordCallEdge(FunctionProfile* caller_profile, ADDRINT callee_addr) {
-    // 记录caller调用了callee (用于计算caller的fan_out)
-    PIN_GetLock(&g_lock, 1);
-    caller_profile->callees_set.insert(callee_addr);
-
-    // 记录callee被caller调用 (用于计算callee的fan_in)
-    // 需要找到callee的profile
-    if (g_function_profiles.find(callee_addr) != g_function_profiles.end()) {
-        g_function_profiles[callee_addr].callers_set.insert(caller_profile->start_addr);
+UINT32 CountCoverageBits(const vector<UINT64>& bits) {
+    UINT32 count = 0;
+    for (UINT64 w : bits) {
+        count += __builtin_popcountll(w);
     }
-    PIN_ReleaseLock(&g_lock);
+    return count;
 }
 
-// ========== F类: 数据依赖回调 ==========
-
 /**
- * 将Pin寄存器映射到0-15的通用寄存器索引
- * 返回-1表示不是通用寄存器
+ * 记录静态边表之外的边：在并发哈希表中查找或插入，已存在时不加锁、不写内存
+ * 表只插入不删除，用CAS抢占空槽；表满时退回持锁的 extra_edges
  */
-inline INT32 MapRegToIndex(REG reg) {
-    // 64位通用寄存器
-    if (reg >= REG_RAX && reg <= REG_R15) {
-        return reg - REG_RAX;
-    }
-    // 32位通用寄存器映射到对应的64位
-    if (reg >= REG_EAX && reg <= REG_R15D) {
-        return reg - REG_EAX;
-    }
-    // 16位通用寄存器
-    if (reg >= REG_AX && reg <= REG_R15W) {
-        return reg - REG_AX;
-    }
-    // 8位低位寄存器 (AL, CL, DL, BL, SPL, BPL, SIL, DIL, R8B-R15B)
-    if (reg >= REG_AL && reg <= REG_R15B) {
-        return reg - REG_AL;
+VOID RecordExtraEdge(FunctionProfile* profile, UINT32 src_bbl, UINT32 dst_bbl) {
+    UINT64 h = ((UINT64)profile->func_id * 0xC2B2AE3D27D4EB4FULL) ^
+               ((((UINT64)src_bbl << 32) | dst_bbl) * 0x9E3779B97F4A7C15ULL);
+    UINT32 slot = (UINT32)(h >> 32) & (EXTRA_EDGE_CAPACITY - 1);
+
+    for (UINT32 probe = 0; probe < EXTRA_EDGE_CAPACITY; probe++) {
+        ExtraEdge& e = g_extra_edges[slot];
+        if (e.state == 0 && __sync_bool_compare_and_swap(&e.state, 0, 1)) {
+            e.func_id = profile->func_id;
+            e.src_bbl = src_bbl;
+            e.dst_bbl = dst_bbl;
+            __sync_synchronize();
+            e.state = 2;
+            return;
+        }
+        while (e.state == 1) {
+            // 其他线程正在写入该槽的键
+        }
+        if (e.func_id == profile->func_id && e.src_bbl == src_bbl && e.dst_bbl == dst_bbl) {
+            return;
+        }
+        slot = (slot + 1) & (EXTRA_EDGE_CAPACITY - 1);
     }
-    return -1;  // 不是通用寄存器
+
+    PIN_GetLock(&g_lock, 1);
+    profile->extra_edges.insert(std::make_pair(src_bbl, dst_bbl));
+    PIN_ReleaseLock(&g_lock);
 }
 
 /**
- * 数据依赖跟踪回调
- * 统计定义-使用对和依赖链长度
+ * BBL执行回调：跟踪基本块执行和控制流边
+ * @param profile 函数剖析数据指针
+ * @param tp 本线程剖析状态
+ * @param bbl_id 当前BBL的静态ID
  */
-VOID TrackDataDependency(FunctionProfile* profile,
-                         REG read_reg1, REG read_reg2, REG read_reg3, REG read_reg4,
-                         REG write_reg1, REG write_reg2) {
-    profile->current_dyn_id++;
-    UINT64 current_id = profile->current_dyn_id;
+VOID TrackBBLExecution(FunctionProfile* profile, ThreadProfile* tp, UINT32 bbl_id) {
+    FunctionCounters& c = tp->counters[profile->func_id];
 
-    // 处理读寄存器（最多4个）
-    REG read_regs[4] = {read_reg1, read_reg2, read_reg3, read_reg4};
-    for (int i = 0; i < 4; i++) {
-        if (read_regs[i] == REG_INVALID()) continue;
-        INT32 idx = MapRegToIndex(read_regs[i]);
-        if (idx >= 0 && idx < 16) {
-            UINT64 def_id = profile->reg_last_def_id[idx];
-            if (def_id > 0) {
-                __sync_fetch_and_add(&(profile->def_use_pairs), 1);
-                // 计算依赖链长度
-                UINT32 chain_len = (UINT32)(current_id - def_id);
-                UINT32 old_max = profile->reg_dep_chain_max;
-                while (chain_len > old_max) {
-                    if (__sync_bool_compare_and_swap(&(profile->reg_dep_chain_max), old_max, chain_len)) {
-                        break;
-                    }
-                    old_max = profile->reg_dep_chain_max;
-                }
+    // 统计BBL执行次数
+    c.bbl_exec++;
+
+    // 记录执行过的唯一BBL
+    SetCoverageBit(profile->bbl_bits.data(), bbl_id);
+
+    // 记录控制流边 (上一个BBL -> 当前BBL)
+    if (c.last_bbl_slot != 0) {
+        UINT32 last_id = c.last_bbl_slot - 1;
+        UINT32 edge_id = UINT32(-1);
+        for (UINT32 k = profile->succ_begin[last_id]; k < profile->succ_begin[last_id + 1]; k++) {
+            if (profile->succ_bbl[k] == bbl_id) {
+                edge_id = profile->succ_edge[k];
+                break;
             }
         }
-    }
-
-    // 处理写寄存器（最多2个）
-    REG write_regs[2] = {write_reg1, write_reg2};
-    for (int i = 0; i < 2; i++) {
-        if (write_regs[i] == REG_INVALID()) continue;
-        INT32 idx = MapRegToIndex(write_regs[i]);
-        if (idx >= 0 && idx < 16) {
-            profile->reg_last_def_id[idx] = current_id;
+        if (edge_id != UINT32(-1)) {
+            SetCoverageBit(profile->edge_bits.data(), edge_id);
+        } else {
+            // 静态分析看不到的边（间接跳转等）
+            RecordExtraEdge(profile, last_id, bbl_id);
         }
     }
+    c.last_bbl_slot = bbl_id + 1;
 }
 
 /**
- * 内存到寄存器传递计数
+ * 函数入口时重置本次调用的跟踪状态
+ * 重置上一个BBL以避免跨调用的虚假边；清空循环栈，
+ * 避免上次调用从循环中途返回后残留的循环被计入嵌套深度
  */
-VOID CountMemToReg(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->mem_to_reg_exec), 1);
+VOID ResetInvocationState(ThreadProfile* tp, UINT32 func_id) {
+    FunctionCounters& c = tp->counters[func_id];
+    c.last_bbl_slot = 0;
+    c.loop_depth = 0;
+}
+
+// ========== 采样回调 ==========
+
+inline UINT64 NowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
 /**
- * 寄存器到内存传递计数
+ * 弹出入口栈指针低于 limit 的调用（已返回、尾调用或 longjmp 跳过的调用），
+ * 记录完整剖析调用的指令数用于估计采样误差
  */
-VOID CountRegToMem(FunctionProfile* profile) {
-    __sync_fetch_and_add(&(profile->reg_to_mem_exec), 1);
+inline VOID PopSampleFrames(ThreadProfile* tp, ADDRINT limit) {
+    while (tp->sample_depth > 0 && tp->sample_stack[tp->sample_depth - 1].sp < limit) {
+        const SampleFrame& f = tp->sample_stack[--tp->sample_depth];
+        if (f.sampled) {
+            FunctionCounters& c = tp->counters[f.func_id];
+            UINT64 n = c.inst_exec - f.inst_base;
+            c.sample_inst_sum += n;
+            c.sample_inst_sumsq += (double)n * (double)n;
+        }
+    }
 }
 
-// ========== G类: 生命周期回调 ==========
+inline ADDRINT CurrentSampleVersion(ThreadProfile* tp) {
+    if (tp->sample_depth == 0) {
+        return VERSION_LIGHT;
+    }
+    return tp->sample_stack[tp->sample_depth - 1].sampled ? VERSION_FULL : VERSION_LIGHT;
+}
 
 /**
- * 寄存器生命周期跟踪回调
+ * 采样模式的函数入口回调：统计调用次数，决定本次调用是否完整剖析
+ * 返回值写入 g_sample_reg，随后的版本分支据此切换到对应版本的 trace
+ * 切换后新 trace 会在同一条入口指令上再执行一次本回调，此时栈顶就是本次调用，直接返回
  */
-VOID TrackRegisterLifetime(FunctionProfile* profile,
-                           REG read_reg1, REG read_reg2, REG read_reg3, REG read_reg4,
-                           REG write_reg1, REG write_reg2) {
-    UINT64 current_id = profile->current_dyn_id;  // 使用F类已更新的ID
+ADDRINT SampleEnter(ThreadProfile* tp, UINT32 func_id, ADDRINT sp) {
+    if (tp->sample_depth > 0) {
+        const SampleFrame& top = tp->sample_stack[tp->sample_depth - 1];
+        if (top.sp == sp && top.func_id == func_id) {
+            return top.sampled ? VERSION_FULL : VERSION_LIGHT;
+        }
+    }
+    PopSampleFrames(tp, sp + 1);
 
-    // 处理读寄存器：计算生命周期
-    REG read_regs[4] = {read_reg1, read_reg2, read_reg3, read_reg4};
-    for (int i = 0; i < 4; i++) {
-        if (read_regs[i] == REG_INVALID()) continue;
-        INT32 idx = MapRegToIndex(read_regs[i]);
-        if (idx >= 0 && idx < 16) {
-            UINT64 def_id = profile->reg_def_id[idx];
-            if (def_id > 0) {
-                UINT64 lifetime = current_id - def_id;
-                __sync_fetch_and_add(&(profile->reg_lifetime_total), lifetime);
+    FunctionCounters& c = tp->counters[func_id];
+    c.call_exec++;
+    if (tp->sample_depth == SAMPLE_STACK_DEPTH) {
+        return VERSION_LIGHT;
+    }
 
-                // 首次使用距离
-                if (!profile->reg_was_used[idx]) {
-                    __sync_fetch_and_add(&(profile->first_use_dist_total), lifetime);
-                    profile->reg_was_used[idx] = true;
-                }
+    bool sampled;
+    if (g_sample_mode == SAMPLE_CALL) {
+        sampled = (c.sample_countdown == 0);
+        c.sample_countdown = sampled ? g_sample_rate - 1 : c.sample_countdown - 1;
+    } else {
+        if (tp->clock_countdown == 0) {
+            tp->clock_countdown = SAMPLE_CLOCK_INTERVAL;
+            UINT64 now = NowMicros();
+            if (now >= tp->window_end) {
+                // 窗口按绝对时间对齐，各线程同时完整剖析
+                UINT64 window = now / g_sample_window_us;
+                tp->window_end = (window + 1) * g_sample_window_us;
+                tp->window_sampled = (window % g_sample_rate == 0);
             }
         }
+        tp->clock_countdown--;
+        sampled = tp->window_sampled != 0;
     }
 
-    // 处理写寄存器：检测死写
-    REG write_regs[2] = {write_reg1, write_reg2};
-    for (int i = 0; i < 2; i++) {
-        if (write_regs[i] == REG_INVALID()) continue;
-        INT32 idx = MapRegToIndex(write_regs[i]);
-        if (idx >= 0 && idx < 16) {
-            // 如果上次写入后未被读取，是死写
-            if (profile->reg_def_id[idx] > 0 && !profile->reg_was_used[idx]) {
-                __sync_fetch_and_add(&(profile->dead_write_exec), 1);
-            }
-            profile->reg_def_id[idx] = current_id;
-            profile->reg_was_used[idx] = false;
-        }
+    SampleFrame& f = tp->sample_stack[tp->sample_depth++];
+    f.sp = sp;
+    f.func_id = func_id;
+    f.sampled = sampled;
+    f.inst_base = c.inst_exec;
+    if (sampled) {
+        c.sampled_calls++;
     }
+    return sampled ? VERSION_FULL : VERSION_LIGHT;
 }
 
-// ========== H类: 动态圈复杂度回调 ==========
-
 /**
- * BBL执行回调：跟踪基本块执行和控制流边
- * @param profile 函数剖析数据指针
- * @param bbl_addr 当前BBL的起始地址
+ * 采样模式的返回点回调（调用指令的下一条指令）：弹出已返回的调用，恢复调用者的版本
  */
-VOID TrackBBLExecution(FunctionProfile* profile, ADDRINT bbl_addr) {
-    // 统计BBL执行次数
-    __sync_fetch_and_add(&(profile->bbl_exec), 1);
-
-    // 记录执行过的唯一BBL
-    PIN_GetLock(&g_lock, 1);
-    profile->executed_bbls.insert(bbl_addr);
-
-    // 记录控制流边 (上一个BBL -> 当前BBL)
-    if (profile->last_bbl_addr != 0) {
-        profile->executed_edges.insert(std::make_pair(profile->last_bbl_addr, bbl_addr));
-    }
-    profile->last_bbl_addr = bbl_addr;
-    PIN_ReleaseLock(&g_lock);
+ADDRINT SampleReturn(ThreadProfile* tp, ADDRINT sp) {
+    PopSampleFrames(tp, sp);
+    return CurrentSampleVersion(tp);
 }
 
 /**
- * 函数入口时重置BBL跟踪状态
- * 每次函数调用开始时，重置last_bbl_addr以避免跨调用的虚假边
+ * 采样模式的 ret 回调：ret 时栈指针与入口相同，弹出本次调用
+ * 返回到未插桩代码（如库函数回调）时没有返回点，依靠这里弹出
  */
-VOID ResetBBLTracking(FunctionProfile* profile) {
-    profile->last_bbl_addr = 0;
+VOID SampleLeave(ThreadProfile* tp, ADDRINT sp) {
+    PopSampleFrames(tp, sp + 1);
 }
 
 // ========== 静态分析函数 ==========
@@ -828,6 +1082,7 @@ VOID AnalyzeStaticInstruction(INS ins, FunctionProfile& profile) {
             ADDRINT target = INS_DirectControlFlowTargetAddress(ins);
             if (target < pc && target >= profile.start_addr && target < profile.end_addr) {
                 profile.loop_static++;
+                profile.backedge_addrs.push_back(pc);
             }
         }
     }
@@ -918,256 +1173,507 @@ VOID AnalyzeStaticInstruction(INS ins, FunctionProfile& profile) {
 }
 
 /**
- * 动态插桩
- * 在插桩时为指令插入运行时回调
+ * 取得直接调用边ID，同一(调用者, 被调用地址)只分配一次
  */
-VOID InstrumentDynamicAnalysis(INS ins, FunctionProfile* profile, ADDRINT pc) {
-    // 所有指令：统计执行次数
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountInstruction,
-                   IARG_PTR, profile,
-                   IARG_END);
+UINT32 GetDirectCallEdge(UINT32 caller_id, ADDRINT callee_addr) {
+    std::pair<UINT32, ADDRINT> key(caller_id, callee_addr);
+    map<std::pair<UINT32, ADDRINT>, UINT32>::iterator it = g_call_edge_ids.find(key);
+    if (it != g_call_edge_ids.end()) {
+        return it->second;
+    }
+
+    // 被调用函数可能位于更高地址、尚未登记，callee_id 在全部函数登记后由 ResolveCallEdgeCallees 填写
+    CallEdge edge;
+    edge.caller_id = caller_id;
+    edge.callee_id = NO_FUNC_ID;
+    edge.callee_addr = callee_addr;
+    edge.count = 0;
+
+    UINT32 edge_id = g_call_edges.size();
+    g_call_edges.push_back(edge);
+    g_call_edge_ids[key] = edge_id;
+    return edge_id;
+}
 
-    // 内存读 - 使用地址分析访问模式
-    if (INS_IsMemoryRead(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)AnalyzeMemoryReadPattern,
-                       IARG_PTR, profile,
-                       IARG_MEMORYREAD_EA,
-                       IARG_END);
-    }
+/**
+ * 查找入口地址对应的被剖析函数ID，NO_FUNC_ID 表示不是被剖析的函数
+ */
+UINT32 FindFunctionId(ADDRINT addr) {
+    map<ADDRINT, FunctionProfile>::const_iterator it = g_function_profiles.find(addr);
+    return (it != g_function_profiles.end()) ? it->second.func_id : NO_FUNC_ID;
+}
 
-    // 内存写 - 使用地址分析访问模式
-    if (INS_IsMemoryWrite(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)AnalyzeMemoryWritePattern,
-                       IARG_PTR, profile,
-                       IARG_MEMORYWRITE_EA,
-                       IARG_END);
+/**
+ * 主镜像的全部函数登记后，为直接调用边解析被调用函数ID
+ */
+VOID ResolveCallEdgeCallees() {
+    for (CallEdge& edge : g_call_edges) {
+        edge.callee_id = FindFunctionId(edge.callee_addr);
     }
+}
 
-    // 访存指令执行(不重复计数：一条指令同时读写只计一次)
-    if (INS_IsMemoryRead(ins) || INS_IsMemoryWrite(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountMemoryInstExec,
-                       IARG_PTR, profile,
-                       IARG_END);
-    }
+/**
+ * 把Pin寄存器映射到紧凑寄存器ID，插桩时使用
+ * 返回-1表示不跟踪（栈指针、指令指针、段寄存器、x87等）
+ * 栈指针的读写主要来自 push/pop/call/ret 的隐式操作，不计入数据依赖
+ */
+INT32 RegToCompactId(REG reg) {
+    static const REG gprs[16] = {
+        REG_RAX, REG_RBX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_RBP, REG_RSP,
+        REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15
+    };
 
-    // 分支
-    if (INS_IsBranch(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountBranch,
-                       IARG_PTR, profile,
-                       IARG_END);
+    if (!REG_valid(reg)) {
+        return -1;
     }
-
-    // 间接跳转
-    if (INS_IsIndirectControlFlow(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountIndirectBranch,
-                       IARG_PTR, profile,
-                       IARG_END);
+    if (REG_is_xmm(reg) && reg - REG_XMM0 < 32) {
+        return REG_ID_VEC_BASE + (reg - REG_XMM0);
     }
-
-    // ========== 计算特性动态统计 ==========
-    // 算术指令执行
-    if (IsArithmeticInstruction(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountArithmeticExec,
-                       IARG_PTR, profile,
-                       IARG_END);
+    if (REG_is_ymm(reg) && reg - REG_YMM0 < 32) {
+        return REG_ID_VEC_BASE + (reg - REG_YMM0);
+    }
+    if (REG_is_zmm(reg) && reg - REG_ZMM0 < 32) {
+        return REG_ID_VEC_BASE + (reg - REG_ZMM0);
+    }
+    if (REG_is_flags(reg)) {
+        return REG_ID_FLAGS;
     }
 
-    // 浮点指令执行
-    if (IsFloatInstruction(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountFloatExec,
-                       IARG_PTR, profile,
-                       IARG_END);
+    REG full = REG_FullRegName(reg);
+    if (full == REG_STACK_PTR) {
+        return -1;
     }
-
-    // 逻辑指令执行
-    if (IsLogicInstruction(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountLogicExec,
-                       IARG_PTR, profile,
-                       IARG_END);
+    for (INT32 i = 0; i < 16; i++) {
+        if (full == gprs[i]) {
+            return i;
+        }
     }
+    return -1;
+}
 
-    // SIMD指令执行
-    if (IsSIMDInstruction(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountSIMDExec,
-                       IARG_PTR, profile,
-                       IARG_END);
+/**
+ * 指令读或写的全部寄存器（含隐式操作数）的紧凑寄存器ID掩码
+ */
+UINT64 InsRegMask(INS ins, bool write) {
+    UINT64 mask = 0;
+    UINT32 num = write ? INS_MaxNumWRegs(ins) : INS_MaxNumRRegs(ins);
+    for (UINT32 i = 0; i < num; i++) {
+        INT32 id = RegToCompactId(write ? INS_RegW(ins, i) : INS_RegR(ins, i));
+        if (id >= 0) {
+            mask |= 1ULL << id;
+        }
     }
+    return mask;
+}
 
-    // 纯计算指令执行
-    if (IsPureComputeInstruction(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountPureComputeExec,
-                       IARG_PTR, profile,
-                       IARG_END);
+/**
+ * 为需要运行时状态的指令分配ID（访存操作ID、调用边ID、间接调用点ID）
+ * 在镜像加载时调用，此时还没有线程开始，每线程数组按最终的ID数量分配
+ */
+VOID AssignInstructionIds(INS ins, FunctionProfile& profile) {
+    InsIds ids;
+    bool needed = false;
+
+    if (MetricEnabled(METRIC_MEM)) {
+        if (INS_IsMemoryRead(ins)) {
+            ids.read_memop = g_num_memops++;
+            needed = true;
+        }
+        if (INS_IsMemoryWrite(ins)) {
+            ids.write_memop = g_num_memops++;
+            needed = true;
+        }
     }
 
-    // 数据移动指令执行
-    if (IsDataMovementInstruction(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountDataMovementExec,
-                       IARG_PTR, profile,
-                       IARG_END);
+    if (MetricEnabled(METRIC_CALL) && INS_IsCall(ins)) {
+        if (INS_IsDirectControlFlow(ins)) {
+            ids.call_id = GetDirectCallEdge(profile.func_id, INS_DirectControlFlowTargetAddress(ins));
+        } else {
+            ids.call_id = g_num_call_sites++;
+        }
+        needed = true;
     }
 
-    // 比较指令执行
-    if (IsCompareInstruction(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountCompareExec,
-                       IARG_PTR, profile,
-                       IARG_END);
+    if (needed) {
+        g_ins_ids[INS_Address(ins)] = ids;
     }
 
-    // 栈操作指令执行
-    if (IsStackInstruction(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountStackExec,
-                       IARG_PTR, profile,
-                       IARG_END);
+    if (g_sample_mode != SAMPLE_NONE && INS_IsCall(ins)) {
+        g_return_sites.insert(INS_NextAddress(ins));
     }
+}
 
-    // 字符串指令执行
-    if (IsStringInstruction(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountStringExec,
-                       IARG_PTR, profile,
-                       IARG_END);
+/**
+ * 动态插桩
+ * 只为依赖运行时地址或分支结果的指标插入逐指令回调，
+ * 与地址无关的计数由 InstrumentTrace 按基本块合并累加
+ */
+VOID InstrumentDynamicAnalysis(INS ins, FunctionProfile* profile, ADDRINT pc) {
+    InsIds ids;
+    map<ADDRINT, InsIds>::const_iterator it = g_ins_ids.find(pc);
+    if (it != g_ins_ids.end()) {
+        ids = it->second;
     }
 
-    // NOP指令执行
-    if (IsNopInstruction(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountNopExec,
-                       IARG_PTR, profile,
-                       IARG_END);
+    // 需要ID的指令不在静态解码结果中时跳过对应回调，记录其地址
+    bool need_memop = MetricEnabled(METRIC_MEM) && (INS_IsMemoryRead(ins) || INS_IsMemoryWrite(ins));
+    bool need_call = MetricEnabled(METRIC_CALL) && INS_IsCall(ins);
+    if ((need_memop && ids.read_memop == NO_INS_ID && ids.write_memop == NO_INS_ID) ||
+        (need_call && ids.call_id == NO_INS_ID)) {
+        g_unmapped_ins.insert(pc);
     }
 
-    // 其他未分类指令执行
-    if (!IsArithmeticInstruction(ins) && !IsLogicInstruction(ins) &&
-        !IsFloatInstruction(ins) && !IsSIMDInstruction(ins) &&
-        !IsDataMovementInstruction(ins) && !IsCompareInstruction(ins) &&
-        !IsStackInstruction(ins) && !IsStringInstruction(ins) &&
-        !IsNopInstruction(ins) && !INS_IsBranch(ins) && !INS_IsCall(ins) &&
-        !INS_IsRet(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountOtherExec,
-                       IARG_PTR, profile,
+    // 内存读 - 使用地址分析访问模式
+    if (MetricEnabled(METRIC_MEM) && INS_IsMemoryRead(ins) && ids.read_memop != NO_INS_ID) {
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)AnalyzeMemoryReadPattern,
+                       IARG_REG_VALUE, g_thread_reg,
+                       IARG_UINT32, ids.read_memop,
+                       IARG_UINT32, profile->func_id,
+                       IARG_MEMORYREAD_EA,
                        IARG_END);
     }
 
-    // ========== D类: 寄存器使用动态统计 ==========
-    UINT32 num_rregs = INS_MaxNumRRegs(ins);
-    UINT32 num_wregs = INS_MaxNumWRegs(ins);
-    if (num_rregs > 0 || num_wregs > 0) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountRegisterOps,
-                       IARG_PTR, profile,
-                       IARG_UINT32, num_rregs,
-                       IARG_UINT32, num_wregs,
+    // 内存写 - 使用地址分析访问模式
+    if (MetricEnabled(METRIC_MEM) && INS_IsMemoryWrite(ins) && ids.write_memop != NO_INS_ID) {
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)AnalyzeMemoryWritePattern,
+                       IARG_REG_VALUE, g_thread_reg,
+                       IARG_UINT32, ids.write_memop,
+                       IARG_UINT32, profile->func_id,
+                       IARG_MEMORYWRITE_EA,
                        IARG_END);
     }
 
     // ========== E类: 控制流细化动态统计 ==========
     // 分支方向统计（只对条件分支）
-    if (INS_IsBranch(ins) && INS_HasFallThrough(ins)) {
+    if (MetricEnabled(METRIC_BRANCH) && INS_IsBranch(ins) && INS_HasFallThrough(ins)) {
         INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountBranchDirection,
-                       IARG_PTR, profile,
+                       IARG_REG_VALUE, g_thread_reg,
+                       IARG_UINT32, profile->func_id,
                        IARG_BRANCH_TAKEN,
                        IARG_END);
     }
 
     // 循环迭代统计和嵌套深度跟踪（回边）
-    if (INS_IsBranch(ins) && INS_IsDirectControlFlow(ins)) {
+    if (MetricEnabled(METRIC_LOOP) && INS_IsBranch(ins) && INS_IsDirectControlFlow(ins)) {
         ADDRINT target = INS_DirectControlFlowTargetAddress(ins);
         if (target < pc && target >= profile->start_addr && target < profile->end_addr) {
             // 这是一个回边，统计循环迭代和嵌套深度
+            UINT32 loop_id = std::lower_bound(profile->backedge_addrs.begin(), profile->backedge_addrs.end(), pc)
+                             - profile->backedge_addrs.begin();
             INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)TrackLoopExecution,
-                           IARG_PTR, profile,
-                           IARG_ADDRINT, pc,  // 回边地址作为循环标识
+                           IARG_REG_VALUE, g_thread_reg,
+                           IARG_UINT32, profile->func_id,
+                           IARG_UINT32, loop_id,
                            IARG_BRANCH_TAKEN,
                            IARG_END);
         }
     }
 
     // 调用深度跟踪
-    if (INS_IsCall(ins)) {
+    if (MetricEnabled(METRIC_CALL) && INS_IsCall(ins)) {
         INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)TrackCallDepthEnter,
-                       IARG_PTR, profile,
+                       IARG_REG_VALUE, g_thread_reg,
+                       IARG_UINT32, profile->func_id,
                        IARG_END);
 
-        // I类: 记录调用边（用于fan_in/fan_out）
-        // 对于直接调用，可以静态获取目标地址
-        if (INS_IsDirectControlFlow(ins)) {
-            ADDRINT target = INS_DirectControlFlowTargetAddress(ins);
-            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordCallEdge,
-                           IARG_PTR, profile,
-                           IARG_ADDRINT, target,
+        // I类: 记录调用边（用于fan_in/fan_out和调用次数）
+        if (ids.call_id == NO_INS_ID) {
+            // 不在静态解码结果中，没有边ID/调用点ID
+        } else if (INS_IsDirectControlFlow(ins)) {
+            // 直接调用：镜像加载时确定边ID
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordDirectCall,
+                           IARG_REG_VALUE, g_thread_reg,
+                           IARG_UINT32, ids.call_id,
                            IARG_END);
         } else {
-            // 对于间接调用，运行时获取目标地址
-            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordCallEdge,
-                           IARG_PTR, profile,
+            // 间接调用：每个调用点一个内联缓存，运行时获取目标地址
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)RecordIndirectCall,
+                           IARG_REG_VALUE, g_thread_reg,
+                           IARG_UINT32, ids.call_id,
+                           IARG_UINT32, profile->func_id,
                            IARG_BRANCH_TARGET_ADDR,
                            IARG_END);
         }
     }
-    if (INS_IsRet(ins)) {
+    if (MetricEnabled(METRIC_CALL) && INS_IsRet(ins)) {
         INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)TrackCallDepthExit,
-                       IARG_PTR, profile,
+                       IARG_REG_VALUE, g_thread_reg,
+                       IARG_UINT32, profile->func_id,
                        IARG_END);
     }
 
-    // ========== F类: 数据依赖 (可选) ==========
-    if (KnobEnableDep.Value()) {
-        // 获取读写寄存器（最多4读2写）
-        REG read_regs[4] = {REG_INVALID(), REG_INVALID(), REG_INVALID(), REG_INVALID()};
-        REG write_regs[2] = {REG_INVALID(), REG_INVALID()};
-
-        for (UINT32 i = 0; i < num_rregs && i < 4; i++) {
-            read_regs[i] = INS_RegR(ins, i);
+    // ========== F类/G类: 寄存器数据流 (可选) ==========
+    if (MetricEnabled(METRIC_DEP | METRIC_LIFE)) {
+        UINT64 read_mask = InsRegMask(ins, false);
+        UINT64 write_mask = InsRegMask(ins, true);
+        if (read_mask != 0 || write_mask != 0) {
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)TrackRegisterDataflow,
+                           IARG_REG_VALUE, g_thread_reg,
+                           IARG_UINT32, profile->func_id,
+                           IARG_ADDRINT, (ADDRINT)read_mask,
+                           IARG_ADDRINT, (ADDRINT)write_mask,
+                           IARG_END);
         }
-        for (UINT32 i = 0; i < num_wregs && i < 2; i++) {
-            write_regs[i] = INS_RegW(ins, i);
+    }
+}
+
+// ========== H类: 静态BBL/边编号 ==========
+
+/**
+ * 按地址顺序为BBL编号，按(源, 目的)顺序为静态边编号，
+ * 并建立 BBL -> (后继BBL, 边ID) 的压缩邻接表，分配覆盖位图
+ */
+VOID AssignStaticIds(FunctionProfile& profile, const set<ADDRINT>& bbl_heads,
+                     const set<std::pair<ADDRINT, ADDRINT>>& static_edges) {
+    profile.bbl_addrs.assign(bbl_heads.begin(), bbl_heads.end());
+    UINT32 num_bbls = profile.bbl_addrs.size();
+
+    // static_edges 按源地址有序，同一源的边连续存放
+    profile.succ_begin.assign(num_bbls + 1, 0);
+    profile.succ_bbl.clear();
+    profile.succ_edge.clear();
+    UINT32 edge_id = 0;
+    for (const auto& edge : static_edges) {
+        UINT32 src = std::lower_bound(profile.bbl_addrs.begin(), profile.bbl_addrs.end(), edge.first)
+                     - profile.bbl_addrs.begin();
+        UINT32 dst = std::lower_bound(profile.bbl_addrs.begin(), profile.bbl_addrs.end(), edge.second)
+                     - profile.bbl_addrs.begin();
+        profile.succ_begin[src + 1]++;
+        profile.succ_bbl.push_back(dst);
+        profile.succ_edge.push_back(edge_id++);
+    }
+    for (UINT32 i = 0; i < num_bbls; i++) {
+        profile.succ_begin[i + 1] += profile.succ_begin[i];
+    }
+
+    profile.bbl_bits.assign((num_bbls + 63) / 64, 0);
+    profile.edge_bits.assign((edge_id + 63) / 64, 0);
+}
+
+// ========== 基本块合并计数 ==========
+
+/**
+ * 查找地址所属的函数剖析数据
+ * 返回NULL表示地址不在任何被剖析的函数内（被过滤或不在主程序.text段）
+ */
+FunctionProfile* FindProfile(ADDRINT addr) {
+    map<ADDRINT, FunctionProfile>::iterator it = g_function_profiles.upper_bound(addr);
+    if (it == g_function_profiles.begin()) {
+        return NULL;
+    }
+    --it;
+    if (addr >= it->second.end_addr) {
+        return NULL;
+    }
+    return &(it->second);
+}
+
+/**
+ * 把一条指令计入基本块静态增量（分类规则与 AnalyzeStaticInstruction 相同）
+ */
+VOID AccumulateBBLDelta(INS ins, BblDelta& d) {
+    d.inst++;
+
+    bool is_mem_read = INS_IsMemoryRead(ins);
+    bool is_mem_write = INS_IsMemoryWrite(ins);
+    UINT32 num_rregs = INS_MaxNumRRegs(ins);
+    UINT32 num_wregs = INS_MaxNumWRegs(ins);
+
+    if (MetricEnabled(METRIC_MEM)) {
+        if (is_mem_read || is_mem_write) d.mem_inst++;
+    }
+
+    if (MetricEnabled(METRIC_BRANCH)) {
+        if (INS_IsBranch(ins)) d.branch++;
+        if (INS_IsIndirectControlFlow(ins)) d.indirect++;
+    }
+
+    if (MetricEnabled(METRIC_MIX)) {
+        bool is_arith = IsArithmeticInstruction(ins);
+        bool is_logic = IsLogicInstruction(ins);
+        bool is_float = IsFloatInstruction(ins);
+        bool is_simd = IsSIMDInstruction(ins);
+        bool is_data_movement = IsDataMovementInstruction(ins);
+        bool is_compare = IsCompareInstruction(ins);
+        bool is_stack = IsStackInstruction(ins);
+        bool is_string = IsStringInstruction(ins);
+        bool is_nop = IsNopInstruction(ins);
+
+        if (is_arith) d.arith++;
+        if (is_logic) d.logic++;
+        if (is_float) d.fp++;
+        if (is_simd) d.simd++;
+        if (IsPureComputeInstruction(ins)) d.pure_compute++;
+        if (is_data_movement) d.data_movement++;
+        if (is_compare) d.compare++;
+        if (is_stack) d.stack++;
+        if (is_string) d.str++;
+        if (is_nop) d.nop++;
+        if (!is_arith && !is_logic && !is_float && !is_simd && !is_data_movement &&
+            !is_compare && !is_stack && !is_string && !is_nop &&
+            !INS_IsBranch(ins) && !INS_IsCall(ins) && !INS_IsRet(ins)) {
+            d.other++;
         }
 
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)TrackDataDependency,
-                       IARG_PTR, profile,
-                       IARG_UINT32, read_regs[0],
-                       IARG_UINT32, read_regs[1],
-                       IARG_UINT32, read_regs[2],
-                       IARG_UINT32, read_regs[3],
-                       IARG_UINT32, write_regs[0],
-                       IARG_UINT32, write_regs[1],
+        d.reg_read += num_rregs;
+        d.reg_write += num_wregs;
+    }
+
+    // F类: 内存与寄存器之间的传递
+    if (MetricEnabled(METRIC_DEP)) {
+        if (is_mem_read && num_wregs > 0) d.mem_to_reg++;
+        if (is_mem_write && num_rregs > 0) d.reg_to_mem++;
+    }
+}
+
+/**
+ * 在片段首条指令前插入一次 ApplyBBLDelta
+ * 增量对象按片段首地址驻留在 g_bbl_deltas 中，生存期与程序相同
+ */
+VOID InsertBBLDelta(INS head, FunctionProfile* profile, const BblDelta& d) {
+    if (profile == NULL || d.inst == 0) {
+        return;
+    }
+    if (!MetricEnabled(METRIC_MIX | METRIC_MEM | METRIC_BRANCH | METRIC_DEP)) {
+        // 只需要指令数
+        INS_InsertCall(head, IPOINT_BEFORE, (AFUNPTR)ApplyBBLInstCount,
+                       IARG_REG_VALUE, g_thread_reg,
+                       IARG_UINT32, profile->func_id,
+                       IARG_UINT32, d.inst,
                        IARG_END);
+        return;
+    }
+    const BblDelta* delta = &g_bbl_deltas.insert(
+        std::make_pair(std::make_pair(INS_Address(head), std::make_pair(profile->func_id, d.inst)), d)).first->second;
+    INS_InsertCall(head, IPOINT_BEFORE, (AFUNPTR)ApplyBBLDelta,
+                   IARG_REG_VALUE, g_thread_reg,
+                   IARG_UINT32, profile->func_id,
+                   IARG_PTR, delta,
+                   IARG_END);
+}
 
-        // 内存到寄存器传递
-        if (INS_IsMemoryRead(ins) && num_wregs > 0) {
-            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountMemToReg,
-                           IARG_PTR, profile,
+/**
+ * 插入一条指令的完整剖析回调：函数入口、BBL跟踪和逐指令的动态分析
+ */
+VOID InstrumentInstruction(INS ins, FunctionProfile* profile, ADDRINT pc) {
+    if (pc == profile->start_addr) {
+        // 函数入口回调(统计调用次数)；采样模式下由 SampleEnter 统计
+        if (g_sample_mode == SAMPLE_NONE) {
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)FunctionEntry,
+                           IARG_REG_VALUE, g_thread_reg,
+                           IARG_UINT32, profile->func_id,
                            IARG_END);
         }
 
-        // 寄存器到内存传递
-        if (INS_IsMemoryWrite(ins) && num_rregs > 0) {
-            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountRegToMem,
-                           IARG_PTR, profile,
+        // E类/H类: 函数入口时重置循环栈和BBL跟踪状态
+        if (MetricEnabled(METRIC_LOOP | METRIC_CFG)) {
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ResetInvocationState,
+                           IARG_REG_VALUE, g_thread_reg,
+                           IARG_UINT32, profile->func_id,
                            IARG_END);
         }
     }
 
-    // ========== G类: 生命周期 (可选) ==========
-    if (KnobEnableLifetime.Value()) {
-        // 获取读写寄存器（最多4读2写）
-        REG read_regs[4] = {REG_INVALID(), REG_INVALID(), REG_INVALID(), REG_INVALID()};
-        REG write_regs[2] = {REG_INVALID(), REG_INVALID()};
+    // H类: 如果是静态BBL头，插入BBL跟踪回调
+    if (MetricEnabled(METRIC_CFG) &&
+        std::binary_search(profile->bbl_addrs.begin(), profile->bbl_addrs.end(), pc)) {
+        UINT32 bbl_id = std::lower_bound(profile->bbl_addrs.begin(), profile->bbl_addrs.end(), pc)
+                        - profile->bbl_addrs.begin();
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)TrackBBLExecution,
+                       IARG_PTR, profile,
+                       IARG_REG_VALUE, g_thread_reg,
+                       IARG_UINT32, bbl_id,
+                       IARG_END);
+    }
 
-        for (UINT32 i = 0; i < num_rregs && i < 4; i++) {
-            read_regs[i] = INS_RegR(ins, i);
-        }
-        for (UINT32 i = 0; i < num_wregs && i < 2; i++) {
-            write_regs[i] = INS_RegW(ins, i);
-        }
+    InstrumentDynamicAnalysis(ins, profile, pc);
+}
 
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)TrackRegisterLifetime,
-                       IARG_PTR, profile,
-                       IARG_UINT32, read_regs[0],
-                       IARG_UINT32, read_regs[1],
-                       IARG_UINT32, read_regs[2],
-                       IARG_UINT32, read_regs[3],
-                       IARG_UINT32, write_regs[0],
-                       IARG_UINT32, write_regs[1],
+/**
+ * 采样模式：在函数入口、返回点和基本块头插入版本切换
+ * 先插入决定版本的回调（结果写入 g_sample_reg），再插入版本分支，
+ * 因此必须在同一条指令的其他回调之前调用
+ */
+VOID InstrumentSampling(INS ins, FunctionProfile* profile, ADDRINT version, bool bbl_head) {
+    ADDRINT pc = INS_Address(ins);
+    ADDRINT other = (version == VERSION_FULL) ? VERSION_LIGHT : VERSION_FULL;
+
+    if (profile != NULL && pc == profile->start_addr) {
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)SampleEnter,
+                       IARG_REG_VALUE, g_thread_reg,
+                       IARG_UINT32, profile->func_id,
+                       IARG_REG_VALUE, REG_STACK_PTR,
+                       IARG_RETURN_REGS, g_sample_reg,
                        IARG_END);
+        INS_InsertVersionCase(ins, g_sample_reg, other, other, IARG_END);
+    } else if (g_return_sites.count(pc)) {
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)SampleReturn,
+                       IARG_REG_VALUE, g_thread_reg,
+                       IARG_REG_VALUE, REG_STACK_PTR,
+                       IARG_RETURN_REGS, g_sample_reg,
+                       IARG_END);
+        INS_InsertVersionCase(ins, g_sample_reg, other, other, IARG_END);
+    } else if (bbl_head) {
+        // 系统调用等之后 Pin 会把版本重置为 0，在块头按寄存器恢复
+        INS_InsertVersionCase(ins, g_sample_reg, other, other, IARG_END);
+    }
+
+    if (profile != NULL && INS_IsRet(ins)) {
+        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)SampleLeave,
+                       IARG_REG_VALUE, g_thread_reg,
+                       IARG_REG_VALUE, REG_STACK_PTR,
+                       IARG_END);
+    }
+}
+
+/**
+ * Trace插桩回调：为每个基本块插入一次计数回调，为每条指令插入动态分析回调
+ * Pin的基本块只能从块首进入，块内地址无关的计数可以在插桩时合并；
+ * 基本块跨越函数边界时按所属函数拆成多段，每段一次回调
+ * 采样模式下每个 trace 有轻量、完整两个版本，轻量版本只统计调用次数
+ */
+VOID InstrumentTrace(TRACE trace, VOID *v) {
+    ADDRINT trace_addr = TRACE_Address(trace);
+    if (trace_addr < g_main_img_low || trace_addr > g_main_img_high) {
+        return;
+    }
+
+    ADDRINT version = TRACE_Version(trace);
+    bool full = (g_sample_mode == SAMPLE_NONE) || (version == VERSION_FULL);
+
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        if (g_sample_mode != SAMPLE_NONE) {
+            // 后继 trace 保持当前版本
+            BBL_SetTargetVersion(bbl, version);
+        }
+
+        INS seg_head = BBL_InsHead(bbl);
+        FunctionProfile* seg_profile = FindProfile(INS_Address(seg_head));
+        BblDelta delta;
+
+        for (INS ins = seg_head; INS_Valid(ins); ins = INS_Next(ins)) {
+            ADDRINT pc = INS_Address(ins);
+            FunctionProfile* profile = FindProfile(pc);
+            if (profile != seg_profile) {
+                if (full) {
+                    InsertBBLDelta(seg_head, seg_profile, delta);
+                }
+                seg_head = ins;
+                seg_profile = profile;
+                delta = BblDelta();
+            }
+
+            if (g_sample_mode != SAMPLE_NONE) {
+                InstrumentSampling(ins, profile, version, ins == BBL_InsHead(bbl));
+            }
+            if (full && profile != NULL) {
+                InstrumentInstruction(ins, profile, pc);
+                AccumulateBBLDelta(ins, delta);
+            }
+        }
+        if (full) {
+            InsertBBLDelta(seg_head, seg_profile, delta);
+        }
     }
 }
 
@@ -1219,16 +1725,8 @@ VOID ImageLoad(IMG img, VOID *v) {
             profile.offset_start = rtn_addr - g_main_img_low;
             profile.offset_end = profile.offset_start + RTN_Size(rtn);
             profile.function_size_bytes = RTN_Size(rtn);
-
-            // 插入函数入口回调(统计调用次数)
-            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)FunctionEntry,
-                          IARG_PTR, &profile,
-                          IARG_END);
-
-            // H类: 函数入口时重置BBL跟踪状态
-            RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)ResetBBLTracking,
-                          IARG_PTR, &profile,
-                          IARG_END);
+            profile.func_id = g_profile_list.size();
+            g_profile_list.push_back(&profile);
 
             // H类: 静态BBL计数和静态边计数
             // 遍历指令，识别BBL边界（BBL以控制流指令结束或被跳转目标开始）
@@ -1279,8 +1777,9 @@ VOID ImageLoad(IMG img, VOID *v) {
                                     static_edges.insert(std::make_pair(current_bbl_start, target));
                                 }
                             }
-                            // 如果有fall-through（条件分支），添加fall-through边
-                            if (INS_HasFallThrough(ins)) {
+                            // 如果有fall-through（条件分支），添加fall-through边；
+                            // 调用指令没有fall-through，但被调用函数返回后从下一条指令继续执行
+                            if (INS_HasFallThrough(ins) || INS_IsCall(ins)) {
                                 static_edges.insert(std::make_pair(current_bbl_start, next_pc));
                             }
                         } else {
@@ -1305,291 +1804,914 @@ VOID ImageLoad(IMG img, VOID *v) {
             // 静态边数量
             profile.edge_static = static_edges.size();
 
-            // 第二遍：静态分析、动态插桩，并在BBL头插入跟踪回调
-            for (INS ins = RTN_InsHead(rtn); INS_Valid(ins); ins = INS_Next(ins)) {
-                ADDRINT pc = INS_Address(ins);
-
-                // H类: 如果是BBL头，插入BBL跟踪回调
-                if (bbl_heads.find(pc) != bbl_heads.end()) {
-                    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)TrackBBLExecution,
-                                   IARG_PTR, &profile,
-                                   IARG_ADDRINT, pc,
-                                   IARG_END);
-                }
+            // 为BBL和边分配静态ID，运行时按ID置位覆盖位图
+            AssignStaticIds(profile, bbl_heads, static_edges);
 
-                // 静态分析
+            // 第二遍：静态分析，并为需要运行时状态的指令分配ID
+            // 动态插桩在 InstrumentTrace 中进行
+            for (INS ins = RTN_InsHead(rtn); INS_Valid(ins); ins = INS_Next(ins)) {
                 AnalyzeStaticInstruction(ins, profile);
-
-                // 动态插桩
-                InstrumentDynamicAnalysis(ins, &profile, pc);
+                AssignInstructionIds(ins, profile);
             }
 
             // D类: 计算unique寄存器数量
             profile.unique_reg_read = profile.read_regs_set.size();
             profile.unique_reg_write = profile.write_regs_set.size();
+            set<REG>().swap(profile.read_regs_set);
+            set<REG>().swap(profile.write_regs_set);
 
             RTN_Close(rtn);
         }
     }
+
+    // I类: 直接调用的被调用函数ID
+    ResolveCallEdgeCallees();
 }
 
-// ========== 程序结束回调 ==========
+// ========== 线程回调 ==========
 
 /**
- * Fini回调：计算派生指标并输出JSON
+ * 把一个线程的计数块归约到 FunctionProfile，调用者持有 g_lock
  */
-VOID Fini(INT32 code, VOID *v) {
-    cerr << "[Function Profiler] Program finished. Writing results..." << endl;
+VOID MergeThreadProfile(ThreadProfile* tp) {
+    // 采样模式: 结束仍在栈上的调用，计入其指令数
+    if (tp->sample_stack != NULL) {
+        PopSampleFrames(tp, ~(ADDRINT)0);
+    }
+
+    for (UINT32 id = 0; id < tp->num_functions; id++) {
+        const FunctionCounters& c = tp->counters[id];
+        FunctionProfile& p = *g_profile_list[id];
+
+        p.call_exec += c.call_exec;
+        p.inst_exec += c.inst_exec;
+        p.mem_read_exec += c.mem_read_exec;
+        p.mem_write_exec += c.mem_write_exec;
+        p.mem_inst_exec += c.mem_inst_exec;
+        p.seq_read_exec += c.seq_read_exec;
+        p.stride_read_exec += c.stride_read_exec;
+        p.random_read_exec += c.random_read_exec;
+        p.seq_write_exec += c.seq_write_exec;
+        p.stride_write_exec += c.stride_write_exec;
+        p.random_write_exec += c.random_write_exec;
+        p.arith_exec += c.arith_exec;
+        p.logic_exec += c.logic_exec;
+        p.float_exec += c.float_exec;
+        p.simd_exec += c.simd_exec;
+        p.pure_compute_exec += c.pure_compute_exec;
+        p.data_movement_exec += c.data_movement_exec;
+        p.compare_exec += c.compare_exec;
+        p.stack_exec += c.stack_exec;
+        p.string_exec += c.string_exec;
+        p.nop_exec += c.nop_exec;
+        p.other_exec += c.other_exec;
+        p.branch_exec += c.branch_exec;
+        p.call_other_exec += c.call_other_exec;
+        p.indirect_exec += c.indirect_exec;
+        p.reg_read_exec += c.reg_read_exec;
+        p.reg_write_exec += c.reg_write_exec;
+        p.branch_taken_exec += c.branch_taken_exec;
+        p.branch_not_taken_exec += c.branch_not_taken_exec;
+        p.loop_iter_total += c.loop_iter_total;
+        p.def_use_pairs += c.def_use_pairs;
+        p.mem_to_reg_exec += c.mem_to_reg_exec;
+        p.reg_to_mem_exec += c.reg_to_mem_exec;
+        p.reg_lifetime_total += c.reg_lifetime_total;
+        p.dead_write_exec += c.dead_write_exec;
+        p.first_use_dist_total += c.first_use_dist_total;
+        p.bbl_exec += c.bbl_exec;
+        p.sampled_calls += c.sampled_calls;
+        p.sample_inst_sum += c.sample_inst_sum;
+        p.sample_inst_sumsq += c.sample_inst_sumsq;
+
+        p.call_depth_max = std::max(p.call_depth_max, c.call_depth_max);
+        p.loop_depth_max = std::max(p.loop_depth_max, c.loop_depth_max);
+        p.reg_dep_chain_max = std::max(p.reg_dep_chain_max, c.reg_dep_chain_max);
+    }
+    g_total_inst_executed += tp->inst_executed;
+
+    // I类: 调用边计数
+    for (UINT32 id = 0; id < tp->num_call_edges; id++) {
+        g_call_edges[id].count += tp->call_edge_counts[id];
+    }
+    for (UINT32 site = 0; site < tp->num_call_sites; site++) {
+        FlushCallSiteCache(tp->site_caches[site]);
+    }
+}
+
+/**
+ * 线程开始：分配本线程的计数块并写入工具寄存器
+ * 主程序镜像在任何线程开始前加载，此时函数ID已全部分配
+ */
+VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v) {
+    ThreadProfile* tp = new ThreadProfile();
+    tp->tid = tid;
+    tp->num_functions = g_profile_list.size();
+
+    void* mem = NULL;
+    size_t bytes = sizeof(FunctionCounters) * (tp->num_functions > 0 ? tp->num_functions : 1);
+    if (posix_memalign(&mem, 64, bytes) != 0) {
+        cerr << "[Function Profiler] Thread " << tid << ": cannot allocate counters" << endl;
+        PIN_ExitProcess(1);
+    }
+    memset(mem, 0, bytes);
+    tp->counters = static_cast<FunctionCounters*>(mem);
+
+    tp->num_call_edges = g_call_edges.size();
+    tp->call_edge_counts = new UINT64[tp->num_call_edges + 1]();
+    tp->num_call_sites = g_num_call_sites;
+    tp->site_caches = new CallSiteCache[tp->num_call_sites + 1]();
+    tp->num_memops = g_num_memops;
+    tp->memops = new MemopState[tp->num_memops + 1]();
+
+    PIN_SetContextReg(ctxt, g_thread_reg, (ADDRINT)tp);
+
+    if (g_sample_mode != SAMPLE_NONE) {
+        tp->sample_stack = new SampleFrame[SAMPLE_STACK_DEPTH];
+        PIN_SetContextReg(ctxt, g_sample_reg, VERSION_LIGHT);
+    }
 
-    // 打开输出文件
-    ofstream outFile(KnobOutputFile.Value().c_str());
-    if (!outFile.is_open()) {
-        cerr << "[ERROR] Cannot open output file: " << KnobOutputFile.Value() << endl;
+    PIN_GetLock(&g_lock, tid + 1);
+    g_live_threads.push_back(tp);
+    PIN_ReleaseLock(&g_lock);
+}
+
+/**
+ * 线程结束：归约本线程计数并释放
+ */
+VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v) {
+    ThreadProfile* tp = reinterpret_cast<ThreadProfile*>(PIN_GetContextReg(ctxt, g_thread_reg));
+    if (tp == NULL) {
         return;
     }
 
-    int min_calls = KnobMinCallCount.Value();
+    PIN_GetLock(&g_lock, tid + 1);
+    MergeThreadProfile(tp);
+    g_live_threads.erase(std::remove(g_live_threads.begin(), g_live_threads.end(), tp),
+                         g_live_threads.end());
+    PIN_ReleaseLock(&g_lock);
 
-    // 写入JSON（不再计算派生指标，只记录原始数据）
-    outFile << "{\n";
+    free(tp->counters);
+    delete[] tp->call_edge_counts;
+    delete[] tp->site_caches;
+    delete[] tp->memops;
+    delete[] tp->sample_stack;
+    delete tp;
+}
 
-    // 工具信息
-    outFile << "  \"tool_info\": {\n";
-    outFile << "    \"name\": \"Function Profiler\",\n";
-    outFile << "    \"version\": \"1.0\",\n";
-    outFile << "    \"description\": \"函数维度的执行特性剖析工具\",\n";
-    outFile << "    \"main_image\": \"" << escape_json(g_main_img_name) << "\",\n";
-    outFile << "    \"base_address\": \"" << addr_to_hex(g_main_img_low) << "\"\n";
-    outFile << "  },\n";
+// ========== 程序结束回调 ==========
 
-    // 函数数据
-    outFile << "  \"functions\": [\n";
+/**
+ * 汇总直接/间接调用边到调用者的 callee_counts 和被调用者的 callers_set
+ * 直接调用边的 callee_id 在镜像加载时已解析，间接调用边在此按地址查找
+ */
+VOID AddCallEdge(UINT32 caller_id, UINT32 callee_id, ADDRINT callee_addr, UINT64 count) {
+    if (count == 0) {
+        return;
+    }
+    FunctionProfile& caller = *g_profile_list[caller_id];
+    // 采样模式: 调用边只在调用者被完整剖析时计数，按调用者的外推系数放大
+    caller.callee_counts[callee_addr] += (UINT64)(count * caller.sample_scale + 0.5);
 
-    bool first_func = true;
-    int func_count = 0;
+    if (callee_id != NO_FUNC_ID) {
+        g_profile_list[callee_id]->callers_set.insert(caller.start_addr);
+    }
+}
+
+VOID BuildCallGraph() {
+    for (const CallEdge& edge : g_call_edges) {
+        AddCallEdge(edge.caller_id, edge.callee_id, edge.callee_addr, edge.count);
+    }
+    for (UINT32 slot = 0; slot < DYN_CALL_EDGE_CAPACITY; slot++) {
+        const DynCallEdge& edge = g_dyn_call_edges[slot];
+        if (edge.state == 2 && edge.count > 0) {
+            AddCallEdge(edge.caller_id, FindFunctionId(edge.callee_addr), edge.callee_addr, edge.count);
+        }
+    }
+    for (const auto& kv : g_dyn_call_overflow) {
+        const DynCallEdge& edge = *kv.second;
+        if (edge.count > 0) {
+            AddCallEdge(edge.caller_id, FindFunctionId(edge.callee_addr), edge.callee_addr, edge.count);
+        }
+    }
+}
 
-    for (auto& kv : g_function_profiles) {
-        FunctionProfile& profile = kv.second;
+/**
+ * 采样模式: 动态计数只在完整剖析的调用中累加，按 调用次数 / 完整剖析的调用次数 外推
+ * call_exec 每次调用都统计，不外推；取最大值的指标与覆盖（unique_*）无法外推，保持采样值
+ */
+inline VOID ScaleCounter(UINT64& value, double scale) {
+    value = (UINT64)(value * scale + 0.5);
+}
 
-        // 过滤：只输出调用次数满足条件的函数
-        if (profile.call_exec < (UINT64)min_calls) {
-            continue;
+VOID ExtrapolateSampledCounters() {
+    g_total_inst_executed = 0;
+    for (FunctionProfile* p : g_profile_list) {
+        double scale = (p->sampled_calls > 0) ? (double)p->call_exec / p->sampled_calls : 0.0;
+        p->sample_scale = scale;
+
+        ScaleCounter(p->inst_exec, scale);
+        ScaleCounter(p->mem_read_exec, scale);
+        ScaleCounter(p->mem_write_exec, scale);
+        ScaleCounter(p->mem_inst_exec, scale);
+        ScaleCounter(p->seq_read_exec, scale);
+        ScaleCounter(p->stride_read_exec, scale);
+        ScaleCounter(p->random_read_exec, scale);
+        ScaleCounter(p->seq_write_exec, scale);
+        ScaleCounter(p->stride_write_exec, scale);
+        ScaleCounter(p->random_write_exec, scale);
+        ScaleCounter(p->arith_exec, scale);
+        ScaleCounter(p->logic_exec, scale);
+        ScaleCounter(p->float_exec, scale);
+        ScaleCounter(p->simd_exec, scale);
+        ScaleCounter(p->pure_compute_exec, scale);
+        ScaleCounter(p->data_movement_exec, scale);
+        ScaleCounter(p->compare_exec, scale);
+        ScaleCounter(p->stack_exec, scale);
+        ScaleCounter(p->string_exec, scale);
+        ScaleCounter(p->nop_exec, scale);
+        ScaleCounter(p->other_exec, scale);
+        ScaleCounter(p->branch_exec, scale);
+        ScaleCounter(p->call_other_exec, scale);
+        ScaleCounter(p->indirect_exec, scale);
+        ScaleCounter(p->reg_read_exec, scale);
+        ScaleCounter(p->reg_write_exec, scale);
+        ScaleCounter(p->branch_taken_exec, scale);
+        ScaleCounter(p->branch_not_taken_exec, scale);
+        ScaleCounter(p->loop_iter_total, scale);
+        ScaleCounter(p->def_use_pairs, scale);
+        ScaleCounter(p->mem_to_reg_exec, scale);
+        ScaleCounter(p->reg_to_mem_exec, scale);
+        ScaleCounter(p->reg_lifetime_total, scale);
+        ScaleCounter(p->dead_write_exec, scale);
+        ScaleCounter(p->first_use_dist_total, scale);
+        ScaleCounter(p->bbl_exec, scale);
+
+        g_total_inst_executed += p->inst_exec;
+    }
+}
+
+/**
+ * 采样模式: 外推后 inst_exec 的相对标准误差
+ * 把完整剖析的调用看作从全部调用中抽取的样本，按各次调用指令数的样本方差估计（含有限总体校正）
+ * @return 样本少于2次或均值为0时返回负数
+ */
+double SampledInstRelativeError(const FunctionProfile& p) {
+    if (p.sampled_calls < 2 || p.sample_inst_sum == 0) {
+        return -1.0;
+    }
+    double n = (double)p.sampled_calls;
+    double mean = p.sample_inst_sum / n;
+    double var = (p.sample_inst_sumsq - p.sample_inst_sum * mean) / (n - 1);
+    if (var < 0) var = 0;
+    double fpc = 1.0 - n / (double)p.call_exec;
+    if (fpc < 0) fpc = 0;
+    return sqrt(var * fpc / n) / mean;
+}
+
+// ========== 输出 ==========
+
+bool StreamWriter::open(const string& path) {
+    fp = fopen(path.c_str(), "w");
+    buf.reserve(CHUNK + 4096);
+    return fp != NULL;
+}
+
+void StreamWriter::close() {
+    if (!fp) return;
+    flush();
+    fclose(fp);
+    fp = NULL;
+}
+
+void StreamWriter::flush() {
+    if (!buf.empty()) {
+        fwrite(buf.data(), 1, buf.size(), fp);
+        buf.clear();
+    }
+}
+
+void StreamWriter::raw(const char* s) {
+    buf.append(s);
+    flush_if_full();
+}
+
+void StreamWriter::printf(const char* fmt, ...) {
+    char tmp[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < sizeof(tmp)) {
+        buf.append(tmp, n);
+    } else {
+        size_t old = buf.size();
+        buf.resize(old + n + 1);
+        va_start(ap, fmt);
+        vsnprintf(&buf[old], n + 1, fmt, ap);
+        va_end(ap);
+        buf.resize(old + n);
+    }
+    flush_if_full();
+}
+
+void StreamWriter::u64(UINT64 value) {
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        buf += tmp[--n];
+    }
+    flush_if_full();
+}
+
+void StreamWriter::i64(INT64 value) {
+    if (value < 0) {
+        buf += '-';
+        u64(0 - (UINT64)value);
+    } else {
+        u64((UINT64)value);
+    }
+}
+
+void StreamWriter::hex(ADDRINT value) {
+    static const char digits[] = "0123456789abcdef";
+    char tmp[16];
+    int n = 0;
+    do {
+        tmp[n++] = digits[value & 0xf];
+        value >>= 4;
+    } while (value != 0);
+    buf += "0x";
+    while (n > 0) {
+        buf += tmp[--n];
+    }
+    flush_if_full();
+}
+
+void StreamWriter::fixed(double value, int precision) {
+    printf("%.*f", precision, value);
+}
+
+void StreamWriter::json_string(const string& s) {
+    buf += '"';
+    for (char c : s) {
+        switch (c) {
+            case '"': buf += "\\\""; break;
+            case '\\': buf += "\\\\"; break;
+            case '\n': buf += "\\n"; break;
+            case '\r': buf += "\\r"; break;
+            case '\t': buf += "\\t"; break;
+            default: buf += c;
+        }
+    }
+    buf += '"';
+    flush_if_full();
+}
+
+void StreamWriter::csv_string(const string& s) {
+    buf += '"';
+    for (char c : s) {
+        if (c == '"') buf += '"';
+        buf += c;
+    }
+    buf += '"';
+    flush_if_full();
+}
+
+/**
+ * 计算派生指标，并释放输出时不再需要的集合与位图
+ * 之后的 JSON/CSV 输出只读取 FunctionProfile 中的标量字段和 callee_counts
+ */
+VOID ComputeDerivedMetrics() {
+    // H类: 把哈希表中的动态边并入各函数的 extra_edges（与表满后持锁写入的边合并去重）
+    for (UINT32 slot = 0; slot < EXTRA_EDGE_CAPACITY; slot++) {
+        const ExtraEdge& edge = g_extra_edges[slot];
+        if (edge.state == 2) {
+            g_profile_list[edge.func_id]->extra_edges.insert(std::make_pair(edge.src_bbl, edge.dst_bbl));
         }
+    }
 
-        // H类: 计算动态圈复杂度
-        profile.unique_bbl_exec = profile.executed_bbls.size();
-        profile.unique_edge_exec = profile.executed_edges.size();
+    for (FunctionProfile* pp : g_profile_list) {
+        FunctionProfile& profile = *pp;
 
-        // I类: 计算fan_in/fan_out
+        // H类: 静态/动态圈复杂度 = E - N + 2，最小为1
+        profile.unique_bbl_exec = CountCoverageBits(profile.bbl_bits);
+        profile.unique_edge_exec = CountCoverageBits(profile.edge_bits) + profile.extra_edges.size();
+        profile.static_cyclomatic = std::max((INT32)profile.edge_static - (INT32)profile.bbl_static + 2, 1);
+        profile.dynamic_cyclomatic = std::max((INT32)profile.unique_edge_exec - (INT32)profile.unique_bbl_exec + 2, 1);
+
+        // I类: fan_in/fan_out
         profile.fan_in = profile.callers_set.size();
-        profile.fan_out = profile.callees_set.size();
+        profile.fan_out = profile.callee_counts.size();
 
-        if (!first_func) {
-            outFile << ",\n";
+        // B3类: 指令类型分布熵
+        // 静态熵：基于静态指令分布
+        const UINT64 static_counts[] = {
+            profile.arith_static, profile.logic_static, profile.float_static, profile.simd_static,
+            profile.data_movement_static, profile.compare_static, profile.stack_static,
+            profile.string_static, profile.nop_static, profile.branch_static, profile.call_static,
+            profile.return_static, profile.other_static
+        };
+        profile.inst_type_entropy_static =
+            ComputeInstructionEntropy(static_counts, sizeof(static_counts) / sizeof(static_counts[0]));
+
+        // 动态熵：基于动态执行分布（分支/调用次数所在的指标组关闭时为0，不参与）
+        const UINT64 exec_counts[] = {
+            profile.arith_exec, profile.logic_exec, profile.float_exec, profile.simd_exec,
+            profile.data_movement_exec, profile.compare_exec, profile.stack_exec,
+            profile.string_exec, profile.nop_exec, profile.branch_exec, profile.call_other_exec,
+            profile.other_exec
+        };
+        profile.inst_type_entropy_exec =
+            ComputeInstructionEntropy(exec_counts, sizeof(exec_counts) / sizeof(exec_counts[0]));
+
+        if (g_sample_mode != SAMPLE_NONE) {
+            profile.inst_exec_rse = SampledInstRelativeError(profile);
         }
-        first_func = false;
-        func_count++;
 
-        outFile << "    {\n";
-
-        // 基本信息
-        outFile << "      \"function_name\": \"" << escape_json(profile.function_name) << "\",\n";
-        outFile << "      \"start_addr\": \"" << addr_to_hex(profile.start_addr) << "\",\n";
-        outFile << "      \"end_addr\": \"" << addr_to_hex(profile.end_addr) << "\",\n";
-        outFile << "      \"offset_start\": \"" << addr_to_hex(profile.offset_start) << "\",\n";
-        outFile << "      \"offset_end\": \"" << addr_to_hex(profile.offset_end) << "\",\n";
-        outFile << "      \"function_size_bytes\": " << profile.function_size_bytes << ",\n";
-
-        // A类：执行统计
-        outFile << "      \"execution_stats\": {\n";
-        outFile << "        \"call_exec\": " << profile.call_exec << ",\n";
-        outFile << "        \"inst_exec\": " << profile.inst_exec << ",\n";
-        outFile << "        \"inst_static\": " << profile.inst_static << "\n";
-        outFile << "      },\n";
-
-        // B1类：数据流
-        outFile << "      \"data_flow\": {\n";
-        outFile << "        \"mem_read_static\": " << profile.mem_read_static << ",\n";
-        outFile << "        \"mem_write_static\": " << profile.mem_write_static << ",\n";
-        outFile << "        \"mem_inst_static\": " << profile.mem_inst_static << ",\n";
-        outFile << "        \"mem_read_exec\": " << profile.mem_read_exec << ",\n";
-        outFile << "        \"mem_write_exec\": " << profile.mem_write_exec << ",\n";
-        outFile << "        \"mem_inst_exec\": " << profile.mem_inst_exec << "\n";
-        outFile << "      },\n";
+        set<ADDRINT>().swap(profile.callers_set);
+        set<std::pair<UINT32, UINT32>>().swap(profile.extra_edges);
+        vector<UINT64>().swap(profile.bbl_bits);
+        vector<UINT64>().swap(profile.edge_bits);
+    }
+}
+
+/**
+ * 写出一个函数的JSON对象
+ */
+VOID WriteFunctionJson(StreamWriter& w, const FunctionProfile& profile) {
+    w.raw("    {\n");
+
+    // 基本信息
+    w.raw("      \"function_name\": ");
+    w.json_string(profile.function_name);
+    w.raw(",\n      \"start_addr\": \"");
+    w.hex(profile.start_addr);
+    w.raw("\",\n      \"end_addr\": \"");
+    w.hex(profile.end_addr);
+    w.raw("\",\n      \"offset_start\": \"");
+    w.hex(profile.offset_start);
+    w.raw("\",\n      \"offset_end\": \"");
+    w.hex(profile.offset_end);
+    w.raw("\",\n      \"function_size_bytes\": ");
+    w.u64(profile.function_size_bytes);
+    w.raw(",\n");
+
+    // 各段在作用域结束时闭合；没有字段的段（对应指标组全部关闭）不输出
+    bool first_section = true;
+
+    {
+        // A类：执行统计（总是输出）
+        JsonSection stats(w, first_section, "execution_stats");
+        stats.add("call_exec", profile.call_exec);
+        stats.add("inst_exec", profile.inst_exec);
+        stats.add("inst_static", profile.inst_static);
+    }
+
+    if (g_sample_mode != SAMPLE_NONE) {
+        // 采样：动态计数已外推，inst_exec_rse 为 inst_exec 的相对标准误差
+        JsonSection sampling(w, first_section, "sampling");
+        sampling.add("sampled_calls", profile.sampled_calls);
+        sampling.add_fixed("scale", profile.sample_scale, 3);
+        if (profile.inst_exec_rse < 0) {
+            sampling.add_null("inst_exec_rse");
+        } else {
+            sampling.add_fixed("inst_exec_rse", profile.inst_exec_rse, 4);
+        }
+    }
+
+    if (MetricEnabled(METRIC_MEM)) {
+        {
+            // B1类：数据流
+            JsonSection flow(w, first_section, "data_flow");
+            flow.add("mem_read_static", profile.mem_read_static);
+            flow.add("mem_write_static", profile.mem_write_static);
+            flow.add("mem_inst_static", profile.mem_inst_static);
+            flow.add("mem_read_exec", profile.mem_read_exec);
+            flow.add("mem_write_exec", profile.mem_write_exec);
+            flow.add("mem_inst_exec", profile.mem_inst_exec);
+        }
 
         // B1.5类：内存访问模式
-        outFile << "      \"memory_access_pattern\": {\n";
-        outFile << "        \"seq_read_exec\": " << profile.seq_read_exec << ",\n";
-        outFile << "        \"stride_read_exec\": " << profile.stride_read_exec << ",\n";
-        outFile << "        \"random_read_exec\": " << profile.random_read_exec << ",\n";
-        outFile << "        \"seq_write_exec\": " << profile.seq_write_exec << ",\n";
-        outFile << "        \"stride_write_exec\": " << profile.stride_write_exec << ",\n";
-        outFile << "        \"random_write_exec\": " << profile.random_write_exec << "\n";
-        outFile << "      },\n";
-
-        // B2类：计算特性
-        outFile << "      \"compute_characteristics\": {\n";
-        outFile << "        \"arith_static\": " << profile.arith_static << ",\n";
-        outFile << "        \"logic_static\": " << profile.logic_static << ",\n";
-        outFile << "        \"float_static\": " << profile.float_static << ",\n";
-        outFile << "        \"simd_static\": " << profile.simd_static << ",\n";
-        outFile << "        \"pure_compute_static\": " << profile.pure_compute_static << ",\n";
-        outFile << "        \"data_movement_static\": " << profile.data_movement_static << ",\n";
-        outFile << "        \"compare_static\": " << profile.compare_static << ",\n";
-        outFile << "        \"stack_static\": " << profile.stack_static << ",\n";
-        outFile << "        \"string_static\": " << profile.string_static << ",\n";
-        outFile << "        \"nop_static\": " << profile.nop_static << ",\n";
-        outFile << "        \"other_static\": " << profile.other_static << ",\n";
-        outFile << "        \"arith_exec\": " << profile.arith_exec << ",\n";
-        outFile << "        \"logic_exec\": " << profile.logic_exec << ",\n";
-        outFile << "        \"float_exec\": " << profile.float_exec << ",\n";
-        outFile << "        \"simd_exec\": " << profile.simd_exec << ",\n";
-        outFile << "        \"pure_compute_exec\": " << profile.pure_compute_exec << ",\n";
-        outFile << "        \"data_movement_exec\": " << profile.data_movement_exec << ",\n";
-        outFile << "        \"compare_exec\": " << profile.compare_exec << ",\n";
-        outFile << "        \"stack_exec\": " << profile.stack_exec << ",\n";
-        outFile << "        \"string_exec\": " << profile.string_exec << ",\n";
-        outFile << "        \"nop_exec\": " << profile.nop_exec << ",\n";
-        outFile << "        \"other_exec\": " << profile.other_exec << "\n";
-        outFile << "      },\n";
+        JsonSection pattern(w, first_section, "memory_access_pattern");
+        pattern.add("seq_read_exec", profile.seq_read_exec);
+        pattern.add("stride_read_exec", profile.stride_read_exec);
+        pattern.add("random_read_exec", profile.random_read_exec);
+        pattern.add("seq_write_exec", profile.seq_write_exec);
+        pattern.add("stride_write_exec", profile.stride_write_exec);
+        pattern.add("random_write_exec", profile.random_write_exec);
+    }
+
+    if (MetricEnabled(METRIC_MIX)) {
+        {
+            // B2类：计算特性
+            JsonSection compute(w, first_section, "compute_characteristics");
+            compute.add("arith_static", profile.arith_static);
+            compute.add("logic_static", profile.logic_static);
+            compute.add("float_static", profile.float_static);
+            compute.add("simd_static", profile.simd_static);
+            compute.add("pure_compute_static", profile.pure_compute_static);
+            compute.add("data_movement_static", profile.data_movement_static);
+            compute.add("compare_static", profile.compare_static);
+            compute.add("stack_static", profile.stack_static);
+            compute.add("string_static", profile.string_static);
+            compute.add("nop_static", profile.nop_static);
+            compute.add("other_static", profile.other_static);
+            compute.add("arith_exec", profile.arith_exec);
+            compute.add("logic_exec", profile.logic_exec);
+            compute.add("float_exec", profile.float_exec);
+            compute.add("simd_exec", profile.simd_exec);
+            compute.add("pure_compute_exec", profile.pure_compute_exec);
+            compute.add("data_movement_exec", profile.data_movement_exec);
+            compute.add("compare_exec", profile.compare_exec);
+            compute.add("stack_exec", profile.stack_exec);
+            compute.add("string_exec", profile.string_exec);
+            compute.add("nop_exec", profile.nop_exec);
+            compute.add("other_exec", profile.other_exec);
+        }
 
         // B3类：指令类型分布熵
-        // 静态熵：基于静态指令分布
-        vector<UINT64> static_counts;
-        static_counts.push_back(profile.arith_static);
-        static_counts.push_back(profile.logic_static);
-        static_counts.push_back(profile.float_static);
-        static_counts.push_back(profile.simd_static);
-        static_counts.push_back(profile.data_movement_static);
-        static_counts.push_back(profile.compare_static);
-        static_counts.push_back(profile.stack_static);
-        static_counts.push_back(profile.string_static);
-        static_counts.push_back(profile.nop_static);
-        static_counts.push_back(profile.branch_static);
-        static_counts.push_back(profile.call_static);
-        static_counts.push_back(profile.return_static);
-        static_counts.push_back(profile.other_static);
-        double static_entropy = ComputeInstructionEntropy(static_counts);
-
-        // 动态熵：基于动态执行分布
-        vector<UINT64> exec_counts;
-        exec_counts.push_back(profile.arith_exec);
-        exec_counts.push_back(profile.logic_exec);
-        exec_counts.push_back(profile.float_exec);
-        exec_counts.push_back(profile.simd_exec);
-        exec_counts.push_back(profile.data_movement_exec);
-        exec_counts.push_back(profile.compare_exec);
-        exec_counts.push_back(profile.stack_exec);
-        exec_counts.push_back(profile.string_exec);
-        exec_counts.push_back(profile.nop_exec);
-        exec_counts.push_back(profile.branch_exec);
-        exec_counts.push_back(profile.call_other_exec);
-        exec_counts.push_back(profile.other_exec);
-        double exec_entropy = ComputeInstructionEntropy(exec_counts);
-
-        outFile << "      \"instruction_entropy\": {\n";
-        outFile << "        \"inst_type_entropy_static\": " << std::fixed << std::setprecision(4) << static_entropy << ",\n";
-        outFile << "        \"inst_type_entropy_exec\": " << std::fixed << std::setprecision(4) << exec_entropy << "\n";
-        outFile << "      },\n";
-
-        // C类：控制流
-        outFile << "      \"control_flow\": {\n";
-        outFile << "        \"branch_static\": " << profile.branch_static << ",\n";
-        outFile << "        \"branch_exec\": " << profile.branch_exec << ",\n";
-        outFile << "        \"loop_static\": " << profile.loop_static << ",\n";
-        outFile << "        \"return_static\": " << profile.return_static << ",\n";
-        outFile << "        \"call_static\": " << profile.call_static << ",\n";
-        outFile << "        \"call_other_exec\": " << profile.call_other_exec << ",\n";
-        outFile << "        \"indirect_exec\": " << profile.indirect_exec << "\n";
-        outFile << "      },\n";
+        JsonSection entropy(w, first_section, "instruction_entropy");
+        entropy.add_fixed("inst_type_entropy_static", profile.inst_type_entropy_static, 4);
+        entropy.add_fixed("inst_type_entropy_exec", profile.inst_type_entropy_exec, 4);
+    }
 
+    {
+        // C类：控制流（字段按 branch/loop/call 指标组输出）
+        JsonSection control(w, first_section, "control_flow");
+        if (MetricEnabled(METRIC_BRANCH)) {
+            control.add("branch_static", profile.branch_static);
+            control.add("branch_exec", profile.branch_exec);
+        }
+        if (MetricEnabled(METRIC_LOOP)) {
+            control.add("loop_static", profile.loop_static);
+        }
+        if (MetricEnabled(METRIC_CALL)) {
+            control.add("return_static", profile.return_static);
+            control.add("call_static", profile.call_static);
+            control.add("call_other_exec", profile.call_other_exec);
+        }
+        if (MetricEnabled(METRIC_BRANCH)) {
+            control.add("indirect_exec", profile.indirect_exec);
+        }
+    }
+
+    if (MetricEnabled(METRIC_CALL)) {
         // I类：函数间调用图
-        outFile << "      \"call_graph\": {\n";
-        outFile << "        \"fan_in\": " << profile.fan_in << ",\n";
-        outFile << "        \"fan_out\": " << profile.fan_out << "\n";
-        outFile << "      },\n";
+        JsonSection graph(w, first_section, "call_graph");
+        graph.add("fan_in", profile.fan_in);
+        graph.add("fan_out", profile.fan_out);
+        graph.field("call_edges");
+        w.raw("[");
+        bool first_edge = true;
+        for (const auto& callee : profile.callee_counts) {
+            map<ADDRINT, FunctionProfile>::const_iterator target = g_function_profiles.find(callee.first);
+            w.raw(first_edge ? "\n          {\"callee\": " : ",\n          {\"callee\": ");
+            if (target != g_function_profiles.end()) {
+                w.json_string(target->second.function_name);
+            } else {
+                w.json_string(RTN_FindNameByAddress(callee.first));
+            }
+            w.raw(", \"callee_addr\": \"");
+            w.hex(callee.first);
+            w.raw("\", \"count\": ");
+            w.u64(callee.second);
+            w.raw("}");
+            first_edge = false;
+        }
+        w.raw(first_edge ? "]" : "\n        ]");
+    }
 
+    if (MetricEnabled(METRIC_MIX)) {
         // D类：寄存器使用
-        outFile << "      \"register_usage\": {\n";
-        outFile << "        \"reg_read_exec\": " << profile.reg_read_exec << ",\n";
-        outFile << "        \"reg_write_exec\": " << profile.reg_write_exec << ",\n";
-        outFile << "        \"reg_read_static\": " << profile.reg_read_static << ",\n";
-        outFile << "        \"reg_write_static\": " << profile.reg_write_static << ",\n";
-        outFile << "        \"unique_reg_read\": " << profile.unique_reg_read << ",\n";
-        outFile << "        \"unique_reg_write\": " << profile.unique_reg_write << "\n";
-        outFile << "      },\n";
-
-        // E类：控制流细化
-        outFile << "      \"control_flow_detail\": {\n";
-        outFile << "        \"branch_taken_exec\": " << profile.branch_taken_exec << ",\n";
-        outFile << "        \"branch_not_taken_exec\": " << profile.branch_not_taken_exec << ",\n";
-        outFile << "        \"cond_branch_static\": " << profile.cond_branch_static << ",\n";
-        outFile << "        \"uncond_branch_static\": " << profile.uncond_branch_static << ",\n";
-        outFile << "        \"loop_iter_total\": " << profile.loop_iter_total << ",\n";
-        outFile << "        \"call_depth_max\": " << profile.call_depth_max << ",\n";
-        outFile << "        \"loop_depth_max\": " << profile.loop_depth_max << "\n";
-        outFile << "      }";
-
-        // F类：数据依赖（可选）
-        if (KnobEnableDep.Value()) {
-            outFile << ",\n";
-            outFile << "      \"data_dependency\": {\n";
-            outFile << "        \"def_use_pairs\": " << profile.def_use_pairs << ",\n";
-            outFile << "        \"reg_dep_chain_max\": " << profile.reg_dep_chain_max << ",\n";
-            outFile << "        \"mem_to_reg_exec\": " << profile.mem_to_reg_exec << ",\n";
-            outFile << "        \"reg_to_mem_exec\": " << profile.reg_to_mem_exec << "\n";
-            outFile << "      }";
-        }
-
-        // G类：生命周期（可选）
-        if (KnobEnableLifetime.Value()) {
-            outFile << ",\n";
-            outFile << "      \"lifetime\": {\n";
-            outFile << "        \"reg_lifetime_total\": " << profile.reg_lifetime_total << ",\n";
-            outFile << "        \"dead_write_exec\": " << profile.dead_write_exec << ",\n";
-            outFile << "        \"first_use_dist_total\": " << profile.first_use_dist_total << "\n";
-            outFile << "      }";
-        }
-
-        // H类：圈复杂度
-        outFile << ",\n";
-        outFile << "      \"cyclomatic_complexity\": {\n";
-        // 静态圈复杂度
-        outFile << "        \"bbl_static\": " << profile.bbl_static << ",\n";
-        outFile << "        \"edge_static\": " << profile.edge_static << ",\n";
-        // 静态圈复杂度 = E - N + 2
-        INT32 static_cc = (INT32)profile.edge_static - (INT32)profile.bbl_static + 2;
-        if (static_cc < 1) static_cc = 1;  // 最小为1
-        outFile << "        \"static_cyclomatic\": " << static_cc << ",\n";
-        // 动态圈复杂度
-        outFile << "        \"bbl_exec\": " << profile.bbl_exec << ",\n";
-        outFile << "        \"unique_bbl_exec\": " << profile.unique_bbl_exec << ",\n";
-        outFile << "        \"unique_edge_exec\": " << profile.unique_edge_exec << ",\n";
-        // 动态圈复杂度 = E - N + 2 (对于单连通图)
-        INT32 dynamic_cc = (INT32)profile.unique_edge_exec - (INT32)profile.unique_bbl_exec + 2;
-        if (dynamic_cc < 1) dynamic_cc = 1;  // 最小为1
-        outFile << "        \"dynamic_cyclomatic\": " << dynamic_cc << "\n";
-        outFile << "      }";
-
-        outFile << "\n";
-
-        outFile << "    }";
-    }
-
-    outFile << "\n  ],\n";
+        JsonSection regs(w, first_section, "register_usage");
+        regs.add("reg_read_exec", profile.reg_read_exec);
+        regs.add("reg_write_exec", profile.reg_write_exec);
+        regs.add("reg_read_static", profile.reg_read_static);
+        regs.add("reg_write_static", profile.reg_write_static);
+        regs.add("unique_reg_read", profile.unique_reg_read);
+        regs.add("unique_reg_write", profile.unique_reg_write);
+    }
+
+    {
+        // E类：控制流细化（字段按 branch/loop/call 指标组输出）
+        JsonSection detail(w, first_section, "control_flow_detail");
+        if (MetricEnabled(METRIC_BRANCH)) {
+            detail.add("branch_taken_exec", profile.branch_taken_exec);
+            detail.add("branch_not_taken_exec", profile.branch_not_taken_exec);
+            detail.add("cond_branch_static", profile.cond_branch_static);
+            detail.add("uncond_branch_static", profile.uncond_branch_static);
+        }
+        if (MetricEnabled(METRIC_LOOP)) {
+            detail.add("loop_iter_total", profile.loop_iter_total);
+        }
+        if (MetricEnabled(METRIC_CALL)) {
+            detail.add("call_depth_max", profile.call_depth_max);
+        }
+        if (MetricEnabled(METRIC_LOOP)) {
+            detail.add("loop_depth_max", profile.loop_depth_max);
+        }
+    }
+
+    // F类：数据依赖（可选）
+    if (MetricEnabled(METRIC_DEP)) {
+        JsonSection dep(w, first_section, "data_dependency");
+        dep.add("def_use_pairs", profile.def_use_pairs);
+        dep.add("reg_dep_chain_max", profile.reg_dep_chain_max);
+        dep.add("mem_to_reg_exec", profile.mem_to_reg_exec);
+        dep.add("reg_to_mem_exec", profile.reg_to_mem_exec);
+    }
+
+    // G类：生命周期（可选）
+    if (MetricEnabled(METRIC_LIFE)) {
+        JsonSection life(w, first_section, "lifetime");
+        life.add("reg_lifetime_total", profile.reg_lifetime_total);
+        life.add("dead_write_exec", profile.dead_write_exec);
+        life.add("first_use_dist_total", profile.first_use_dist_total);
+    }
+
+    // H类：圈复杂度
+    if (MetricEnabled(METRIC_CFG)) {
+        JsonSection cc(w, first_section, "cyclomatic_complexity");
+        cc.add("bbl_static", profile.bbl_static);
+        cc.add("edge_static", profile.edge_static);
+        cc.add("static_cyclomatic", profile.static_cyclomatic);
+        cc.add("bbl_exec", profile.bbl_exec);
+        cc.add("unique_bbl_exec", profile.unique_bbl_exec);
+        cc.add("unique_edge_exec", profile.unique_edge_exec);
+        cc.add("dynamic_cyclomatic", profile.dynamic_cyclomatic);
+    }
+
+    w.raw("\n    }");
+}
+
+/**
+ * 写出JSON报告（只记录原始数据和少量派生指标）
+ * @return 输出的函数数量，-1 表示无法打开文件
+ */
+int WriteJsonReport(const string& path, UINT64 min_calls) {
+    StreamWriter w;
+    if (!w.open(path)) {
+        cerr << "[ERROR] Cannot open output file: " << path << endl;
+        return -1;
+    }
+
+    w.raw("{\n");
+
+    // 工具信息
+    w.raw("  \"tool_info\": {\n");
+    w.raw("    \"name\": \"Function Profiler\",\n");
+    w.raw("    \"version\": \"1.0\",\n");
+    w.printf("    \"schema_version\": %d,\n", PROFILE_SCHEMA_VERSION);
+    w.raw("    \"description\": \"函数维度的执行特性剖析工具\",\n");
+    w.raw("    \"main_image\": ");
+    w.json_string(g_main_img_name);
+    w.raw(",\n    \"base_address\": \"");
+    w.hex(g_main_img_low);
+    w.raw("\",\n    \"metrics\": ");
+    w.json_string(MetricsToString(g_metrics));
+    w.raw(",\n    \"sample_mode\": ");
+    w.json_string(KnobSampleMode.Value());
+    w.printf(",\n    \"sample_rate\": %u,\n", g_sample_rate);
+    w.printf("    \"sample_window_us\": %lu\n", (unsigned long)g_sample_window_us);
+    w.raw("  },\n");
+
+    // 函数数据
+    w.raw("  \"functions\": [\n");
+
+    int func_count = 0;
+    for (const auto& kv : g_function_profiles) {
+        // 过滤：只输出调用次数满足条件的函数
+        if (kv.second.call_exec < min_calls) {
+            continue;
+        }
+        if (func_count > 0) {
+            w.raw(",\n");
+        }
+        WriteFunctionJson(w, kv.second);
+        func_count++;
+    }
+
+    w.raw("\n  ],\n");
 
     // 统计信息
-    outFile << "  \"statistics\": {\n";
-    outFile << "    \"total_functions_analyzed\": " << func_count << ",\n";
-    outFile << "    \"total_instructions_executed\": " << g_total_inst_executed << "\n";
-    outFile << "  }\n";
+    w.raw("  \"statistics\": {\n");
+    w.printf("    \"total_functions_analyzed\": %d,\n", func_count);
+    w.raw("    \"total_instructions_executed\": ");
+    w.u64(g_total_inst_executed);
+    w.raw("\n  }\n");
+
+    w.raw("}\n");
+    w.close();
+    return func_count;
+}
+
+// ========== CSV 输出 ==========
+
+/**
+ * CSV列：每函数一行，列集合与顺序只随 PROFILE_SCHEMA_VERSION 变化，
+ * 所属指标组未启用（或未使用采样模式）的列输出空值
+ */
+struct CsvColumn {
+    const char* name;
+    UINT32 group;                   // 所属指标组，0 表示总是输出
+    void (*write)(StreamWriter& w, const FunctionProfile& p);
+};
+
+#define CSV_GROUP_SAMPLING (1U << 16)
+
+#define CSV_U64(group, field) \
+    {#field, group, [](StreamWriter& w, const FunctionProfile& p) { w.u64(p.field); }}
+#define CSV_I64(group, field) \
+    {#field, group, [](StreamWriter& w, const FunctionProfile& p) { w.i64(p.field); }}
+#define CSV_F4(group, field) \
+    {#field, group, [](StreamWriter& w, const FunctionProfile& p) { w.fixed(p.field, 4); }}
+
+static const CsvColumn g_csv_columns[] = {
+    {"function_name", 0, [](StreamWriter& w, const FunctionProfile& p) { w.csv_string(p.function_name); }},
+    {"start_addr", 0, [](StreamWriter& w, const FunctionProfile& p) { w.hex(p.start_addr); }},
+    {"offset_start", 0, [](StreamWriter& w, const FunctionProfile& p) { w.hex(p.offset_start); }},
+    CSV_U64(0, function_size_bytes),
+    // A类
+    CSV_U64(0, call_exec),
+    CSV_U64(0, inst_exec),
+    CSV_U64(0, inst_static),
+    // 采样
+    CSV_U64(CSV_GROUP_SAMPLING, sampled_calls),
+    CSV_F4(CSV_GROUP_SAMPLING, sample_scale),
+    {"inst_exec_rse", CSV_GROUP_SAMPLING, [](StreamWriter& w, const FunctionProfile& p) {
+        if (p.inst_exec_rse >= 0) w.fixed(p.inst_exec_rse, 4);
+    }},
+    // B1/B1.5类
+    CSV_U64(METRIC_MEM, mem_read_static),
+    CSV_U64(METRIC_MEM, mem_write_static),
+    CSV_U64(METRIC_MEM, mem_inst_static),
+    CSV_U64(METRIC_MEM, mem_read_exec),
+    CSV_U64(METRIC_MEM, mem_write_exec),
+    CSV_U64(METRIC_MEM, mem_inst_exec),
+    CSV_U64(METRIC_MEM, seq_read_exec),
+    CSV_U64(METRIC_MEM, stride_read_exec),
+    CSV_U64(METRIC_MEM, random_read_exec),
+    CSV_U64(METRIC_MEM, seq_write_exec),
+    CSV_U64(METRIC_MEM, stride_write_exec),
+    CSV_U64(METRIC_MEM, random_write_exec),
+    // B2/B3类
+    CSV_U64(METRIC_MIX, arith_static),
+    CSV_U64(METRIC_MIX, logic_static),
+    CSV_U64(METRIC_MIX, float_static),
+    CSV_U64(METRIC_MIX, simd_static),
+    CSV_U64(METRIC_MIX, pure_compute_static),
+    CSV_U64(METRIC_MIX, data_movement_static),
+    CSV_U64(METRIC_MIX, compare_static),
+    CSV_U64(METRIC_MIX, stack_static),
+    CSV_U64(METRIC_MIX, string_static),
+    CSV_U64(METRIC_MIX, nop_static),
+    CSV_U64(METRIC_MIX, other_static),
+    CSV_U64(METRIC_MIX, arith_exec),
+    CSV_U64(METRIC_MIX, logic_exec),
+    CSV_U64(METRIC_MIX, float_exec),
+    CSV_U64(METRIC_MIX, simd_exec),
+    CSV_U64(METRIC_MIX, pure_compute_exec),
+    CSV_U64(METRIC_MIX, data_movement_exec),
+    CSV_U64(METRIC_MIX, compare_exec),
+    CSV_U64(METRIC_MIX, stack_exec),
+    CSV_U64(METRIC_MIX, string_exec),
+    CSV_U64(METRIC_MIX, nop_exec),
+    CSV_U64(METRIC_MIX, other_exec),
+    CSV_F4(METRIC_MIX, inst_type_entropy_static),
+    CSV_F4(METRIC_MIX, inst_type_entropy_exec),
+    // C/E类
+    CSV_U64(METRIC_BRANCH, branch_static),
+    CSV_U64(METRIC_BRANCH, branch_exec),
+    CSV_U64(METRIC_BRANCH, indirect_exec),
+    CSV_U64(METRIC_BRANCH, branch_taken_exec),
+    CSV_U64(METRIC_BRANCH, branch_not_taken_exec),
+    CSV_U64(METRIC_BRANCH, cond_branch_static),
+    CSV_U64(METRIC_BRANCH, uncond_branch_static),
+    CSV_U64(METRIC_LOOP, loop_static),
+    CSV_U64(METRIC_LOOP, loop_iter_total),
+    CSV_U64(METRIC_LOOP, loop_depth_max),
+    CSV_U64(METRIC_CALL, return_static),
+    CSV_U64(METRIC_CALL, call_static),
+    CSV_U64(METRIC_CALL, call_other_exec),
+    CSV_U64(METRIC_CALL, call_depth_max),
+    // I类（调用边只在JSON中输出）
+    CSV_U64(METRIC_CALL, fan_in),
+    CSV_U64(METRIC_CALL, fan_out),
+    // D类
+    CSV_U64(METRIC_MIX, reg_read_exec),
+    CSV_U64(METRIC_MIX, reg_write_exec),
+    CSV_U64(METRIC_MIX, reg_read_static),
+    CSV_U64(METRIC_MIX, reg_write_static),
+    CSV_U64(METRIC_MIX, unique_reg_read),
+    CSV_U64(METRIC_MIX, unique_reg_write),
+    // F类
+    CSV_U64(METRIC_DEP, def_use_pairs),
+    CSV_U64(METRIC_DEP, reg_dep_chain_max),
+    CSV_U64(METRIC_DEP, mem_to_reg_exec),
+    CSV_U64(METRIC_DEP, reg_to_mem_exec),
+    // G类
+    CSV_U64(METRIC_LIFE, reg_lifetime_total),
+    CSV_U64(METRIC_LIFE, dead_write_exec),
+    CSV_U64(METRIC_LIFE, first_use_dist_total),
+    // H类
+    CSV_U64(METRIC_CFG, bbl_static),
+    CSV_U64(METRIC_CFG, edge_static),
+    CSV_I64(METRIC_CFG, static_cyclomatic),
+    CSV_U64(METRIC_CFG, bbl_exec),
+    CSV_U64(METRIC_CFG, unique_bbl_exec),
+    CSV_U64(METRIC_CFG, unique_edge_exec),
+    CSV_I64(METRIC_CFG, dynamic_cyclomatic),
+};
+
+/**
+ * 写出CSV报告：首行为 "# schema_version=N" 注释，其后为表头和每函数一行
+ */
+bool WriteCsvReport(const string& path, UINT64 min_calls) {
+    StreamWriter w;
+    if (!w.open(path)) {
+        cerr << "[ERROR] Cannot open CSV file: " << path << endl;
+        return false;
+    }
+
+    UINT32 enabled = g_metrics | (g_sample_mode != SAMPLE_NONE ? CSV_GROUP_SAMPLING : 0);
+    const size_t num_columns = sizeof(g_csv_columns) / sizeof(g_csv_columns[0]);
+
+    w.printf("# schema_version=%d\n", PROFILE_SCHEMA_VERSION);
+    for (size_t i = 0; i < num_columns; i++) {
+        w.raw(i == 0 ? "" : ",");
+        w.raw(g_csv_columns[i].name);
+    }
+    w.raw("\n");
+
+    for (const auto& kv : g_function_profiles) {
+        const FunctionProfile& profile = kv.second;
+        if (profile.call_exec < min_calls) {
+            continue;
+        }
+        for (size_t i = 0; i < num_columns; i++) {
+            const CsvColumn& col = g_csv_columns[i];
+            if (i > 0) {
+                w.raw(",");
+            }
+            if (col.group == 0 || (enabled & col.group) != 0) {
+                col.write(w, profile);
+            }
+        }
+        w.raw("\n");
+    }
+
+    w.close();
+    return true;
+}
+
+/**
+ * Fini回调：归约线程计数，计算派生指标并输出JSON/CSV
+ */
+VOID Fini(INT32 code, VOID *v) {
+    cerr << "[Function Profiler] Program finished. Writing results..." << endl;
+
+    // 归约退出时仍未结束的线程
+    PIN_GetLock(&g_lock, 0);
+    for (ThreadProfile* tp : g_live_threads) {
+        MergeThreadProfile(tp);
+    }
+    g_live_threads.clear();
+    PIN_ReleaseLock(&g_lock);
 
-    outFile << "}\n";
+    UINT64 min_calls = (UINT64)KnobMinCallCount.Value();
 
-    outFile.close();
+    // 采样模式: 外推动态计数（调用边在 BuildCallGraph 中按调用者外推）
+    if (g_sample_mode != SAMPLE_NONE) {
+        ExtrapolateSampledCounters();
+    }
 
+    // I类: 由调用边汇总 fan_in/fan_out 和每条边的调用次数
+    BuildCallGraph();
+
+    ComputeDerivedMetrics();
+
+    int func_count = WriteJsonReport(KnobOutputFile.Value(), min_calls);
+    if (func_count < 0) {
+        return;
+    }
     cerr << "[Function Profiler] Results written to: " << KnobOutputFile.Value() << endl;
+
+    if (!KnobCsvFile.Value().empty() && WriteCsvReport(KnobCsvFile.Value(), min_calls)) {
+        cerr << "[Function Profiler] CSV written to: " << KnobCsvFile.Value() << endl;
+    }
+
     cerr << "[Function Profiler] Total functions analyzed: " << func_count << endl;
+    if (!g_unmapped_ins.empty()) {
+        cerr << "[Function Profiler] Warning: " << g_unmapped_ins.size()
+             << " instructions outside the static decode had no memop/call ID; "
+             << "their memory pattern and call edges were not recorded" << endl;
+    }
 }
 
 // ========== Main 函数 ==========
@@ -1603,18 +2725,76 @@ int main(int argc, char *argv[]) {
         cerr << "Usage: pin -t function_profiler.so [options] -- <program> [program args]" << endl;
         cerr << "Options:" << endl;
         cerr << "  -o <file>          输出JSON文件路径 (默认: function_profile.json)" << endl;
+        cerr << "  -csv <file>        额外输出每函数一行的CSV (默认: 不输出)" << endl;
         cerr << "  -min_calls <n>     最小调用次数过滤 (默认: 1)" << endl;
         cerr << "  -enable_dep        启用F类数据依赖分析 (有性能开销)" << endl;
         cerr << "  -enable_lifetime   启用G类生命周期分析 (有性能开销)" << endl;
+        cerr << "  -metrics <list>    启用的指标组 mix,mem,branch,loop,call,dep,life,cfg 或 all" << endl;
+        cerr << "                     (默认: mix,mem,branch,loop,call,cfg)" << endl;
+        cerr << "  -sample <mode>     采样模式 none / call / time (默认: none)" << endl;
+        cerr << "  -sample_rate <n>   完整剖析 1/N 的调用或时间窗口 (默认: 100)" << endl;
+        cerr << "  -sample_window_us <n>  time 模式的时间窗口长度 (默认: 1000)" << endl;
+        return 1;
+    }
+
+    // 解析指标组；-enable_dep / -enable_lifetime 等价于追加 dep / life
+    if (!ParseMetrics(KnobMetrics.Value(), g_metrics)) {
+        return 1;
+    }
+    if (KnobEnableDep.Value()) {
+        g_metrics |= METRIC_DEP;
+    }
+    if (KnobEnableLifetime.Value()) {
+        g_metrics |= METRIC_LIFE;
+    }
+    cerr << "[Function Profiler] Metric groups: " << MetricsToString(g_metrics) << endl;
+
+    // 解析采样模式
+    if (KnobSampleMode.Value() == "call") {
+        g_sample_mode = SAMPLE_CALL;
+    } else if (KnobSampleMode.Value() == "time") {
+        g_sample_mode = SAMPLE_TIME;
+    } else if (KnobSampleMode.Value() != "none") {
+        cerr << "[Function Profiler] Unknown sample mode: " << KnobSampleMode.Value() << endl;
         return 1;
     }
+    if (g_sample_mode != SAMPLE_NONE) {
+        if (KnobSampleRate.Value() == 0 || KnobSampleWindow.Value() == 0) {
+            cerr << "[Function Profiler] -sample_rate and -sample_window_us must be positive" << endl;
+            return 1;
+        }
+        g_sample_rate = KnobSampleRate.Value();
+        g_sample_window_us = KnobSampleWindow.Value();
+        cerr << "[Function Profiler] Sampling: " << KnobSampleMode.Value() << ", 1/" << g_sample_rate << endl;
+    }
 
     // 初始化锁
     PIN_InitLock(&g_lock);
 
+    // 分析回调通过工具寄存器取得本线程计数块
+    g_thread_reg = PIN_ClaimToolRegister();
+    if (!REG_valid(g_thread_reg)) {
+        cerr << "[Function Profiler] Cannot claim a tool register" << endl;
+        return 1;
+    }
+    if (g_sample_mode != SAMPLE_NONE) {
+        g_sample_reg = PIN_ClaimToolRegister();
+        if (!REG_valid(g_sample_reg)) {
+            cerr << "[Function Profiler] Cannot claim a tool register for sampling" << endl;
+            return 1;
+        }
+    }
+
     // 注册镜像加载回调
     IMG_AddInstrumentFunction(ImageLoad, 0);
 
+    // 注册Trace插桩回调（基本块合并计数、逐指令动态分析、采样版本切换）
+    TRACE_AddInstrumentFunction(InstrumentTrace, 0);
+
+    // 注册线程回调
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    PIN_AddThreadFiniFunction(ThreadFini, 0);
+
     // 注册程序结束回调
     PIN_AddFiniFunction(Fini, 0);
 
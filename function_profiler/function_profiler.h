@@ -11,14 +11,27 @@
 #ifndef FUNCTION_PROFILER_H
 #define FUNCTION_PROFILER_H
 
+#include <cstdio>
 #include <string>
 #include <map>
 #include <set>
+#include <vector>
 #include "pin.H"
 
 using std::string;
 using std::map;
 using std::set;
+using std::vector;
+
+// 每线程循环嵌套栈深度，超过时不再压栈，嵌套深度记为 MAX_LOOP_DEPTH + 1
+#define MAX_LOOP_DEPTH 16
+
+// 采样模式下每线程最多跟踪的嵌套调用层数，超过时新调用不做完整剖析
+#define SAMPLE_STACK_DEPTH 1024
+
+// 输出格式版本：JSON 的 tool_info.schema_version、CSV 首行注释
+// 增删字段或改变字段含义时加1
+#define PROFILE_SCHEMA_VERSION 2
 
 /**
  * 函数剖析数据结构
@@ -33,6 +46,7 @@ struct FunctionProfile {
     ADDRINT offset_start;           // 起始偏移(相对主程序基址)
     ADDRINT offset_end;             // 结束偏移(相对主程序基址)
     UINT32 function_size_bytes;     // 函数大小(字节)
+    UINT32 func_id;                 // 函数ID(镜像加载时分配，索引每线程计数块)
 
     // ========== A类: 执行统计 ==========
     UINT64 call_exec;               // 函数调用执行次数(动态)
@@ -49,14 +63,6 @@ struct FunctionProfile {
     UINT32 mem_inst_static;         // 访存指令静态数量（不重复计数）
 
     // ========== B1.5类: 内存访问模式 ==========
-    // 运行时状态（不输出到JSON）
-    ADDRINT last_read_addr;         // 上一次读地址
-    ADDRINT last_write_addr;        // 上一次写地址
-    INT64 last_read_stride;         // 上一次读stride
-    INT64 last_write_stride;        // 上一次写stride
-    bool has_last_read;             // 是否有上一次读记录
-    bool has_last_write;            // 是否有上一次写记录
-
     // 读访问模式统计
     UINT64 seq_read_exec;           // 连续读执行次数(动态)
     UINT64 stride_read_exec;        // 步长读执行次数(动态)
@@ -98,6 +104,7 @@ struct FunctionProfile {
     UINT32 branch_static;           // 分支指令静态数量
     UINT64 branch_exec;             // 分支指令执行次数(动态)
     UINT32 loop_static;             // 循环静态数量(回边检测)
+    vector<ADDRINT> backedge_addrs; // 循环ID -> 回边指令地址(升序，不输出)
     UINT32 return_static;           // 返回点静态数量
     UINT32 call_static;             // 函数调用静态数量
     UINT64 call_other_exec;         // 调用其他函数执行次数(动态)
@@ -106,8 +113,8 @@ struct FunctionProfile {
     // ========== I类: 函数间调用图 ==========
     UINT32 fan_in;                  // 入度：有多少不同函数调用本函数(动态)
     UINT32 fan_out;                 // 出度：本函数调用多少不同函数(动态)
-    set<ADDRINT> callers_set;       // 运行时状态：调用本函数的函数地址集合(不输出)
-    set<ADDRINT> callees_set;       // 运行时状态：本函数调用的函数地址集合(不输出)
+    set<ADDRINT> callers_set;       // Fini时汇总：调用本函数的函数地址集合
+    map<ADDRINT, UINT64> callee_counts;  // Fini时汇总：被调用地址 -> 调用次数
 
     // ========== D类: 寄存器使用 ==========
     UINT64 reg_read_exec;           // 寄存器读取执行次数(动态)
@@ -116,8 +123,8 @@ struct FunctionProfile {
     UINT32 reg_write_static;        // 静态寄存器写操作数(静态)
     UINT32 unique_reg_read;         // 使用的不同读寄存器数(静态)
     UINT32 unique_reg_write;        // 使用的不同写寄存器数(静态)
-    set<REG> read_regs_set;         // 运行时状态：读寄存器集合(不输出)
-    set<REG> write_regs_set;        // 运行时状态：写寄存器集合(不输出)
+    set<REG> read_regs_set;         // 镜像加载时使用：读寄存器集合(统计后释放)
+    set<REG> write_regs_set;        // 镜像加载时使用：写寄存器集合(统计后释放)
 
     // ========== E类: 控制流细化 ==========
     UINT64 branch_taken_exec;       // 分支跳转执行次数(动态)
@@ -126,27 +133,18 @@ struct FunctionProfile {
     UINT32 uncond_branch_static;    // 无条件跳转静态数量(静态)
     UINT64 loop_iter_total;         // 循环总迭代次数(动态)
     UINT32 call_depth_max;          // 最大调用深度(动态)
-    UINT32 current_call_depth;      // 运行时状态：当前调用深度(不输出)
     UINT32 loop_depth_max;          // 最大循环嵌套深度(动态)
-    UINT32 current_loop_depth;      // 运行时状态：当前循环嵌套深度(不输出)
-    set<ADDRINT> active_loops;      // 运行时状态：当前活跃的循环回边地址(不输出)
 
     // ========== F类: 数据依赖 (可选启用) ==========
     UINT64 def_use_pairs;           // 定义-使用对总数(动态)
     UINT32 reg_dep_chain_max;       // 最长寄存器依赖链(动态)
     UINT64 mem_to_reg_exec;         // 内存→寄存器传递次数(动态)
     UINT64 reg_to_mem_exec;         // 寄存器→内存传递次数(动态)
-    // 运行时状态：简化的寄存器跟踪(16个通用寄存器)
-    UINT64 reg_last_def_id[16];     // 每个寄存器最后定义的指令ID
-    UINT64 current_dyn_id;          // 当前动态指令ID
 
     // ========== G类: 生命周期 (可选启用) ==========
     UINT64 reg_lifetime_total;      // 寄存器值总存活指令数(动态)
     UINT64 dead_write_exec;         // 死写次数(动态)
     UINT64 first_use_dist_total;    // 定义到首次使用的总距离(动态)
-    // 运行时状态
-    UINT64 reg_def_id[16];          // 寄存器定义时的指令ID
-    bool reg_was_used[16];          // 寄存器是否被使用过
 
     // ========== H类: 圈复杂度 ==========
     // 静态圈复杂度
@@ -156,16 +154,35 @@ struct FunctionProfile {
     UINT64 bbl_exec;                // 基本块执行次数(动态)
     UINT32 unique_bbl_exec;         // 实际执行的唯一基本块数(动态)
     UINT32 unique_edge_exec;        // 实际执行的唯一边数(动态)
+    INT32 static_cyclomatic;        // 静态圈复杂度 E - N + 2(Fini时计算)
+    INT32 dynamic_cyclomatic;       // 动态圈复杂度(Fini时计算)
+    // 静态BBL/边编号(镜像加载时分配，不输出到JSON)
+    vector<ADDRINT> bbl_addrs;      // BBL ID -> 起始地址(升序)
+    vector<UINT32> succ_begin;      // BBL ID -> succ_bbl/succ_edge 中的起始下标(长度 N+1)
+    vector<UINT32> succ_bbl;        // 后继BBL ID
+    vector<UINT32> succ_edge;       // 对应的静态边ID
     // 运行时状态(不输出到JSON)
-    set<ADDRINT> executed_bbls;                         // 执行过的BBL地址集合
-    set<std::pair<ADDRINT, ADDRINT>> executed_edges;    // 执行过的边集合 (src, dst)
-    ADDRINT last_bbl_addr;          // 上一个执行的BBL地址
+    vector<UINT64> bbl_bits;        // 执行过的BBL位图(按BBL ID)
+    vector<UINT64> edge_bits;       // 执行过的静态边位图(按边ID)
+    set<std::pair<UINT32, UINT32>> extra_edges;  // 不在静态边表中的动态边(哈希表满后持锁写入，Fini时并入哈希表中的边)
+
+    // ========== 采样 ==========
+    UINT64 sampled_calls;           // 完整剖析的调用次数
+    UINT64 sample_inst_sum;         // 完整剖析的各次调用的指令数之和
+    double sample_inst_sumsq;       // 完整剖析的各次调用的指令数平方和（估计采样误差）
+    double sample_scale;            // 外推系数 call_exec / sampled_calls（未采样时为 1）
+    double inst_exec_rse;           // 外推后 inst_exec 的相对标准误差（Fini时计算，负数表示无法估计）
+
+    // ========== B3类: 指令类型熵(Fini时计算) ==========
+    double inst_type_entropy_static;
+    double inst_type_entropy_exec;
 
     // 构造函数：初始化所有字段
     FunctionProfile() :
         start_addr(0), end_addr(0),
         offset_start(0), offset_end(0),
         function_size_bytes(0),
+        func_id(0),
         // A类: 执行统计
         call_exec(0),
         inst_exec(0),
@@ -178,9 +195,6 @@ struct FunctionProfile {
         mem_write_static(0),
         mem_inst_static(0),
         // B1.5类: 内存访问模式
-        last_read_addr(0), last_write_addr(0),
-        last_read_stride(0), last_write_stride(0),
-        has_last_read(false), has_last_write(false),
         seq_read_exec(0), stride_read_exec(0), random_read_exec(0),
         seq_write_exec(0), stride_write_exec(0), random_write_exec(0),
         // B2类: 计算特性
@@ -231,15 +245,12 @@ struct FunctionProfile {
         uncond_branch_static(0),
         loop_iter_total(0),
         call_depth_max(0),
-        current_call_depth(0),
         loop_depth_max(0),
-        current_loop_depth(0),
         // F类: 数据依赖
         def_use_pairs(0),
         reg_dep_chain_max(0),
         mem_to_reg_exec(0),
         reg_to_mem_exec(0),
-        current_dyn_id(0),
         // G类: 生命周期
         reg_lifetime_total(0),
         dead_write_exec(0),
@@ -250,16 +261,288 @@ struct FunctionProfile {
         bbl_exec(0),
         unique_bbl_exec(0),
         unique_edge_exec(0),
-        last_bbl_addr(0)
+        static_cyclomatic(0),
+        dynamic_cyclomatic(0),
+        // 采样
+        sampled_calls(0),
+        sample_inst_sum(0),
+        sample_inst_sumsq(0),
+        sample_scale(1.0),
+        inst_exec_rse(-1.0),
+        inst_type_entropy_static(0),
+        inst_type_entropy_exec(0)
     {
-        // 初始化数组
-        for (int i = 0; i < 16; i++) {
-            reg_last_def_id[i] = 0;
-            reg_def_id[i] = 0;
-            reg_was_used[i] = false;
-        }
         // set 容器自动初始化为空
     }
 };
 
+/**
+ * 基本块静态增量：一个基本块（属于同一函数的一段）内各类指令的数量
+ * 插桩时计算一次，块每执行一次整体累加到 FunctionProfile，
+ * 字段与 FunctionProfile 中同名的 _exec 计数一一对应
+ */
+struct BblDelta {
+    UINT32 inst;                    // -> inst_exec
+    UINT32 mem_inst;                // -> mem_inst_exec
+    UINT32 branch;                  // -> branch_exec
+    UINT32 indirect;                // -> indirect_exec
+    UINT32 arith;                   // -> arith_exec
+    UINT32 logic;                   // -> logic_exec
+    UINT32 fp;                      // -> float_exec
+    UINT32 simd;                    // -> simd_exec
+    UINT32 pure_compute;            // -> pure_compute_exec
+    UINT32 data_movement;           // -> data_movement_exec
+    UINT32 compare;                 // -> compare_exec
+    UINT32 stack;                   // -> stack_exec
+    UINT32 str;                     // -> string_exec
+    UINT32 nop;                     // -> nop_exec
+    UINT32 other;                   // -> other_exec
+    UINT32 reg_read;                // -> reg_read_exec
+    UINT32 reg_write;               // -> reg_write_exec
+    UINT32 mem_to_reg;              // -> mem_to_reg_exec (仅 -enable_dep)
+    UINT32 reg_to_mem;              // -> reg_to_mem_exec (仅 -enable_dep)
+
+    BblDelta() :
+        inst(0), mem_inst(0), branch(0), indirect(0),
+        arith(0), logic(0), fp(0), simd(0), pure_compute(0), data_movement(0),
+        compare(0), stack(0), str(0), nop(0), other(0),
+        reg_read(0), reg_write(0), mem_to_reg(0), reg_to_mem(0) {}
+};
+
+/**
+ * 每线程、每函数的动态计数块
+ * 分析回调只写本线程的计数块，不使用原子操作；按 cache line 对齐，
+ * 相邻函数的计数块不会共享 cache line。ThreadFini/Fini 时归约到 FunctionProfile
+ */
+struct FunctionCounters {
+    // A类
+    UINT64 call_exec;
+    UINT64 inst_exec;
+    // B1类
+    UINT64 mem_read_exec;
+    UINT64 mem_write_exec;
+    UINT64 mem_inst_exec;
+    // B1.5类
+    UINT64 seq_read_exec;
+    UINT64 stride_read_exec;
+    UINT64 random_read_exec;
+    UINT64 seq_write_exec;
+    UINT64 stride_write_exec;
+    UINT64 random_write_exec;
+    // B2类
+    UINT64 arith_exec;
+    UINT64 logic_exec;
+    UINT64 float_exec;
+    UINT64 simd_exec;
+    UINT64 pure_compute_exec;
+    UINT64 data_movement_exec;
+    UINT64 compare_exec;
+    UINT64 stack_exec;
+    UINT64 string_exec;
+    UINT64 nop_exec;
+    UINT64 other_exec;
+    // C类
+    UINT64 branch_exec;
+    UINT64 call_other_exec;
+    UINT64 indirect_exec;
+    // D类
+    UINT64 reg_read_exec;
+    UINT64 reg_write_exec;
+    // E类
+    UINT64 branch_taken_exec;
+    UINT64 branch_not_taken_exec;
+    UINT64 loop_iter_total;
+    // F类
+    UINT64 def_use_pairs;
+    UINT64 mem_to_reg_exec;
+    UINT64 reg_to_mem_exec;
+    // G类
+    UINT64 reg_lifetime_total;
+    UINT64 dead_write_exec;
+    UINT64 first_use_dist_total;
+    // H类
+    UINT64 bbl_exec;
+    // 采样
+    UINT64 sampled_calls;
+    UINT64 sample_inst_sum;
+    double sample_inst_sumsq;
+    // 取最大值归约
+    UINT32 call_depth_max;
+    UINT32 loop_depth_max;
+    UINT32 reg_dep_chain_max;
+
+    // 运行时状态（本线程内有效，不归约）
+    UINT32 current_call_depth;      // 当前调用深度
+    UINT32 last_bbl_slot;           // 本次调用中上一个执行的BBL ID + 1（0=尚无）
+    UINT32 loop_depth;              // 当前循环嵌套深度（可超过 MAX_LOOP_DEPTH）
+    UINT32 loop_stack[MAX_LOOP_DEPTH];  // 活跃循环ID，栈顶为最内层
+    UINT32 sample_countdown;        // call 采样模式：距下一次完整剖析的调用次数
+} __attribute__((aligned(64)));
+
+/**
+ * 每条静态访存操作（一条指令的读或写）在每个线程中的步长预测表项
+ * 同一循环中交替访问多个数组时，各访存指令的步长互不干扰
+ */
+struct MemopState {
+    ADDRINT last_addr;              // 上一次访问地址
+    INT64 last_stride;              // 预测步长
+    UINT32 confidence;              // 预测步长的置信度（饱和计数，0~MEMOP_MAX_CONFIDENCE）
+    UINT32 valid;                   // 是否已有上一次访问
+};
+
+// ========== F类/G类: 寄存器数据流 ==========
+
+// 紧凑寄存器ID：0-15 通用寄存器，16-47 XMM/YMM/ZMM0-31（同号的 XMM/YMM/ZMM 视为同一寄存器），48 标志寄存器
+// 每条指令的读/写寄存器集合在插桩时编码为 64 位掩码
+#define REG_ID_VEC_BASE 16
+#define REG_ID_FLAGS 48
+#define NUM_REG_IDS 49
+
+/**
+ * 每线程的寄存器定义状态（F类、G类共用）
+ */
+struct RegDataflowState {
+    UINT64 dyn_id;                  // 本线程已跟踪的指令数，作为定义ID（从1开始）
+    UINT64 def_id[NUM_REG_IDS];     // 寄存器最后一次定义的指令ID（0=尚未定义）
+    UINT64 defined_mask;            // 已定义过的寄存器
+    UINT64 used_mask;               // 最后一次定义之后被读过的寄存器
+};
+
+/**
+ * 需要运行时状态的指令的ID，镜像加载时分配
+ * trace 可能被多次插桩（代码缓存淘汰、采样模式的两个版本），ID 不能在 trace 插桩时分配
+ */
+#define NO_INS_ID 0xffffffffU
+
+struct InsIds {
+    UINT32 read_memop;              // 读访存操作ID
+    UINT32 write_memop;             // 写访存操作ID
+    UINT32 call_id;                 // 直接调用: 调用边ID；间接调用: 调用点ID
+
+    InsIds() : read_memop(NO_INS_ID), write_memop(NO_INS_ID), call_id(NO_INS_ID) {}
+};
+
+// ========== I类: 调用图 ==========
+
+// 被调用地址不是被剖析函数的入口（如PLT、库函数）
+#define NO_FUNC_ID 0xffffffffU
+
+/**
+ * 直接调用边：(调用者, 被调用地址)，插桩时静态确定并编号
+ */
+struct CallEdge {
+    UINT32 caller_id;               // 调用者函数ID
+    UINT32 callee_id;               // 被调用函数ID，NO_FUNC_ID 表示不是被剖析的函数
+    ADDRINT callee_addr;            // 被调用地址
+    UINT64 count;                   // 调用次数(各线程归约后)
+};
+
+/**
+ * 间接调用边：运行时首次出现时插入并发哈希表，之后只增加计数
+ * state: 0=空, 1=正在写入, 2=可用
+ */
+struct DynCallEdge {
+    volatile UINT32 state;
+    UINT32 caller_id;
+    ADDRINT callee_addr;
+    UINT64 count;                   // 由各线程的内联缓存批量累加
+
+    DynCallEdge() : state(0), caller_id(0), callee_addr(0), count(0) {}
+};
+
+/**
+ * 静态边表之外的动态控制流边 (函数ID, 源BBL, 目的BBL)，如间接跳转
+ * 运行时首次出现时插入并发哈希表；state: 0=空, 1=正在写入, 2=可用
+ */
+struct ExtraEdge {
+    volatile UINT32 state;
+    UINT32 func_id;
+    UINT32 src_bbl;
+    UINT32 dst_bbl;
+
+    ExtraEdge() : state(0), func_id(0), src_bbl(0), dst_bbl(0) {}
+};
+
+/**
+ * 间接调用点的每线程内联缓存：目标不变时只增加本地计数
+ */
+struct CallSiteCache {
+    ADDRINT target;                 // 上一次的调用目标
+    DynCallEdge* edge;              // 对应的间接调用边
+    UINT64 pending;                 // 尚未累加到 edge->count 的次数
+};
+
+/**
+ * 采样模式下一次调用的记录，按栈指针判断调用是否已结束
+ * （尾调用、longjmp 没有匹配的 ret，由之后的入口/返回点按栈指针弹出）
+ */
+struct SampleFrame {
+    ADDRINT sp;                     // 入口处的栈指针
+    UINT32 func_id;
+    UINT32 sampled;                 // 本次调用是否完整剖析
+    UINT64 inst_base;               // 入口时该函数的 inst_exec（求本次调用的指令数）
+};
+
+/**
+ * 每线程剖析状态，指针保存在工具寄存器中，分析回调通过 IARG_REG_VALUE 取得
+ */
+struct ThreadProfile {
+    FunctionCounters* counters;     // 函数ID -> 本线程计数块（零初始化）
+    UINT32 num_functions;           // counters 的长度
+    UINT64* call_edge_counts;       // 直接调用边ID -> 本线程调用次数
+    UINT32 num_call_edges;
+    CallSiteCache* site_caches;     // 间接调用点ID -> 本线程内联缓存
+    UINT32 num_call_sites;
+    MemopState* memops;             // 访存操作ID -> 本线程步长预测表项（零初始化）
+    UINT32 num_memops;
+    UINT64 inst_executed;           // 本线程在被剖析函数内执行的指令数
+    SampleFrame* sample_stack;      // 采样模式的调用栈（-sample none 时为 NULL）
+    UINT32 sample_depth;
+    UINT32 clock_countdown;         // time 采样模式：距下一次读时钟的调用次数
+    UINT64 window_end;              // time 采样模式：当前时间窗口的结束时间(微秒)
+    UINT32 window_sampled;          // time 采样模式：当前时间窗口是否完整剖析
+    RegDataflowState regs;          // F类/G类寄存器定义状态（零初始化）
+    THREADID tid;
+
+    ThreadProfile() : counters(NULL), num_functions(0), call_edge_counts(NULL), num_call_edges(0),
+                      site_caches(NULL), num_call_sites(0), memops(NULL), num_memops(0),
+                      inst_executed(0), sample_stack(NULL), sample_depth(0), clock_countdown(0),
+                      window_end(0), window_sampled(0), regs(), tid(0) {}
+};
+
+// ========== 流式输出 ==========
+
+/**
+ * 缓冲写出 JSON / CSV：内容先写入内存缓冲区，超过 CHUNK 字节时整块 fwrite；
+ * 整数直接格式化到缓冲区，字符串直接转义写入，不构造中间 std::string
+ */
+class StreamWriter {
+public:
+    static const size_t CHUNK = 1 << 20;
+
+    StreamWriter() : fp(NULL) {}
+    ~StreamWriter() { close(); }
+
+    bool open(const string& path);
+    void close();
+
+    void raw(const char* s);
+    void printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+    void u64(UINT64 value);
+    void i64(INT64 value);
+    void hex(ADDRINT value);                    // "0x..."，不带引号
+    void fixed(double value, int precision);
+    void json_string(const string& s);          // 带引号并转义
+    void csv_string(const string& s);           // 带引号，内部引号加倍
+
+private:
+    FILE* fp;
+    string buf;
+
+    void flush_if_full() {
+        if (buf.size() >= CHUNK) flush();
+    }
+    void flush();
+};
+
 #endif // FUNCTION_PROFILER_H
@@ -1,5 +1,7 @@
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <utility>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -9,7 +11,9 @@
 using std::cerr;
 using std::endl;
 using std::ifstream;
+using std::map;
 using std::ofstream;
+using std::pair;
 using std::string;
 using std::vector;
 
@@ -18,40 +22,73 @@ static UINT64 jump_count = 0;
 static vector<UINT64> random_indices;
 static vector<UINT64>::iterator current_index;
 static UINT64 icount = 0;
+// Next sampled index (*current_index), or ~0 once all indices are consumed
+static UINT64 next_index = ~(UINT64)0;
+// Jump classification per (BBL address, instruction count), built once so a
+// re-JIT of the same block (e.g. after a code cache flush) reuses it
+static map<pair<ADDRINT, UINT32>, vector<UINT8> > bbl_jump_tables;
 KNOB<string> randnumsfile(KNOB_MODE_WRITEONCE, "pintool", "randnumsfile", "none", "Input file containing random indices");
 KNOB<UINT64> total_count(KNOB_MODE_WRITEONCE, "pintool", "totalcount", "0", "Total instruction count");
 
 // Function to check if an instruction is a jump type
 bool IsJumpInstruction(INS ins)
 {
-    return INS_IsBranch(ins) || INS_IsCall(ins) || INS_IsRet(ins);
+    return INS_IsBranch(ins) || !INS_HasFallThrough(ins);
 }
 
-// Function to increment dynamic instruction count and check for jumps
-VOID docount(INS ins)
+static VOID AdvanceIndex()
 {
-    icount++;
+    ++current_index;
+    next_index = (current_index != random_indices.end()) ? *current_index : ~(UINT64)0;
+}
 
-    // Check if the current instruction count matches the current index
-    if (current_index != random_indices.end() && icount == *current_index)
+// Called before every BBL: count the whole block, and only report when the
+// next sampled index falls inside it
+ADDRINT CountBbl(UINT32 num_ins)
+{
+    icount += num_ins;
+    return icount >= next_index;
+}
+
+// Slow path: resolve every sampled index in this block. is_jump[i] is the
+// jump classification of the i-th instruction, precomputed at JIT time.
+VOID SampleBbl(const UINT8* is_jump, UINT32 num_ins)
+{
+    UINT64 base = icount - num_ins;     // icount before the first instruction
+    while (next_index <= icount)
     {
-        // If the instruction is a jump type, increment the jump count
-        //if (IsJumpInstruction(ins))
-        if(INS_IsBranch(ins) || !INS_HasFallThrough(ins))
+        // Indices already passed (e.g. 0) can never match
+        if (next_index > base && is_jump[next_index - base - 1])
         {
             jump_count++;
         }
-        // Move to the next index
-        ++current_index;
+        AdvanceIndex();
     }
-    //std::cout << icount << "and\t" << *current_index << std::endl;
 }
 
 // Instrumentation function
-VOID Instruction(INS ins, VOID* v)
+VOID Trace(TRACE trace, VOID* v)
 {
-    // Insert a call to docount before every instruction
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)docount, IARG_PTR, ins, IARG_END);
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        UINT32 num_ins = BBL_NumIns(bbl);
+        vector<UINT8>& table = bbl_jump_tables[std::make_pair(BBL_Address(bbl), num_ins)];
+        if (table.empty())
+        {
+            table.reserve(num_ins);
+            for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+            {
+                table.push_back(IsJumpInstruction(ins) ? 1 : 0);
+            }
+        }
+        const UINT8* is_jump = &table[0];
+
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountBbl, IARG_UINT32, num_ins, IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)SampleBbl,
+                           IARG_PTR, is_jump,
+                           IARG_UINT32, num_ins,
+                           IARG_END);
+    }
 }
 
 // Function to parse the random numbers file
@@ -79,6 +116,8 @@ void ParseRandomNumbersFile(const std::string& filename)
     // Sort the random indices in ascending order
     std::sort(random_indices.begin(), random_indices.end());
     current_index = random_indices.begin();
+    if (current_index != random_indices.end())
+        next_index = *current_index;
 }
 
 // Function called when the application exits
@@ -118,8 +157,8 @@ int main(int argc, char* argv[])
     // Parse the random numbers file
     ParseRandomNumbersFile(randnumsfile.Value());
 
-    // Add instrumentation for each instruction
-    INS_AddInstrumentFunction(Instruction, 0);
+    // Add instrumentation for each basic block
+    TRACE_AddInstrumentFunction(Trace, 0);
 
     // Register Fini function
     PIN_AddFiniFunction(Fini, 0);
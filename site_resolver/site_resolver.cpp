@@ -0,0 +1,348 @@
+/*
+ * site_resolver.cpp - 单次运行解析注错位置工具实现
+ *
+ * 用法：
+ *   pin -t site_resolver.so \
+ *       -randnumsfile randnums.txt \
+ *       -o sites.json \
+ *       -- ./program args
+ *
+ * 每个随机序号的输出可直接作为 targeted_faultinjection.so 的
+ * -target_pc / -target_reg / -target_kth 参数
+ */
+
+#include "site_resolver.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+
+// ========== 全局变量 ==========
+
+static UINT64 g_icount = 0;                         // 全局动态指令计数（从 1 开始）
+static UINT64 g_next_index = ~(UINT64)0;            // 下一个待解析的序号
+static std::vector<SiteRecord> g_sites;             // 按序号升序排列
+static size_t g_next_site = 0;
+
+// pc -> 包含该 pc 的所有基本块计数器
+static std::map<ADDRINT, std::vector<BblCounter*> > g_pc_bbls;
+// 块起始地址 -> 计数器（重新 JIT 时复用，避免重复登记）
+static std::map<ADDRINT, BblCounter*> g_bbl_by_addr;
+// pc -> 静态信息（每个 pc 只提取一次）
+static std::map<ADDRINT, SiteStatic> g_statics;
+
+// ========== 静态信息提取 ==========
+
+static std::string mem_operand_base(INS ins) {
+    REG base_reg = INS_MemoryBaseReg(ins);
+    return REG_valid(base_reg) ? REG_StringShort(base_reg) : "none";
+}
+
+void collect_site_static(INS ins, SiteStatic& info) {
+    info.valid = true;
+    info.disasm = INS_Disassemble(ins);
+    info.next_pc = INS_NextAddress(ins);
+
+    // 写寄存器列表（与 findnextinst 的 regwN 一致）
+    UINT32 numW = INS_MaxNumWRegs(ins);
+    for (UINT32 i = 0; i < numW; i++) {
+        REG reg = INS_RegW(ins, i);
+        if (REG_valid(reg))
+            info.regw.push_back(REG_StringShort(reg));
+    }
+
+    // 注错寄存器选择（与 randomInst 一致）
+    if (INS_IsMemoryWrite(ins) || INS_IsMemoryRead(ins)) {
+        REG reg = INS_MemoryBaseReg(ins);
+        if (!REG_valid(reg))
+            reg = INS_MemoryIndexReg(ins);
+        info.reg_kind = "mem";
+        info.target_reg = REG_StringShort(reg);
+    } else {
+        UINT32 randW = numW > 1 ? rand() % numW : 0;
+        REG reg = INS_RegW(ins, randW);
+        if (numW > 1 && REG_is_flags(reg))
+            randW = (randW + 1) % numW;
+        if (numW > 1 && REG_valid(INS_RegW(ins, randW)))
+            reg = INS_RegW(ins, randW);
+        else
+            reg = INS_RegW(ins, 0);
+        if (!REG_valid(reg) || REG_is_flags(reg)) {
+            info.reg_kind = "invalid";
+            info.target_reg = "";
+        } else {
+            info.reg_kind = "reg";
+            info.target_reg = REG_StringShort(reg);
+        }
+    }
+
+    // 内存与栈操作信息（与 findnextinst 一致）
+    info.mem_read = INS_IsMemoryRead(ins);
+    info.mem_write = INS_IsMemoryWrite(ins);
+    if ((INS_IsStackRead(ins) || INS_IsStackWrite(ins)) && REG_valid(INS_MemoryBaseReg(ins))) {
+        if (INS_MemoryOperandIsRead(ins, 0))
+            info.stackr = mem_operand_base(ins);
+        if (INS_MemoryOperandIsWritten(ins, 0))
+            info.stackw = mem_operand_base(ins);
+    }
+    if (info.mem_read || info.mem_write) {
+        info.base = mem_operand_base(ins);
+        REG index_reg = INS_MemoryIndexReg(ins);
+        info.index = REG_valid(index_reg) ? REG_StringShort(index_reg) : "none";
+        info.displacement = INS_MemoryDisplacement(ins);
+        info.scale = INS_MemoryScale(ins);
+    } else {
+        info.base = "none";
+        info.index = "none";
+    }
+}
+
+// 函数序言分析（与 findnextinst 的 spsize 输出一致），需要 RTN 已打开
+static void collect_spsize(RTN rtn, SiteStatic& info) {
+    bool meet_rbp = false;
+    for (INS ins = RTN_InsHead(rtn); INS_Valid(ins); ins = INS_Next(ins)) {
+        if (OPCODE_StringShort(INS_Opcode(ins)) == "PUSH") {
+            if (meet_rbp)
+                info.spsize.push_back(INS_Disassemble(ins));
+            if (INS_MaxNumRRegs(ins) > 0 && REG_StringShort(INS_RegR(ins, 0)) == "rbp")
+                meet_rbp = true;
+        }
+        if (OPCODE_StringShort(INS_Opcode(ins)) == "SUB") {
+            UINT32 numW = INS_MaxNumWRegs(ins);
+            for (UINT32 i = 0; i < numW; i++) {
+                if (REG_StringShort(INS_RegW(ins, i)) == "rsp")
+                    info.spsize.push_back(INS_Disassemble(ins));
+            }
+            break;
+        }
+    }
+}
+
+// 在分析回调中首次采样到某 pc 时调用，需持有 client lock 才能查询 RTN/IMG
+static void resolve_static(ADDRINT pc) {
+    if (g_statics.find(pc) != g_statics.end()) return;
+    SiteStatic& info = g_statics[pc];
+
+    PIN_LockClient();
+
+    IMG img = IMG_FindByAddress(pc);
+    if (IMG_Valid(img)) {
+        info.img_name = IMG_Name(img);
+        info.offset = pc - IMG_LowAddress(img);
+    }
+
+    RTN rtn = RTN_FindByAddress(pc);
+    if (RTN_Valid(rtn)) {
+        RTN_Open(rtn);
+        for (INS ins = RTN_InsHead(rtn); INS_Valid(ins); ins = INS_Next(ins)) {
+            if (INS_Address(ins) == pc) {
+                collect_site_static(ins, info);
+                break;
+            }
+        }
+        collect_spsize(rtn, info);
+        RTN_Close(rtn);
+    }
+
+    PIN_UnlockClient();
+}
+
+// ========== 分析回调 ==========
+
+// 每个基本块执行前调用：块计数 + 全局计数，只有下一个序号落在本块内才进入慢路径
+ADDRINT Count_Bbl(BblCounter* counter) {
+    counter->execs++;
+    g_icount += counter->num_ins;
+    return g_icount >= g_next_index;
+}
+
+// 某 pc 截至目前的执行次数（当前块已计入）
+static UINT64 occurrences(ADDRINT pc) {
+    UINT64 total = 0;
+    const std::vector<BblCounter*>& bbls = g_pc_bbls[pc];
+    for (size_t i = 0; i < bbls.size(); i++)
+        total += bbls[i]->execs;
+    return total;
+}
+
+VOID Resolve_Sites(BblCounter* counter) {
+    UINT64 base = g_icount - counter->num_ins;   // 本块第一条指令之前的计数
+    while (g_next_site < g_sites.size() && g_sites[g_next_site].index <= g_icount) {
+        SiteRecord& site = g_sites[g_next_site];
+        if (site.index > base) {
+            site.pc = counter->pcs[site.index - base - 1];
+            site.kth = occurrences(site.pc);
+            resolve_static(site.pc);
+        }
+        g_next_site++;
+    }
+    g_next_index = g_next_site < g_sites.size() ? g_sites[g_next_site].index : ~(UINT64)0;
+}
+
+// ========== 插桩函数 ==========
+
+static BblCounter* get_bbl_counter(BBL bbl) {
+    ADDRINT addr = BBL_Address(bbl);
+    UINT32 num_ins = BBL_NumIns(bbl);
+
+    std::map<ADDRINT, BblCounter*>::iterator it = g_bbl_by_addr.find(addr);
+    if (it != g_bbl_by_addr.end() && it->second->num_ins == num_ins)
+        return it->second;
+
+    BblCounter* counter = new BblCounter();
+    counter->num_ins = num_ins;
+    counter->pcs = new ADDRINT[num_ins];
+    UINT32 i = 0;
+    for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins), i++) {
+        counter->pcs[i] = INS_Address(ins);
+        g_pc_bbls[counter->pcs[i]].push_back(counter);
+    }
+    g_bbl_by_addr[addr] = counter;
+    return counter;
+}
+
+VOID Trace(TRACE trace, VOID* v) {
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl)) {
+        BblCounter* counter = get_bbl_counter(bbl);
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)Count_Bbl, IARG_PTR, counter, IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)Resolve_Sites, IARG_PTR, counter, IARG_END);
+    }
+}
+
+// ========== 输入 / 输出 ==========
+
+static bool site_less(const SiteRecord& a, const SiteRecord& b) {
+    return a.index < b.index;
+}
+
+static bool load_randnums(const std::string& filename) {
+    std::ifstream infile(filename.c_str());
+    if (!infile.is_open()) {
+        fprintf(stderr, "[错误] 无法打开随机序号文件: %s\n", filename.c_str());
+        return false;
+    }
+    std::string line;
+    while (std::getline(infile, line)) {
+        std::istringstream iss(line);
+        UINT64 value;
+        if (iss >> value) {
+            SiteRecord site;
+            site.index = value;
+            g_sites.push_back(site);
+        }
+    }
+    std::sort(g_sites.begin(), g_sites.end(), site_less);
+    if (!g_sites.empty())
+        g_next_index = g_sites[0].index;
+    return true;
+}
+
+static std::string escape_json(const std::string& s) {
+    std::string result;
+    for (size_t i = 0; i < s.size(); i++) {
+        switch (s[i]) {
+            case '"': result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\t': result += "\\t"; break;
+            default: result += s[i];
+        }
+    }
+    return result;
+}
+
+static void write_string_list(FILE* fp, const std::vector<std::string>& list) {
+    fprintf(fp, "[");
+    for (size_t i = 0; i < list.size(); i++) {
+        if (i > 0) fprintf(fp, ", ");
+        fprintf(fp, "\"%s\"", escape_json(list[i]).c_str());
+    }
+    fprintf(fp, "]");
+}
+
+VOID Fini(INT32 code, VOID* v) {
+    FILE* fp = fopen(output_file.Value().c_str(), "w");
+    if (!fp) {
+        fprintf(stderr, "[错误] 无法创建输出文件: %s\n", output_file.Value().c_str());
+        return;
+    }
+
+    UINT64 resolved = 0;
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"total_instructions\": %lu,\n", g_icount);
+    fprintf(fp, "  \"sites\": [\n");
+    for (size_t i = 0; i < g_sites.size(); i++) {
+        const SiteRecord& site = g_sites[i];
+        fprintf(fp, "    {\"index\": %lu, \"pc\": \"0x%lx\"", site.index, site.pc);
+
+        // 序号超出程序实际指令数时 pc 为 0（同 randomInst 的 pc:0）
+        std::map<ADDRINT, SiteStatic>::const_iterator it = g_statics.find(site.pc);
+        if (site.pc != 0 && it != g_statics.end()) {
+            const SiteStatic& info = it->second;
+            resolved++;
+            fprintf(fp, ", \"img_name\": \"%s\", \"offset\": \"0x%lx\", \"kth\": %lu",
+                    escape_json(info.img_name).c_str(), info.offset, site.kth);
+            fprintf(fp, ", \"disasm\": \"%s\", \"next_pc\": \"0x%lx\"",
+                    escape_json(info.disasm).c_str(), info.next_pc);
+            fprintf(fp, ", \"reg_kind\": \"%s\", \"target_reg\": \"%s\", \"regw\": ",
+                    info.valid ? info.reg_kind.c_str() : "unknown", info.target_reg.c_str());
+            write_string_list(fp, info.regw);
+            fprintf(fp, ", \"memory_read\": %s, \"memory_write\": %s",
+                    info.mem_read ? "true" : "false", info.mem_write ? "true" : "false");
+            fprintf(fp, ", \"stackr\": \"%s\", \"stackw\": \"%s\"",
+                    info.stackr.c_str(), info.stackw.c_str());
+            fprintf(fp, ", \"base\": \"%s\", \"index_reg\": \"%s\", \"displacement\": %ld, \"scale\": %u",
+                    info.base.c_str(), info.index.c_str(), info.displacement, info.scale);
+            fprintf(fp, ", \"spsize\": ");
+            write_string_list(fp, info.spsize);
+        }
+        fprintf(fp, "}%s\n", i + 1 < g_sites.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n");
+    fprintf(fp, "}\n");
+    fclose(fp);
+
+    fprintf(stderr, "[site_resolver] 总动态指令数: %lu\n", g_icount);
+    fprintf(stderr, "[site_resolver] 解析 %lu / %lu 个序号，结果已写入: %s\n",
+            resolved, (UINT64)g_sites.size(), output_file.Value().c_str());
+}
+
+// ========== 主函数 ==========
+
+INT32 Usage() {
+    cerr << "site_resolver - 单次运行解析注错位置（pc / offset / kth / 寄存器 / 栈信息）" << endl;
+    cerr << endl;
+    cerr << "用法：" << endl;
+    cerr << "  pin -t site_resolver.so -randnumsfile randnums.txt -o sites.json -- ./program args" << endl;
+    cerr << endl;
+    cerr << KNOB_BASE::StringKnobSummary() << endl;
+    return -1;
+}
+
+int main(int argc, char* argv[]) {
+    PIN_InitSymbols();
+    if (PIN_Init(argc, argv)) {
+        return Usage();
+    }
+
+    if (randnums_file.Value().empty()) {
+        fprintf(stderr, "[错误] 必须指定 -randnumsfile 参数\n");
+        return Usage();
+    }
+    if (!load_randnums(randnums_file.Value())) {
+        return Usage();
+    }
+    fprintf(stderr, "[site_resolver] 待解析序号数: %lu\n", (UINT64)g_sites.size());
+
+    TRACE_AddInstrumentFunction(Trace, 0);
+    PIN_AddFiniFunction(Fini, 0);
+
+    PIN_StartProgram();
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * site_resolver.h - 单次运行解析注错位置工具头文件
+ *
+ * 功能：给定 N 个随机全局动态指令序号，一次运行输出每个序号对应的
+ *       pc、镜像偏移、写寄存器、第 K 次执行、下一条指令及栈/基址/索引信息，
+ *       替代 randomInst → findnextinst → determineInst 三次运行
+ */
+
+#ifndef SITE_RESOLVER_H
+#define SITE_RESOLVER_H
+
+#include "pin.H"
+#include <string>
+#include <vector>
+
+// ========== KNOB 参数定义 ==========
+
+KNOB<std::string> randnums_file(KNOB_MODE_WRITEONCE, "pintool",
+    "randnumsfile", "", "随机全局指令序号文件（每行一个，从 1 开始）");
+
+KNOB<std::string> output_file(KNOB_MODE_WRITEONCE, "pintool",
+    "o", "sites.json", "解析结果输出文件");
+
+// ========== 基本块计数器 ==========
+
+/*
+ * 每个基本块一个，在 JIT 时分配
+ * 同一 pc 可能出现在多个基本块中（跳入块中间会生成新块），
+ * 因此某 pc 的执行次数 = 包含它的所有块计数之和
+ */
+struct BblCounter {
+    UINT64 execs;                    // 块执行次数
+    UINT32 num_ins;                  // 块内指令数
+    ADDRINT* pcs;                    // 块内每条指令的地址
+
+    BblCounter() : execs(0), num_ins(0), pcs(NULL) {}
+};
+
+// ========== 指令静态信息（首次采样时提取）==========
+
+struct SiteStatic {
+    bool valid;                      // 是否找到该指令
+    std::string disasm;              // 反汇编
+    std::string img_name;            // 所在镜像
+    ADDRINT offset;                  // 镜像内偏移
+    ADDRINT next_pc;                 // 下一条指令地址
+
+    std::string reg_kind;            // mem / reg / invalid（与 randomInst 一致）
+    std::string target_reg;          // 建议的注错寄存器
+    std::vector<std::string> regw;   // 写寄存器列表
+
+    bool mem_read;
+    bool mem_write;
+    std::string stackr;              // 栈读基址寄存器
+    std::string stackw;              // 栈写基址寄存器
+    std::string base;                // 基址寄存器
+    std::string index;               // 索引寄存器
+    INT64 displacement;              // 偏移
+    UINT32 scale;                    // 缩放因子
+
+    std::vector<std::string> spsize; // 函数序言中 push rbp 之后的压栈及 sub rsp
+
+    SiteStatic() : valid(false), offset(0), next_pc(0), mem_read(false), mem_write(false),
+                   displacement(0), scale(0) {}
+};
+
+// ========== 单个采样点 ==========
+
+struct SiteRecord {
+    UINT64 index;                    // 全局动态指令序号（从 1 开始）
+    ADDRINT pc;                      // 指令地址（0 表示程序未执行到该序号）
+    UINT64 kth;                      // 该 pc 第几次执行（从 1 开始）
+
+    SiteRecord() : index(0), pc(0), kth(0) {}
+};
+
+/**
+ * 从静态指令中提取 targeted_faultinjection.so 需要的信息
+ */
+void collect_site_static(INS ins, SiteStatic& info);
+
+#endif // SITE_RESOLVER_H
@@ -9,6 +9,17 @@
  *       -inject_bit -1 \
  *       -o inject_info.txt \
  *       -- ./program args
+ *
+ *   内存操作数 / 标志寄存器故障（无需 -target_reg，不经过 CONTEXT）：
+ *   pin -t targeted_faultinjection.so \
+ *       -target_pc 0x4019c8 -fault_model mem|flags -target_kth 459 \
+ *       -- ./program args
+ *
+ *   ASLR/PIE 程序使用镜像内偏移（不需要先确定基址）：
+ *   pin -t targeted_faultinjection.so \
+ *       -target_offset 0x19c8 [-target_img libfoo.so] \
+ *       -target_reg rax -target_kth 459 \
+ *       -- ./program args
  */
 
 #include "targeted_faultinjection.h"
@@ -22,16 +33,23 @@ using namespace std;
 
 // ========== 全局变量 ==========
 
-UINT64 g_exec_count = 0;                // 目标指令执行计数
 UINT64 g_total_ins_count = 0;           // 全局动态指令计数
 bool g_injected = false;                 // 是否已注错
 REG g_target_reg_enum = REG_INVALID();   // 目标寄存器枚举
-std::string g_target_inst_disasm = "";   // 目标指令反汇编
-ADDRINT g_next_pc = 0;                   // 下一条指令地址
+FaultModel g_fault_model = FM_REG;       // 故障模型
+CJmpMap g_jmp_map;                       // 条件跳转 -> 依赖的标志位
+REG g_mem_ea_reg = REG_INVALID();        // 内存写的有效地址（IPOINT_BEFORE 写入，按线程保存在工具寄存器中）
+
+// 绝对地址 -> 目标；插桩时每条指令只做一次哈希查找
+std::unordered_map<ADDRINT, TargetSite> g_targets;
+// 尚未换算为绝对地址的镜像内偏移
+std::vector<ADDRINT> g_target_offsets;
 
 // 注错信息
 struct InjectionInfo {
     ADDRINT inject_pc;
+    ADDRINT inject_offset;          // 镜像内偏移
+    std::string inject_img;         // 所在镜像
     std::string inject_inst;
     std::string inject_reg;
     UINT64 inject_kth;
@@ -48,8 +66,24 @@ struct InjectionInfo {
     std::string index;              // 索引寄存器
     INT64 displacement;             // 偏移
     UINT32 scale;                   // 缩放因子
+
+    ADDRINT mem_addr;               // 内存故障：有效地址
+    UINT32 mem_size;                // 内存故障：操作数大小
 } g_inject_info;
 
+// ========== 镜像匹配 ==========
+
+bool image_matches_target(IMG img) {
+    const std::string& want = target_img.Value();
+    if (want.empty()) {
+        return IMG_IsMainExecutable(img);
+    }
+    const std::string name = IMG_Name(img);
+    if (name == want) return true;
+    size_t slash = name.find_last_of('/');
+    return slash != std::string::npos && name.compare(slash + 1, std::string::npos, want) == 0;
+}
+
 // ========== 寄存器名称解析 ==========
 
 REG parse_target_register(const std::string& name) {
@@ -170,6 +204,79 @@ void inject_fault_ymm(CONTEXT* ctxt, REG reg, INT32 bit) {
     g_inject_info.inject_bit = bit;
 }
 
+void inject_fault_mem(ADDRINT ea, UINT32 size, INT32 bit) {
+    UINT64 original = 0;
+    UINT32 copy_size = size < sizeof(original) ? size : sizeof(original);
+    PIN_SafeCopy(&original, reinterpret_cast<VOID*>(ea), copy_size);
+
+    UINT8 byte = 0;
+    ADDRINT byte_addr = ea + bit / 8;
+    PIN_SafeCopy(&byte, reinterpret_cast<VOID*>(byte_addr), 1);
+    byte ^= (1U << (bit % 8));
+    PIN_SafeCopy(reinterpret_cast<VOID*>(byte_addr), &byte, 1);
+
+    UINT64 injected = 0;
+    PIN_SafeCopy(&injected, reinterpret_cast<VOID*>(ea), copy_size);
+
+    g_inject_info.mem_addr = ea;
+    g_inject_info.mem_size = size;
+    g_inject_info.original_value = original;
+    g_inject_info.injected_value = injected;
+    g_inject_info.inject_bit = bit;
+}
+
+// 没有后继条件跳转时可翻转的状态标志位：CF/PF/ZF/SF/OF
+static const UINT32 g_flag_bits[] = {CF_BIT, PF_BIT, ZF_BIT, SF_BIT, OF_BIT};
+
+static bool is_status_flag_bit(INT32 bit) {
+    for (UINT32 i = 0; i < sizeof(g_flag_bits) / sizeof(g_flag_bits[0]); i++) {
+        if (bit == (INT32)g_flag_bits[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void inject_fault_flags(ADDRINT* rflags, BOOL has_jmp, UINT32 jmp_index, INT32 bit) {
+    ADDRINT original = *rflags;
+    ADDRINT temp = original;
+
+    if (!has_jmp) {
+        temp ^= (1UL << bit);
+    } else if (g_jmp_map.findJmpType(jmp_index) == CJmpMap::DEFAULT) {
+        bit = g_jmp_map.findInjectBit(jmp_index);
+        temp ^= (1UL << bit);
+    } else if (g_jmp_map.findJmpType(jmp_index) == CJmpMap::USPECJMP) {
+        // JBE/JA 系列：CF|ZF 决定跳转，翻转其组合结果
+        bit = -1;
+        if ((temp & (1UL << CF_BIT)) || (temp & (1UL << ZF_BIT))) {
+            temp &= ~(1UL << CF_BIT);
+            temp &= ~(1UL << ZF_BIT);
+        } else {
+            temp |= (1UL << ZF_BIT);
+        }
+    } else {
+        // JLE/JG 系列：ZF|(SF!=OF) 决定跳转
+        bit = -1;
+        bool sf = (temp >> SF_BIT) & 1;
+        bool of = (temp >> OF_BIT) & 1;
+        if ((temp & (1UL << ZF_BIT)) || sf != of) {
+            temp &= ~(1UL << ZF_BIT);
+            if (sf != of) {
+                temp ^= (1UL << SF_BIT);
+            }
+        } else {
+            temp |= (1UL << ZF_BIT);
+        }
+    }
+
+    *rflags = temp;
+
+    g_inject_info.original_value = original;
+    g_inject_info.injected_value = temp;
+    g_inject_info.inject_bit = bit;
+}
+
 // ========== 信息输出 ==========
 
 void write_inject_info() {
@@ -180,7 +287,10 @@ void write_inject_info() {
     }
 
     fprintf(fp, "inject_pc: 0x%lx\n", g_inject_info.inject_pc);
+    fprintf(fp, "inject_offset: 0x%lx\n", g_inject_info.inject_offset);
+    fprintf(fp, "inject_img: %s\n", g_inject_info.inject_img.c_str());
     fprintf(fp, "inject_inst: %s\n", g_inject_info.inject_inst.c_str());
+    fprintf(fp, "fault_model: %s\n", fault_model.Value().c_str());
     fprintf(fp, "inject_reg: %s\n", g_inject_info.inject_reg.c_str());
     fprintf(fp, "inject_kth: %lu\n", g_inject_info.inject_kth);
     fprintf(fp, "dynamic_ins_count: %lu\n", g_inject_info.dynamic_ins_count);
@@ -194,6 +304,10 @@ void write_inject_info() {
     fprintf(fp, "index: %s\n", g_inject_info.index.c_str());
     fprintf(fp, "displacement: %ld\n", g_inject_info.displacement);
     fprintf(fp, "scale: %u\n", g_inject_info.scale);
+    if (g_fault_model == FM_MEM) {
+        fprintf(fp, "mem_addr: 0x%lx\n", g_inject_info.mem_addr);
+        fprintf(fp, "mem_size: %u\n", g_inject_info.mem_size);
+    }
 
     fclose(fp);
     fprintf(stderr, "[targeted_fi] 注错信息已写入: %s\n", output_file.Value().c_str());
@@ -206,43 +320,75 @@ VOID Count_Ins() {
     g_total_ins_count++;
 }
 
-VOID Analyze_TargetInst(THREADID tid, ADDRINT ip, CONTEXT* ctxt, VOID* v) {
-    g_exec_count++;
-
-    // 检查是否达到注错时机
-    if (g_exec_count == target_kth.Value() && !g_injected) {
-        fprintf(stderr, "[targeted_fi] 第 %lu 次执行目标指令 0x%lx，开始注错\n",
-                g_exec_count, ip);
+// 初始化随机数种子；同一秒内并发启动的注错进程需通过 -seed 区分
+static VOID seed_random() {
+    UINT32 seed = random_seed.Value();
+    srand(seed != 0 ? seed : (UINT32)time(NULL));
+}
 
-        // 读取寄存器原值
-        UINT32 bit_width = get_reg_bit_width(g_target_reg_enum);
-        INT32 bit = inject_bit.Value();
+// 确定注入比特位置（-inject_bit 指定或随机）
+static INT32 choose_inject_bit(UINT32 bit_width) {
+    INT32 bit = inject_bit.Value();
 
-        // 确定注入比特位置
-        if (bit == -1) {
-            // 随机选择比特位
-            srand(time(NULL));
-            if (high_bit_only.Value()) {
-                bit = (bit_width / 2) + (rand() % (bit_width / 2));
-            } else {
-                bit = rand() % bit_width;
-            }
+    if (bit == -1) {
+        // 随机选择比特位
+        seed_random();
+        if (high_bit_only.Value()) {
+            bit = (bit_width / 2) + (rand() % (bit_width / 2));
+        } else {
+            bit = rand() % bit_width;
         }
+    }
 
-        // 检查比特位置是否合法
-        if (bit >= (INT32)bit_width) {
-            fprintf(stderr, "[警告] 注入比特 %d 超出寄存器位宽 %u，调整为 %u\n",
-                    bit, bit_width, bit_width - 1);
-            bit = bit_width - 1;
-        }
+    // 检查比特位置是否合法
+    if (bit >= (INT32)bit_width) {
+        fprintf(stderr, "[警告] 注入比特 %d 超出位宽 %u，调整为 %u\n",
+                bit, bit_width, bit_width - 1);
+        bit = bit_width - 1;
+    }
+    return bit;
+}
+
+// 填充注错信息中与目标指令相关的部分
+static void fill_site_info(TargetSite* site, ADDRINT ip) {
+    g_inject_info.inject_pc = ip;
+    g_inject_info.inject_offset = site->offset;
+    g_inject_info.inject_img = site->img_name;
+    g_inject_info.inject_inst = site->disasm;
+    g_inject_info.inject_kth = site->exec_count;
+    g_inject_info.dynamic_ins_count = g_total_ins_count;
+    g_inject_info.next_pc = site->next_pc;
+    g_inject_info.regw_list = site->regw_list;
+    g_inject_info.stackw = site->stackw;
+    g_inject_info.base = site->base;
+    g_inject_info.index = site->index;
+    g_inject_info.displacement = site->displacement;
+    g_inject_info.scale = site->scale;
+}
+
+static void finish_injection() {
+    write_inject_info();
+
+    g_injected = true;
+
+    fprintf(stderr, "[targeted_fi] 注错完成: %s bit %d (0x%lx -> 0x%lx)\n",
+            g_inject_info.inject_reg.c_str(), g_inject_info.inject_bit,
+            g_inject_info.original_value, g_inject_info.injected_value);
+}
+
+VOID Analyze_TargetInst(THREADID tid, ADDRINT ip, CONTEXT* ctxt, TargetSite* site) {
+    site->exec_count++;
+
+    // 检查是否达到注错时机
+    if (site->exec_count == target_kth.Value() && !g_injected) {
+        fprintf(stderr, "[targeted_fi] 第 %lu 次执行目标指令 0x%lx，开始注错\n",
+                site->exec_count, ip);
+
+        INT32 bit = choose_inject_bit(get_reg_bit_width(g_target_reg_enum));
 
         // 填充注错信息
-        g_inject_info.inject_pc = ip;
-        g_inject_info.inject_inst = g_target_inst_disasm;
+        fill_site_info(site, ip);
         g_inject_info.inject_reg = target_reg.Value();
-        g_inject_info.inject_kth = g_exec_count;
-        g_inject_info.dynamic_ins_count = g_total_ins_count;
-        g_inject_info.next_pc = g_next_pc;
 
         // 执行注错
         if (REG_is_xmm(g_target_reg_enum)) {
@@ -253,22 +399,138 @@ VOID Analyze_TargetInst(THREADID tid, ADDRINT ip, CONTEXT* ctxt, VOID* v) {
             inject_fault_gpr(ctxt, g_target_reg_enum, bit);
         }
 
-        // 写入注错信息
-        write_inject_info();
-
-        g_injected = true;
-
-        fprintf(stderr, "[targeted_fi] 注错完成: %s bit %d (0x%lx -> 0x%lx)\n",
-                target_reg.Value().c_str(), bit,
-                g_inject_info.original_value, g_inject_info.injected_value);
+        finish_injection();
 
         // 继续执行
         PIN_ExecuteAt(ctxt);
     }
 }
 
+// 内存读：在指令读取之前翻转操作数，不需要 CONTEXT
+VOID Analyze_MemRead(ADDRINT ip, ADDRINT ea, UINT32 size, TargetSite* site) {
+    site->exec_count++;
+
+    if (site->exec_count == target_kth.Value() && !g_injected) {
+        fprintf(stderr, "[targeted_fi] 第 %lu 次执行目标指令 0x%lx，内存读注错 [0x%lx]\n",
+                site->exec_count, ip, ea);
+
+        fill_site_info(site, ip);
+        g_inject_info.inject_reg = "mem";
+        inject_fault_mem(ea, size, choose_inject_bit(size * 8));
+        finish_injection();
+    }
+}
+
+// 内存写：IPOINT_BEFORE 把有效地址写入工具寄存器 g_mem_ea_reg，IPOINT_AFTER 读回并翻转写入的值
+// 工具寄存器按线程保存，多线程执行同一条指令时互不覆盖
+ADDRINT Record_MemWriteEA(ADDRINT ea) {
+    return ea;
+}
+
+VOID Analyze_MemWrite(ADDRINT ip, ADDRINT ea, UINT32 size, TargetSite* site) {
+    site->exec_count++;
+
+    if (site->exec_count == target_kth.Value() && !g_injected) {
+        fprintf(stderr, "[targeted_fi] 第 %lu 次执行目标指令 0x%lx，内存写注错 [0x%lx]\n",
+                site->exec_count, ip, ea);
+
+        fill_site_info(site, ip);
+        g_inject_info.inject_reg = "mem";
+        inject_fault_mem(ea, size, choose_inject_bit(size * 8));
+        finish_injection();
+    }
+}
+
+// 标志寄存器：IPOINT_AFTER 通过寄存器引用修改，返回后即生效，不需要 PIN_ExecuteAt
+VOID Analyze_Flags(ADDRINT ip, ADDRINT* rflags, BOOL has_jmp, UINT32 jmp_index, TargetSite* site) {
+    site->exec_count++;
+
+    if (site->exec_count == target_kth.Value() && !g_injected) {
+        fprintf(stderr, "[targeted_fi] 第 %lu 次执行目标指令 0x%lx，标志寄存器注错\n",
+                site->exec_count, ip);
+
+        // 没有后继条件跳转时，在 CF/PF/ZF/SF/OF 中选择（指定的 -inject_bit 已在启动时检查）
+        INT32 bit = inject_bit.Value();
+        if (!has_jmp && bit == -1) {
+            seed_random();
+            bit = g_flag_bits[rand() % (sizeof(g_flag_bits) / sizeof(g_flag_bits[0]))];
+        }
+
+        fill_site_info(site, ip);
+        g_inject_info.inject_reg = "rflags";
+        inject_fault_flags(rflags, has_jmp, jmp_index, bit);
+        finish_injection();
+    }
+}
+
 // ========== 插桩函数 ==========
 
+// 内存故障：有内存读时在读之前翻转，否则在写之后翻转
+// 使用 predicated call，cmov 等谓词指令只统计实际访存的执行
+static void InstrumentMemFault(INS ins, TargetSite* site) {
+    if (INS_IsMemoryRead(ins)) {
+        site->mem_size = INS_MemoryReadSize(ins);
+        INS_InsertPredicatedCall(
+            ins, IPOINT_BEFORE, (AFUNPTR)Analyze_MemRead,
+            IARG_INST_PTR,
+            IARG_MEMORYREAD_EA,
+            IARG_MEMORYREAD_SIZE,
+            IARG_PTR, site,
+            IARG_END
+        );
+    } else if (INS_IsMemoryWrite(ins) && INS_HasFallThrough(ins)) {
+        site->mem_size = INS_MemoryWriteSize(ins);
+        INS_InsertPredicatedCall(
+            ins, IPOINT_BEFORE, (AFUNPTR)Record_MemWriteEA,
+            IARG_MEMORYWRITE_EA,
+            IARG_RETURN_REGS, g_mem_ea_reg,
+            IARG_END
+        );
+        INS_InsertPredicatedCall(
+            ins, IPOINT_AFTER, (AFUNPTR)Analyze_MemWrite,
+            IARG_INST_PTR,
+            IARG_REG_VALUE, g_mem_ea_reg,
+            IARG_UINT32, site->mem_size,
+            IARG_PTR, site,
+            IARG_END
+        );
+    } else {
+        fprintf(stderr, "[警告] 目标指令 0x%lx 没有可注错的内存操作数: %s\n",
+                site->addr, site->disasm.c_str());
+    }
+}
+
+// 标志寄存器故障：指令写完标志之后修改；后继为条件跳转时复用 CJmpMap 选择标志位
+static void InstrumentFlagsFault(INS ins, TargetSite* site) {
+    if (!INS_HasFallThrough(ins)) {
+        fprintf(stderr, "[警告] 目标指令 0x%lx 没有顺序后继，无法注入标志寄存器故障: %s\n",
+                site->addr, site->disasm.c_str());
+        return;
+    }
+
+    BOOL has_jmp = false;
+    UINT32 jmp_index = 0;
+    INS next_ins = INS_Next(ins);
+    if (INS_Valid(next_ins) && INS_Category(next_ins) == XED_CATEGORY_COND_BR) {
+        std::string jmp_name = OPCODE_StringShort(INS_Opcode(next_ins));
+        // JCXZ/JECXZ/JRCXZ 不依赖标志位，不在 CJmpMap 中
+        if (jmp_name.find("CXZ") == std::string::npos) {
+            has_jmp = true;
+            jmp_index = g_jmp_map.findJmpIndex(jmp_name);
+        }
+    }
+
+    INS_InsertCall(
+        ins, IPOINT_AFTER, (AFUNPTR)Analyze_Flags,
+        IARG_INST_PTR,
+        IARG_REG_REFERENCE, REG_GFLAGS,
+        IARG_BOOL, has_jmp,
+        IARG_UINT32, jmp_index,
+        IARG_PTR, site,
+        IARG_END
+    );
+}
+
 VOID Instruction(INS ins, VOID* v) {
     ADDRINT ip = INS_Address(ins);
 
@@ -276,13 +538,15 @@ VOID Instruction(INS ins, VOID* v) {
     INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)Count_Ins, IARG_END);
 
     // 检查是否为目标指令
-    if (ip == target_pc.Value()) {
-        fprintf(stderr, "[targeted_fi] 找到目标指令: 0x%lx: %s\n",
-                ip, INS_Disassemble(ins).c_str());
+    std::unordered_map<ADDRINT, TargetSite>::iterator it = g_targets.find(ip);
+    if (it != g_targets.end()) {
+        TargetSite* site = &it->second;
+        fprintf(stderr, "[targeted_fi] 找到目标指令: 0x%lx (offset 0x%lx): %s\n",
+                ip, site->offset, INS_Disassemble(ins).c_str());
 
         // 保存指令信息
-        g_target_inst_disasm = INS_Disassemble(ins);
-        g_next_pc = INS_NextAddress(ins);
+        site->disasm = INS_Disassemble(ins);
+        site->next_pc = INS_NextAddress(ins);
 
         // 提取内存操作信息
         if (INS_IsMemoryRead(ins) || INS_IsMemoryWrite(ins)) {
@@ -290,25 +554,25 @@ VOID Instruction(INS ins, VOID* v) {
             REG index_reg = INS_MemoryIndexReg(ins);
 
             if (REG_valid(base_reg)) {
-                g_inject_info.base = REG_StringShort(base_reg);
+                site->base = REG_StringShort(base_reg);
             } else {
-                g_inject_info.base = "none";
+                site->base = "none";
             }
 
             if (REG_valid(index_reg)) {
-                g_inject_info.index = REG_StringShort(index_reg);
-                g_inject_info.scale = INS_MemoryScale(ins);
+                site->index = REG_StringShort(index_reg);
+                site->scale = INS_MemoryScale(ins);
             } else {
-                g_inject_info.index = "none";
-                g_inject_info.scale = 0;
+                site->index = "none";
+                site->scale = 0;
             }
 
-            g_inject_info.displacement = INS_MemoryDisplacement(ins);
+            site->displacement = INS_MemoryDisplacement(ins);
         } else {
-            g_inject_info.base = "none";
-            g_inject_info.index = "none";
-            g_inject_info.displacement = 0;
-            g_inject_info.scale = 0;
+            site->base = "none";
+            site->index = "none";
+            site->displacement = 0;
+            site->scale = 0;
         }
 
         // 提取写寄存器
@@ -321,10 +585,19 @@ VOID Instruction(INS ins, VOID* v) {
                 regw_list += REG_StringShort(reg);
             }
         }
-        g_inject_info.regw_list = regw_list.empty() ? "none" : regw_list;
+        site->regw_list = regw_list.empty() ? "none" : regw_list;
 
         // 检查是否为栈写
-        g_inject_info.stackw = INS_IsStackWrite(ins) ? "yes" : "no";
+        site->stackw = INS_IsStackWrite(ins) ? "yes" : "no";
+
+        if (g_fault_model == FM_MEM) {
+            InstrumentMemFault(ins, site);
+            return;
+        }
+        if (g_fault_model == FM_FLAGS) {
+            InstrumentFlagsFault(ins, site);
+            return;
+        }
 
         // 插入分析回调（IPOINT_BEFORE）
         // 注意：使用 IPOINT_BEFORE 确保在指令执行前修改寄存器
@@ -334,21 +607,66 @@ VOID Instruction(INS ins, VOID* v) {
             IARG_THREAD_ID,
             IARG_INST_PTR,
             IARG_CONTEXT,
-            IARG_PTR, NULL,
+            IARG_PTR, site,
             IARG_END
         );
     }
 }
 
+// ========== 镜像加载回调 ==========
+
+/*
+ * 在镜像加载时把 -target_offset 换算为绝对地址
+ * 镜像的代码只会在加载之后才被插桩，因此此时登记目标不会漏掉
+ */
+VOID ImageLoad(IMG img, VOID* v) {
+    ADDRINT low = IMG_LowAddress(img);
+    ADDRINT high = IMG_HighAddress(img);
+
+    // -target_pc 给出的绝对地址：补全其所在镜像和偏移，便于记录
+    for (std::unordered_map<ADDRINT, TargetSite>::iterator it = g_targets.begin();
+         it != g_targets.end(); ++it) {
+        TargetSite& site = it->second;
+        if (site.img_name.empty() && site.addr >= low && site.addr <= high) {
+            site.img_name = IMG_Name(img);
+            site.offset = site.addr - low;
+        }
+    }
+
+    if (g_target_offsets.empty() || !image_matches_target(img)) return;
+
+    for (size_t i = 0; i < g_target_offsets.size(); i++) {
+        ADDRINT addr = low + g_target_offsets[i];
+        TargetSite& site = g_targets[addr];
+        site.addr = addr;
+        site.offset = g_target_offsets[i];
+        site.img_name = IMG_Name(img);
+        fprintf(stderr, "[targeted_fi] 目标 offset 0x%lx -> 0x%lx (%s)\n",
+                site.offset, addr, site.img_name.c_str());
+    }
+    g_target_offsets.clear();
+}
+
 // ========== Fini 回调 ==========
 
 VOID Fini(INT32 code, VOID* v) {
-    fprintf(stderr, "[targeted_fi] 程序退出，目标指令共执行 %lu 次\n", g_exec_count);
+    UINT64 max_exec_count = 0;
+    for (std::unordered_map<ADDRINT, TargetSite>::const_iterator it = g_targets.begin();
+         it != g_targets.end(); ++it) {
+        fprintf(stderr, "[targeted_fi] 程序退出，目标指令 0x%lx (offset 0x%lx) 共执行 %lu 次\n",
+                it->first, it->second.offset, it->second.exec_count);
+        max_exec_count = std::max(max_exec_count, it->second.exec_count);
+    }
     fprintf(stderr, "[targeted_fi] 总动态指令数: %lu\n", g_total_ins_count);
 
+    if (!g_target_offsets.empty()) {
+        fprintf(stderr, "[警告] 未找到镜像 %s，-target_offset 未生效\n",
+                target_img.Value().empty() ? "(主程序)" : target_img.Value().c_str());
+    }
+
     if (!g_injected) {
         fprintf(stderr, "[警告] 未执行注错！目标指令执行次数 %lu < 目标次数 %lu\n",
-                g_exec_count, target_kth.Value());
+                max_exec_count, target_kth.Value());
     }
 }
 
@@ -366,6 +684,9 @@ INT32 Usage() {
     cerr << "      -o inject_info.txt \\" << endl;
     cerr << "      -- ./program args" << endl;
     cerr << endl;
+    cerr << "  用 -target_offset 0x19c8 [-target_img name] 代替 -target_pc，" << endl;
+    cerr << "  在镜像加载时换算绝对地址，适用于开启 ASLR 的 PIE 程序" << endl;
+    cerr << endl;
     cerr << KNOB_BASE::StringKnobSummary() << endl;
     return -1;
 }
@@ -377,23 +698,67 @@ int main(int argc, char* argv[]) {
     }
 
     // 检查必需参数
-    if (target_pc.Value() == 0) {
-        fprintf(stderr, "[错误] 必须指定 -target_pc 参数\n");
+    for (UINT32 i = 0; i < target_offset.NumberOfValues(); i++) {
+        const std::string& value = target_offset.Value(i);
+        if (!value.empty()) {
+            g_target_offsets.push_back(strtoull(value.c_str(), NULL, 0));
+        }
+    }
+
+    if (target_pc.Value() == 0 && g_target_offsets.empty()) {
+        fprintf(stderr, "[错误] 必须指定 -target_pc 或 -target_offset 参数\n");
         return Usage();
     }
 
-    if (target_reg.Value().empty()) {
-        fprintf(stderr, "[错误] 必须指定 -target_reg 参数\n");
+    if (target_pc.Value() != 0) {
+        g_targets[target_pc.Value()].addr = target_pc.Value();
+    }
+
+    if (fault_model.Value() == "mem") {
+        g_fault_model = FM_MEM;
+    } else if (fault_model.Value() == "flags") {
+        g_fault_model = FM_FLAGS;
+    } else if (fault_model.Value() != "reg") {
+        fprintf(stderr, "[错误] 无法识别故障模型: %s\n", fault_model.Value().c_str());
         return Usage();
     }
 
-    // 解析目标寄存器
-    g_target_reg_enum = parse_target_register(target_reg.Value());
-    fprintf(stderr, "[targeted_fi] 目标寄存器: %s (Pin REG: %s)\n",
-            target_reg.Value().c_str(), REG_StringShort(g_target_reg_enum).c_str());
+    if (g_fault_model == FM_MEM) {
+        g_mem_ea_reg = PIN_ClaimToolRegister();
+        if (!REG_valid(g_mem_ea_reg)) {
+            fprintf(stderr, "[错误] 无法分配工具寄存器\n");
+            return 1;
+        }
+    }
+
+    if (g_fault_model == FM_FLAGS && inject_bit.Value() != -1 && !is_status_flag_bit(inject_bit.Value())) {
+        fprintf(stderr, "[错误] flags 模型的 -inject_bit 必须为 -1 或 CF/PF/ZF/SF/OF 位 (%u/%u/%u/%u/%u): %d\n",
+                CF_BIT, PF_BIT, ZF_BIT, SF_BIT, OF_BIT, inject_bit.Value());
+        return Usage();
+    }
+
+    if (g_fault_model == FM_REG) {
+        if (target_reg.Value().empty()) {
+            fprintf(stderr, "[错误] 必须指定 -target_reg 参数\n");
+            return Usage();
+        }
+
+        // 解析目标寄存器
+        g_target_reg_enum = parse_target_register(target_reg.Value());
+        fprintf(stderr, "[targeted_fi] 目标寄存器: %s (Pin REG: %s)\n",
+                target_reg.Value().c_str(), REG_StringShort(g_target_reg_enum).c_str());
+    } else {
+        fprintf(stderr, "[targeted_fi] 故障模型: %s\n", fault_model.Value().c_str());
+    }
 
     // 打印配置信息
-    fprintf(stderr, "[targeted_fi] 目标 PC: 0x%lx\n", target_pc.Value());
+    if (target_pc.Value() != 0) {
+        fprintf(stderr, "[targeted_fi] 目标 PC: 0x%lx\n", target_pc.Value());
+    }
+    for (size_t i = 0; i < g_target_offsets.size(); i++) {
+        fprintf(stderr, "[targeted_fi] 目标 offset: 0x%lx (%s)\n", g_target_offsets[i],
+                target_img.Value().empty() ? "主程序" : target_img.Value().c_str());
+    }
     fprintf(stderr, "[targeted_fi] 目标执行次数: %lu\n", target_kth.Value());
     fprintf(stderr, "[targeted_fi] 注入比特: %d %s\n",
             inject_bit.Value(),
@@ -401,6 +766,7 @@ int main(int argc, char* argv[]) {
     fprintf(stderr, "[targeted_fi] 输出文件: %s\n", output_file.Value().c_str());
 
     // 注册回调
+    IMG_AddInstrumentFunction(ImageLoad, 0);
     INS_AddInstrumentFunction(Instruction, 0);
     PIN_AddFiniFunction(Fini, 0);
 
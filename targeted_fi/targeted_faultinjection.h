@@ -8,7 +8,9 @@
 #define TARGETED_FAULTINJECTION_H
 
 #include "pin.H"
+#include "../fi_cjmp_map.h"
 #include <map>
+#include <unordered_map>
 #include <string>
 #include <cstdio>
 #include <cstdlib>
@@ -18,8 +20,17 @@
 KNOB<UINT64> target_pc(KNOB_MODE_WRITEONCE, "pintool",
     "target_pc", "0", "目标指令地址（绝对地址）");
 
+KNOB<std::string> target_offset(KNOB_MODE_APPEND, "pintool",
+    "target_offset", "", "目标指令镜像内偏移（可多次指定），在镜像加载时换算为绝对地址");
+
+KNOB<std::string> target_img(KNOB_MODE_WRITEONCE, "pintool",
+    "target_img", "", "-target_offset 所属镜像名（空=主程序），匹配完整路径或文件名");
+
 KNOB<std::string> target_reg(KNOB_MODE_WRITEONCE, "pintool",
-    "target_reg", "", "目标寄存器名称（如 rax, xmm0）");
+    "target_reg", "", "目标寄存器名称（如 rax, xmm0），仅 reg 模型需要");
+
+KNOB<std::string> fault_model(KNOB_MODE_WRITEONCE, "pintool",
+    "fault_model", "reg", "故障模型：reg=寄存器, mem=内存操作数, flags=标志寄存器");
 
 KNOB<UINT64> target_kth(KNOB_MODE_WRITEONCE, "pintool",
     "target_kth", "1", "在第 K 次执行时注错（从 1 开始）");
@@ -30,9 +41,46 @@ KNOB<INT32> inject_bit(KNOB_MODE_WRITEONCE, "pintool",
 KNOB<BOOL> high_bit_only(KNOB_MODE_WRITEONCE, "pintool",
     "high_bit_only", "0", "是否只在高位注错");
 
+KNOB<UINT32> random_seed(KNOB_MODE_WRITEONCE, "pintool",
+    "seed", "0", "随机比特选择的种子（0=当前时间；并发注错时应各不相同）");
+
 KNOB<std::string> output_file(KNOB_MODE_WRITEONCE, "pintool",
     "o", "inject_info.txt", "注错信息输出文件");
 
+// ========== 故障模型 ==========
+
+enum FaultModel {
+    FM_REG = 0,      // GPR/XMM/YMM，通过 CONTEXT + PIN_ExecuteAt
+    FM_MEM = 1,      // 内存操作数，按有效地址原地翻转
+    FM_FLAGS = 2     // RFLAGS，通过寄存器引用原地修改
+};
+
+// ========== 注错目标 ==========
+
+/*
+ * 单个目标指令，在插桩时填充静态信息
+ * -target_pc 直接给出绝对地址；-target_offset 在镜像加载时换算
+ */
+struct TargetSite {
+    ADDRINT addr;                   // 运行时绝对地址
+    ADDRINT offset;                 // 镜像内偏移
+    std::string img_name;           // 所在镜像
+    UINT64 exec_count;              // 该目标的执行计数
+
+    std::string disasm;             // 指令反汇编
+    ADDRINT next_pc;                // 下一条指令地址
+    std::string regw_list;          // 写寄存器列表
+    std::string stackw;             // 是否栈写
+    std::string base;               // 基址寄存器
+    std::string index;              // 索引寄存器
+    INT64 displacement;             // 偏移
+    UINT32 scale;                   // 缩放因子
+    UINT32 mem_size;                // 内存操作数大小（字节）
+
+    TargetSite() : addr(0), offset(0), exec_count(0), next_pc(0),
+                   displacement(0), scale(0), mem_size(0) {}
+};
+
 // ========== 寄存器位宽查询 ==========
 
 /**
@@ -71,6 +119,11 @@ inline UINT32 get_reg_bit_width(REG reg) {
     return 64;  // 默认64位
 }
 
+/**
+ * 判断镜像名是否与 -target_img 匹配（空=主程序）
+ */
+bool image_matches_target(IMG img);
+
 /**
  * 解析寄存器名称，返回 Pin 的 REG 枚举
  */
@@ -91,4 +144,15 @@ void inject_fault_xmm(CONTEXT* ctxt, REG reg, INT32 bit);
  */
 void inject_fault_ymm(CONTEXT* ctxt, REG reg, INT32 bit);
 
+/**
+ * 对内存操作数进行故障注入（按有效地址原地翻转，不需要 CONTEXT）
+ */
+void inject_fault_mem(ADDRINT ea, UINT32 size, INT32 bit);
+
+/**
+ * 对标志寄存器进行故障注入（不需要 CONTEXT）
+ * has_jmp 为真时按后继条件跳转翻转其依赖的标志位（同 faultinjection.cpp）
+ */
+void inject_fault_flags(ADDRINT* rflags, BOOL has_jmp, UINT32 jmp_index, INT32 bit);
+
 #endif // TARGETED_FAULTINJECTION_H